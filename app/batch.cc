@@ -0,0 +1,274 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * Batch mode: convert many HEIF files in one process on a pool of worker
+ * threads
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "batch.h"
+#include "decoder.h"
+#include "pipeline.h"
+
+namespace fs = std::filesystem;
+
+bool has_heif_extension(const std::string &path)
+{
+    std::string ext = fs::path(path).extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+
+    return ext == ".heic" || ext == ".heif" || ext == ".hif";
+}
+
+/* Matches name against a pattern containing '*' and '?' wildcards */
+static bool wildcard_match(const std::string &pattern, const std::string &name)
+{
+    size_t p = 0, n = 0;
+    size_t star = std::string::npos, mark = 0;
+
+    while (n < name.size()) {
+        if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == name[n])) {
+            p++;
+            n++;
+        } else if (p < pattern.size() && pattern[p] == '*') {
+            star = p++;
+            mark = n;
+        } else if (star != std::string::npos) {
+            p = star + 1;
+            n = ++mark;
+        } else {
+            return false;
+        }
+    }
+
+    while (p < pattern.size() && pattern[p] == '*')
+        p++;
+
+    return p == pattern.size();
+}
+
+static bool read_manifest(const std::string &manifest_filename,
+                          std::vector<std::string> &inputs)
+{
+    std::ifstream manifest(manifest_filename);
+    if (manifest.fail()) {
+        std::cerr << "Can't open manifest " << manifest_filename << std::endl;
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(manifest, line)) {
+        /* Tolerate manifests written on Windows */
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (line.empty() || line[0] == '#')
+            continue;
+        inputs.push_back(line);
+    }
+
+    return true;
+}
+
+bool expand_batch_inputs(const std::vector<std::string> &specs,
+                         std::vector<std::string> &inputs)
+{
+    std::error_code ec;
+
+    for (const auto &spec : specs) {
+        if (spec.starts_with("@")) {
+            if (!read_manifest(spec.substr(1), inputs))
+                return false;
+            continue;
+        }
+
+        fs::path path(spec);
+
+        if (fs::is_directory(path, ec)) {
+            std::vector<std::string> found;
+            for (const auto &entry : fs::directory_iterator(path, ec)) {
+                if (entry.is_regular_file(ec) && has_heif_extension(entry.path().string()))
+                    found.push_back(entry.path().string());
+            }
+            std::sort(found.begin(), found.end());
+            inputs.insert(inputs.end(), found.begin(), found.end());
+            continue;
+        }
+
+        std::string pattern = path.filename().string();
+        if (pattern.find_first_of("*?") == std::string::npos) {
+            inputs.push_back(spec);
+            continue;
+        }
+
+        fs::path dir = path.parent_path();
+        if (dir.empty())
+            dir = ".";
+
+        std::vector<std::string> found;
+        for (const auto &entry : fs::directory_iterator(dir, ec)) {
+            if (entry.is_regular_file(ec) &&
+                wildcard_match(pattern, entry.path().filename().string()))
+                found.push_back((path.parent_path() / entry.path().filename()).string());
+        }
+        if (ec) {
+            std::cerr << "Can't read directory " << dir.string() << ": "
+                      << ec.message() << std::endl;
+            return false;
+        }
+        if (found.empty()) {
+            std::cerr << "No files match " << spec << std::endl;
+            return false;
+        }
+        std::sort(found.begin(), found.end());
+        inputs.insert(inputs.end(), found.begin(), found.end());
+    }
+
+    return true;
+}
+
+std::string batch_output_filename(const std::string &input_filename,
+                                  const struct heif2jpg_batch_options &options)
+{
+    std::string output_filename =
+        derive_output_filename(input_filename, output_suffix(options.output_p010,
+                                                             options.preview_width != 0));
+
+    if (options.output_dir.empty())
+        return output_filename;
+
+    return (fs::path(options.output_dir) / fs::path(output_filename).filename()).string();
+}
+
+int run_batch(const std::vector<std::string> &inputs,
+              const struct heif2jpg_batch_options &options)
+{
+    std::vector<struct heif2jpg_pipeline_file> files;
+    for (const auto &input_filename : inputs)
+        files.push_back({input_filename, batch_output_filename(input_filename, options)});
+
+    return run_batch_files(files, options);
+}
+
+/*
+ * Images the pipeline will convert, at most: one per image that's already
+ * open, and as many as options.images can pick from each file it opens
+ */
+static size_t count_batch_images(const std::vector<struct heif2jpg_pipeline_file> &files,
+                                 const struct heif2jpg_batch_options &options)
+{
+    size_t per_file = count_selected_images(options.images);
+    size_t num_images = 0;
+
+    for (const auto &file : files) {
+        size_t n = file.ctx ? 1 : per_file;
+        num_images = n > SIZE_MAX - num_images ? SIZE_MAX : num_images + n;
+    }
+
+    return num_images;
+}
+
+/*
+ * Splits num_workers cores for num_images images, filling in whatever
+ * options leave at 0. Whole images in parallel scale better than threads
+ * inside one decode, so decodes only get extra threads from cores that no
+ * decode or encode thread would keep busy, as with a few large files.
+ */
+static unsigned int plan_threads(const struct heif2jpg_batch_options &options, size_t num_images,
+                                 struct heif2jpg_pipeline_options &pipeline_options)
+{
+    unsigned int num_workers = options.num_workers;
+    if (num_workers == 0)
+        num_workers = std::max(1u, std::thread::hardware_concurrency());
+
+    /*
+     * Split the workers between the two heavy stages so decoding the next
+     * file overlaps encoding the current one. Packing and writing are
+     * memory/IO bound and only need a thread each.
+     */
+    unsigned int decode_workers = (num_workers + 1) / 2;
+    unsigned int encode_workers = std::max(1u, num_workers / 2);
+
+    /* Each decode feeds one encode per rendition, so encoders get the larger share */
+    unsigned int num_renditions = std::max(1u, (unsigned int)options.renditions.size());
+    if (num_renditions > 1) {
+        decode_workers = std::max(1u, num_workers / (num_renditions + 1));
+        encode_workers = std::max(1u, num_workers - decode_workers);
+    }
+
+    if (options.encode_workers)
+        encode_workers = options.encode_workers;
+
+    /*
+     * Decoders past the number of images would have nothing to do, and past
+     * what the encoders and queue can take they'd only hold decoded images
+     * while they wait to hand them on
+     */
+    if (options.decode_workers) {
+        decode_workers = options.decode_workers;
+    } else {
+        decode_workers = std::min(decode_workers, (unsigned int)std::max<size_t>(1, num_images));
+        decode_workers = std::min(decode_workers,
+                                  encode_workers + (unsigned int)options.queue_depth);
+    }
+
+    pipeline_options.decode_threads = decode_workers;
+    pipeline_options.pack_threads = 1;
+    pipeline_options.encode_threads = encode_workers;
+
+    if (options.decode_threads)
+        return options.decode_threads;
+
+    size_t num_encodes = std::max<size_t>(1, num_images);
+    num_encodes = num_encodes > SIZE_MAX / num_renditions ? SIZE_MAX : num_encodes * num_renditions;
+    unsigned int busy = decode_workers + (unsigned int)std::min<size_t>(encode_workers, num_encodes);
+
+    return 1 + (num_workers > busy ? (num_workers - busy) / decode_workers : 0);
+}
+
+int run_batch_files(const std::vector<struct heif2jpg_pipeline_file> &files,
+                    const struct heif2jpg_batch_options &options)
+{
+    struct heif2jpg_pipeline_options pipeline_options;
+
+    set_heif_decoding_threads(plan_threads(options, count_batch_images(files, options), pipeline_options));
+    for (const auto &file : files) {
+        if (file.ctx)
+            apply_heif_decoding_threads(file.ctx.get());
+    }
+
+    pipeline_options.write_threads = options.write_threads;
+    pipeline_options.queue_depth = options.queue_depth;
+    pipeline_options.prefetch = options.prefetch;
+    pipeline_options.output_p010 = options.output_p010;
+    pipeline_options.write_mode = options.write_mode;
+    pipeline_options.stats = options.stats;
+    pipeline_options.tiled = options.tiled;
+    pipeline_options.images = options.images;
+    pipeline_options.preview_width = options.preview_width;
+    pipeline_options.encode_options = options.encode_options;
+    pipeline_options.renditions = options.renditions;
+    pipeline_options.max_memory = options.max_memory;
+    pipeline_options.converted = options.converted;
+
+    std::unique_ptr<ConversionCache> cache;
+    if (!options.cache_dir.empty()) {
+        cache = std::make_unique<ConversionCache>(options.cache_dir, options.cache_max_bytes);
+        if (cache->open())
+            return 1;
+        pipeline_options.cache = cache.get();
+    }
+
+    return run_pipeline(files, pipeline_options);
+}
@@ -0,0 +1,98 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * Batch mode: convert many HEIF files in one process on a pool of worker
+ * threads
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#ifndef HEIF2JPG_BATCH_H
+#define HEIF2JPG_BATCH_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "convert.h"
+#include "pipeline.h"
+
+struct heif2jpg_batch_options {
+    /* Number of worker threads; 0 means one per hardware thread */
+    unsigned int num_workers;
+    /*
+     * Threads for the decode and encode stages, and threads libheif may use
+     * inside each decode; 0 lets run_batch_files() pick from num_workers
+     */
+    unsigned int decode_workers = 0;
+    unsigned int encode_workers = 0;
+    unsigned int decode_threads = 0;
+    /* Images allowed to wait between pipeline stages */
+    size_t queue_depth;
+    /* Input files read ahead of the decoders; 0 maps them as they're opened */
+    size_t prefetch = 0;
+    /* Threads writing outputs */
+    unsigned int write_threads = 1;
+    /* Directory to write outputs to; empty means next to each input */
+    std::string output_dir;
+    bool output_p010;
+    enum heif2jpg_write_mode write_mode;
+    /* Print a JSON stats record per file instead of a progress line */
+    bool stats;
+    /* Decode grid images one tile at a time */
+    bool tiled;
+    /* Images to convert from each file, as for select_heif_images() */
+    std::string images;
+    /* If set, convert previews this many pixels wide instead of the images */
+    uint16_t preview_width;
+    struct heif2jpg_encode_options encode_options;
+    /* Sizes to write each image at from one decode; empty for just one */
+    std::vector<struct heif2jpg_rendition> renditions;
+    /* If set, outputs are cached in this directory, up to cache_max_bytes */
+    std::string cache_dir;
+    uint64_t cache_max_bytes = 0;
+    /* If not 0, bytes of estimated memory the images in flight may use at once */
+    uint64_t max_memory = 0;
+    /* If set, called with each input file whose outputs were all written */
+    std::function<void(const std::string &input_filename)> converted;
+};
+
+/* True for the .heic/.heif/.hif files picked up from directories */
+bool has_heif_extension(const std::string &path);
+
+/*
+ * Expands batch input specifications into a list of input file paths.
+ *
+ * Each spec is one of:
+ *   - "@path": a manifest file with one input path per line; blank lines and
+ *     lines starting with '#' are skipped
+ *   - a directory: every .heic/.heif/.hif file directly inside of it
+ *   - a glob: '*' and '?' are expanded in the file name part of the path
+ *   - anything else is used as a file path as-is
+ *
+ * Returns false and prints an error if a spec can't be expanded.
+ */
+bool expand_batch_inputs(const std::vector<std::string> &specs,
+                         std::vector<std::string> &inputs);
+
+/* Output file path for input_filename given the batch options */
+std::string batch_output_filename(const std::string &input_filename,
+                                  const struct heif2jpg_batch_options &options);
+
+/*
+ * Converts every file in inputs through the decode/pack/encode/write
+ * pipeline, splitting options.num_workers between the decode and encode
+ * stages and the threads inside each decode. Encoders come from a pool
+ * shared by the encode threads: each job takes one, carries it to the write
+ * stage so the jpeg is written from the encoder's buffer, and then hands it
+ * back to be reset and reused.
+ *
+ * Returns 0 if every file converted, or the exit code of the last failure.
+ */
+int run_batch(const std::vector<std::string> &inputs,
+              const struct heif2jpg_batch_options &options);
+
+/* run_batch() for files whose output paths, or opened images, are known */
+int run_batch_files(const std::vector<struct heif2jpg_pipeline_file> &files,
+                    const struct heif2jpg_batch_options &options);
+
+#endif /* HEIF2JPG_BATCH_H */
@@ -0,0 +1,439 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * Benchmark that runs a corpus of HEIF files through each conversion stage
+ * and reports per-stage timings, throughput and peak memory as JSON
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include <argparse/argparse.hpp>
+
+#include "batch.h"
+#include "convert.h"
+#include "decoder.h"
+#include "log.h"
+#include "p010_pack.h"
+#include "stats.h"
+
+enum bench_stage {
+    BENCH_READ,
+    BENCH_DECODE,
+    BENCH_PACK,
+    BENCH_ENCODE,
+    BENCH_WRITE,
+    BENCH_NUM_STAGES,
+};
+
+static const char *bench_stage_names[BENCH_NUM_STAGES] = {
+    "read_from_file",
+    "decode_image",
+    "pack_p010",
+    "uhdr_encode",
+    "write",
+};
+
+struct bench_stage_samples {
+    std::vector<double> ms;
+    /*
+     * Bytes the stage handled, summed over every sample: the input file for
+     * read, decoded planes for decode and pack, P010 for encode and the JPEG
+     * for write
+     */
+    uint64_t bytes = 0;
+    size_t peak_rss = 0;
+};
+
+/*
+ * Resets the process's peak RSS so the next reading only covers what comes
+ * after it. Only Linux supports this; elsewhere the peak is for the whole
+ * run so far.
+ */
+static bool reset_peak_rss()
+{
+#ifdef __linux__
+    std::ofstream clear_refs("/proc/self/clear_refs");
+    clear_refs << "5";
+    clear_refs.close();
+    return !clear_refs.fail();
+#else
+    return false;
+#endif
+}
+
+/* Peak resident set size in bytes, or 0 if it can't be read */
+static size_t peak_rss_bytes()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.PeakWorkingSetSize;
+    return 0;
+#else
+#ifdef __linux__
+    /* VmHWM follows clear_refs resets; ru_maxrss doesn't */
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0)
+            return (size_t)std::stoull(line.substr(6)) * 1024;
+    }
+#endif
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return (size_t)usage.ru_maxrss;
+#else
+    return (size_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+/* Times one stage call and records it in samples */
+class BenchTimer
+{
+public:
+    BenchTimer(struct bench_stage_samples &samples, bool record)
+        : samples_(samples), record_(record)
+    {
+        reset_peak_rss();
+        start_ = std::chrono::steady_clock::now();
+    }
+
+    void stop(uint64_t bytes)
+    {
+        auto elapsed = std::chrono::steady_clock::now() - start_;
+        if (!record_)
+            return;
+
+        samples_.ms.push_back(std::chrono::duration<double, std::milli>(elapsed).count());
+        samples_.bytes += bytes;
+        samples_.peak_rss = std::max(samples_.peak_rss, peak_rss_bytes());
+    }
+
+private:
+    struct bench_stage_samples &samples_;
+    bool record_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+/* Nearest-rank percentile of sorted samples */
+static double percentile(const std::vector<double> &sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+
+    size_t rank = (size_t)std::ceil(p / 100.0 * sorted.size());
+    return sorted[std::max<size_t>(rank, 1) - 1];
+}
+
+static double median(const std::vector<double> &sorted)
+{
+    size_t n = sorted.size();
+    if (n == 0)
+        return 0;
+
+    return n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+}
+
+/*
+ * Runs one file through every stage. Samples are only recorded when record
+ * is set, so warmup passes fault in the plane pool and encoder without
+ * skewing the results.
+ */
+static int bench_file(const std::string &input_filename, const std::string &output_filename,
+                      const struct heif2jpg_encode_options &encode_options,
+                      ConversionWorker &worker, bool record,
+                      std::vector<struct bench_stage_samples> &stages)
+{
+    DecodedImage decoded;
+    P010Image packed;
+    const uhdr_compressed_image_t *encoded;
+    int ret;
+
+    std::error_code ec;
+    uint64_t input_size = std::filesystem::file_size(input_filename, ec);
+    if (ec)
+        input_size = 0;
+
+    BenchTimer read_timer(stages[BENCH_READ], record);
+    ret = read_heif_file(input_filename, decoded, false);
+    if (ret)
+        return ret;
+    read_timer.stop(input_size);
+
+    BenchTimer decode_timer(stages[BENCH_DECODE], record);
+    ret = decode_heif_image(decoded, false);
+    if (ret)
+        return ret;
+
+    /* Decode throughput is counted in decoded bytes, like the later stages */
+    uint64_t decoded_size = 0;
+    const enum heif_channel channels[] = {heif_channel_Y, heif_channel_Cb, heif_channel_Cr};
+    for (enum heif_channel channel : channels) {
+        size_t stride;
+        heif_image_get_plane_readonly2(decoded.image, channel, &stride);
+        decoded_size += (uint64_t)stride * heif_image_get_height(decoded.image, channel);
+    }
+    decode_timer.stop(decoded_size);
+
+    /* Same pack the JPEG path uses: in place, or downscaled for -w */
+    int width, height;
+    bool sdr = is_sdr_jpeg_image(decoded.image, encode_options);
+    BenchTimer pack_timer(stages[BENCH_PACK], record);
+    if (sdr)
+        ret = 0; /* plain jpegs are encoded from the decoded planes */
+    else if (get_downscaled_size(decoded.image, encode_options, width, height))
+        ret = pack_p010_image_scaled(decoded.image, packed, width, height,
+                                     encode_options.resize_filter, false);
+    else
+        ret = pack_p010_image_in_place(decoded.image, packed, false);
+    if (ret)
+        return ret;
+    pack_timer.stop(decoded_size);
+
+    BenchTimer encode_timer(stages[BENCH_ENCODE], record);
+    if (sdr)
+        ret = encode_sdr_jpeg(decoded.image, encode_options, worker, &encoded,
+                              decoded.metadata.get());
+    else
+        ret = encode_uhdr_image(packed, encode_options, worker, &encoded,
+                                decoded.metadata.get());
+    if (ret)
+        return ret;
+    encode_timer.stop(sdr ? decoded_size : (uint64_t)packed.y_size() + packed.uv_size());
+
+    BenchTimer write_timer(stages[BENCH_WRITE], record);
+    ret = write_output_file(output_filename, {{encoded->data, encoded->data_sz}},
+                            worker.write_mode);
+    if (ret)
+        return ret;
+    write_timer.stop(encoded->data_sz);
+
+    uhdr_reset_encoder(worker.encoder);
+
+    return 0;
+}
+
+static std::string bench_json(const std::vector<struct bench_stage_samples> &stages,
+                              size_t num_files, int iterations, bool rss_per_stage)
+{
+    std::ostringstream json;
+
+    json << "{\n";
+    json << "  \"files\": " << num_files << ",\n";
+    json << "  \"iterations\": " << iterations << ",\n";
+    json << "  \"decoder\": " << json_string(heif_decoder_name(selected_heif_decoder())) << ",\n";
+    json << "  \"decode_threads\": " << heif_decoding_threads() << ",\n";
+    json << "  \"p010_kernels\": " << json_string(get_p010_pack_kernels().name) << ",\n";
+    json << "  \"peak_rss_per_stage\": " << (rss_per_stage ? "true" : "false") << ",\n";
+    json << "  \"stages\": {\n";
+
+    for (int i = 0; i < BENCH_NUM_STAGES; i++) {
+        std::vector<double> sorted = stages[i].ms;
+        std::sort(sorted.begin(), sorted.end());
+
+        double total_ms = 0;
+        for (double ms : sorted)
+            total_ms += ms;
+        double mb_per_s = total_ms > 0 ? stages[i].bytes / 1e6 / (total_ms / 1000) : 0;
+
+        char line[512];
+        snprintf(line, sizeof(line),
+                 "    \"%s\": {\"samples\": %zu, \"min_ms\": %.3f, \"median_ms\": %.3f, "
+                 "\"p99_ms\": %.3f, \"mb_per_s\": %.1f, \"peak_rss_bytes\": %zu}%s\n",
+                 bench_stage_names[i], sorted.size(), sorted.empty() ? 0 : sorted.front(),
+                 median(sorted), percentile(sorted, 99), mb_per_s, stages[i].peak_rss,
+                 i + 1 < BENCH_NUM_STAGES ? "," : "");
+        json << line;
+    }
+
+    json << "  }\n";
+    json << "}\n";
+
+    return json.str();
+}
+
+int main(int argc, char **argv)
+{
+    /* Automatically inits and deinits the library in main() scope */
+    LibHeifInitializer initializer;
+
+    argparse::ArgumentParser argparser("heif2jpg_bench");
+    argparser.add_argument("corpus")
+        .nargs(argparse::nargs_pattern::at_least_one)
+        .help("HEIF files to benchmark: files, directories, globs or @manifest, as with heif2jpg --batch");
+    argparser.add_argument("-n", "--iterations")
+        .default_value(5)
+        .help("Timed passes over the corpus")
+        .scan<'i', int>();
+    argparser.add_argument("--warmup")
+        .default_value(1)
+        .help("Untimed passes over the corpus before timing starts")
+        .scan<'i', int>();
+    argparser.add_argument("--json")
+        .default_value(std::string("-"))
+        .help("File to write JSON results to; \"-\" writes to stdout");
+    argparser.add_argument("-o", "--output-dir")
+        .default_value(std::string(""))
+        .help("Directory the write stage writes to; defaults to the system temp directory");
+    argparser.add_argument("-w")
+        .default_value((uint16_t)0)
+        .help("Output image width, in pixels")
+        .scan<'i', uint16_t>();
+    argparser.add_argument("--resize-filter")
+        .default_value(std::string("lanczos"))
+        .help("Filter for shrinking to -w as the image is packed: lanczos or box");
+    argparser.add_argument("-q")
+        .default_value((uint8_t)95)
+        .help("Output base image and gainmap image quality, 0-100")
+        .scan<'i', uint8_t>();
+    argparser.add_argument("--preset")
+        .default_value(std::string("quality"))
+        .help("Ultra HDR encoder preset: quality, balanced or speed");
+    argparser.add_argument("--write-mode")
+        .default_value(std::string("buffered"))
+        .help("How output files are written: buffered, writev (POSIX only) or mmap");
+    argparser.add_argument("--decoder")
+        .default_value(std::string("auto"))
+        .help("HEVC decoder: auto, libde265, ffmpeg or another libheif decoder id, as with heif2jpg");
+    argparser.add_argument("--decode-threads")
+        .default_value(0)
+        .help("Threads libheif may use inside one decode; 0 = one per hardware thread")
+        .scan<'i', int>();
+
+    try {
+        argparser.parse_args(argc, argv);
+    }
+    catch (const std::exception& err) {
+        std::cerr << err.what() << std::endl;
+        std::cerr << argparser;
+        return 1;
+    }
+
+    std::vector<std::string> inputs;
+    if (!expand_batch_inputs(argparser.get<std::vector<std::string>>("corpus"), inputs))
+        return 2;
+    if (inputs.empty()) {
+        std::cerr << "No input files found" << std::endl;
+        return 2;
+    }
+
+    if (!select_heif_decoder(argparser.get<std::string>("--decoder")))
+        return 1;
+
+    int decode_threads = argparser.get<int>("--decode-threads");
+    if (decode_threads < 0) {
+        std::cerr << "Bad decode thread count; must be 0 or more" << std::endl;
+        return 1;
+    }
+    if (!decode_threads)
+        decode_threads = std::max(1u, std::thread::hardware_concurrency());
+    set_heif_decoding_threads(decode_threads);
+
+    int iterations = argparser.get<int>("--iterations");
+    int warmup = argparser.get<int>("--warmup");
+    if (iterations < 1 || warmup < 0) {
+        std::cerr << "Bad iteration count; need at least 1 timed pass" << std::endl;
+        return 1;
+    }
+
+    enum heif2jpg_write_mode write_mode;
+    if (!parse_write_mode(argparser.get<std::string>("--write-mode"), write_mode)) {
+        std::cerr << "Bad write mode (" << argparser.get<std::string>("--write-mode") <<
+            "); must be buffered, writev or mmap" << std::endl;
+        return 1;
+    }
+
+    struct heif2jpg_encode_options encode_options;
+    encode_options.color_gamut = UHDR_CG_BT_2100;
+    encode_options.color_range = UHDR_CR_FULL_RANGE;
+    encode_options.color_transfer = UHDR_CT_HLG;
+    encode_options.new_width = argparser.get<uint16_t>("-w");
+    encode_options.quality = argparser.get<uint8_t>("-q");
+
+    if (!parse_resize_filter(argparser.get<std::string>("--resize-filter"),
+                             encode_options.resize_filter)) {
+        std::cerr << "Bad resize filter (" << argparser.get<std::string>("--resize-filter") <<
+            "); must be lanczos or box" << std::endl;
+        return 1;
+    }
+
+    if (!parse_encode_preset(argparser.get<std::string>("--preset"), encode_options)) {
+        std::cerr << "Bad preset (" << argparser.get<std::string>("--preset") <<
+            "); must be quality, balanced or speed" << std::endl;
+        return 1;
+    }
+
+    if (encode_options.quality > 100) {
+        std::cerr << "Bad quality value (" << encode_options.quality <<
+            "); must be between 1 and 100" << std::endl;
+        return 9;
+    }
+
+    std::filesystem::path output_dir = argparser.get<std::string>("-o");
+    if (output_dir.empty())
+        output_dir = std::filesystem::temp_directory_path();
+    std::string output_filename = (output_dir / "heif2jpg_bench.uhdr.jpg").string();
+
+    std::string json_filename = argparser.get<std::string>("--json");
+    if (is_stdout_output(json_filename))
+        set_log_to_stderr(true);
+
+    bool rss_per_stage = reset_peak_rss();
+    std::vector<struct bench_stage_samples> stages(BENCH_NUM_STAGES);
+    ConversionWorker worker(false);
+    worker.write_mode = write_mode;
+
+    for (int pass = 0; pass < warmup + iterations; pass++) {
+        bool record = pass >= warmup;
+
+        log_out() << (record ? "Timed pass " : "Warmup pass ")
+                  << (record ? pass - warmup + 1 : pass + 1) << "\r";
+        log_out().flush();
+
+        for (const std::string &input : inputs) {
+            int ret = bench_file(input, output_filename, encode_options, worker, record, stages);
+            if (ret) {
+                std::cerr << "Failed to convert " << input << std::endl;
+                return ret;
+            }
+        }
+    }
+    log_out() << std::endl;
+
+    std::error_code ec;
+    std::filesystem::remove(output_filename, ec);
+
+    for (int i = 0; i < BENCH_NUM_STAGES; i++) {
+        std::vector<double> sorted = stages[i].ms;
+        std::sort(sorted.begin(), sorted.end());
+        fprintf(log_file(), "  %-15s min %9.3f ms  median %9.3f ms  p99 %9.3f ms  peak RSS %7.1f MB\n",
+                bench_stage_names[i], sorted.front(), median(sorted), percentile(sorted, 99),
+                stages[i].peak_rss / 1e6);
+    }
+
+    std::string json = bench_json(stages, inputs.size(), iterations, rss_per_stage);
+    return write_output_file(json_filename, {{json.data(), json.size()}});
+}
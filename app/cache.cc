@@ -0,0 +1,208 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * On-disk cache of conversion outputs, keyed by a hash of the input file and
+ * the options that shape the output
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <filesystem>
+#include <random>
+
+#include "cache.h"
+#include "log.h"
+#include "xxhash.h"
+
+namespace fs = std::filesystem;
+
+/* Bumped whenever the same key could start meaning different output */
+#define CACHE_FORMAT "heif2jpg-cache-1"
+
+/* Temporary files left this long are from writers that died */
+#define CACHE_STALE_TEMP_AGE std::chrono::hours(1)
+
+ConversionCache::ConversionCache(const std::string &dir, uint64_t max_bytes)
+    : dir_(dir), max_bytes_(max_bytes)
+{
+}
+
+int ConversionCache::open()
+{
+    std::error_code ec;
+
+    fs::create_directories(dir_, ec);
+    if (ec || !fs::is_directory(dir_, ec)) {
+        error_out() << "Can't use cache directory " << dir_ << ": " << ec.message() << std::endl;
+        return 1;
+    }
+
+    /* Counts what's already there, trimming it if the cap has shrunk */
+    evict();
+
+    return 0;
+}
+
+std::string ConversionCache::describe(const struct heif2jpg_cache_params &params)
+{
+    const struct heif2jpg_encode_options &encode = params.encode_options;
+    char options[512];
+
+    int n = snprintf(options, sizeof(options),
+                     CACHE_FORMAT " gamut=%d range=%d transfer=%d width=%u quality=%u "
+                     "gainmap_quality=%u gainmap_scale=%u preset=%d "
+                     "filter=%d upconvert=%d color_from_file=%d metadata=%d "
+                     "p010=%d preview=%u images=",
+                     (int)encode.color_gamut, (int)encode.color_range,
+                     (int)encode.color_transfer, (unsigned int)encode.new_width,
+                     (unsigned int)encode.quality, (unsigned int)encode.gainmap_quality,
+                     (unsigned int)encode.gainmap_scale, (int)encode.uhdr_preset,
+                     (int)encode.resize_filter, (int)encode.upconvert_8bit,
+                     (int)encode.color_from_file, (int)encode.copy_metadata,
+                     (int)params.output_p010, (unsigned int)params.preview_width);
+
+    return std::string(options, n) + params.images;
+}
+
+std::string ConversionCache::key(const void *data, size_t size,
+                                 const struct heif2jpg_cache_params &params)
+{
+    uint64_t content_hash = xxh64(data, size);
+    std::string description = describe(params);
+    uint64_t options_hash = xxh64(description.data(), description.size(), content_hash);
+
+    char key[33];
+    snprintf(key, sizeof(key), "%016" PRIx64 "%016" PRIx64, content_hash, options_hash);
+
+    return key;
+}
+
+/* Entries are spread over 256 subdirectories by their first two digits */
+std::string ConversionCache::entry_path(const std::string &key) const
+{
+    return (fs::path(dir_) / key.substr(0, 2) / key).string();
+}
+
+bool ConversionCache::lookup(const std::string &key, std::vector<uint8_t> &out)
+{
+    std::string path = entry_path(key);
+    std::error_code ec;
+
+    /* Entries can be evicted by another process at any point; that's a miss */
+    FILE *file = fopen(path.c_str(), "rb");
+    uintmax_t size = file ? fs::file_size(path, ec) : 0;
+    bool hit = file && !ec && size > 0;
+    if (hit) {
+        out.resize(size);
+        hit = fread(out.data(), 1, size, file) == size;
+    }
+    if (file)
+        fclose(file);
+
+    if (!hit) {
+        out.clear();
+        misses_++;
+        return false;
+    }
+
+    /* Marks the entry as recently used */
+    fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+    hits_++;
+
+    return true;
+}
+
+void ConversionCache::store(const std::string &key,
+                            const std::vector<std::pair<const void *, size_t>> &buffers)
+{
+    /* Random per process, so names are unique across processes sharing the directory */
+    static std::atomic<uint64_t> next_temp{((uint64_t)std::random_device()() << 32) ^
+                                           std::random_device()()};
+    std::string path = entry_path(key);
+    std::error_code ec;
+
+    fs::create_directories(fs::path(path).parent_path(), ec);
+
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".tmp%016" PRIx64, (uint64_t)next_temp++);
+    std::string temp_path = path + suffix;
+
+    FILE *file = fopen(temp_path.c_str(), "wb");
+    if (!file)
+        return;
+
+    bool ok = true;
+    size_t size = 0;
+    for (const auto &buffer : buffers) {
+        ok = ok && fwrite(buffer.first, 1, buffer.second, file) == buffer.second;
+        size += buffer.second;
+    }
+    ok = fclose(file) == 0 && ok;
+
+    if (ok)
+        fs::rename(temp_path, path, ec);
+    if (!ok || ec) {
+        fs::remove(temp_path, ec);
+        return;
+    }
+
+    if ((total_bytes_ += size) > max_bytes_)
+        evict();
+}
+
+void ConversionCache::evict()
+{
+    struct entry {
+        fs::file_time_type used;
+        uintmax_t size;
+        fs::path path;
+    };
+
+    /* Someone else is already evicting; their scan covers this entry too */
+    std::unique_lock<std::mutex> lock(evict_mutex_, std::try_to_lock);
+    if (!lock.owns_lock())
+        return;
+
+    std::vector<struct entry> entries;
+    uint64_t total = 0;
+    auto now = fs::file_time_type::clock::now();
+    std::error_code ec;
+
+    for (fs::recursive_directory_iterator it(dir_, ec), end; !ec && it != end; it.increment(ec)) {
+        std::error_code entry_ec;
+        if (!it->is_regular_file(entry_ec))
+            continue;
+
+        fs::file_time_type used = it->last_write_time(entry_ec);
+        uintmax_t size = it->file_size(entry_ec);
+        if (entry_ec)
+            continue;
+
+        if (it->path().filename().string().find(".tmp") != std::string::npos) {
+            if (now - used > CACHE_STALE_TEMP_AGE)
+                fs::remove(it->path(), entry_ec);
+            continue;
+        }
+
+        entries.push_back({used, size, it->path()});
+        total += size;
+    }
+
+    if (total > max_bytes_) {
+        std::sort(entries.begin(), entries.end(),
+                  [](const struct entry &a, const struct entry &b) { return a.used < b.used; });
+
+        for (const auto &e : entries) {
+            if (total <= max_bytes_ / 10 * 9)
+                break;
+            /* Already gone means another process evicted it */
+            fs::remove(e.path, ec);
+            total -= e.size;
+        }
+    }
+
+    total_bytes_ = total;
+}
@@ -0,0 +1,91 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * On-disk cache of conversion outputs, keyed by a hash of the input file and
+ * the options that shape the output
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#ifndef HEIF2JPG_CACHE_H
+#define HEIF2JPG_CACHE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "convert.h"
+
+/* Everything besides the input bytes that decides what a conversion writes */
+struct heif2jpg_cache_params {
+    struct heif2jpg_encode_options encode_options;
+    bool output_p010 = false;
+    uint16_t preview_width = 0;
+    /* Images picked from the file, as for select_heif_images() */
+    std::string images;
+};
+
+/*
+ * A directory of converted outputs, one file per key, so an input that's
+ * submitted again is written from the cache without being decoded or
+ * encoded.
+ *
+ * Entries are written to a temporary name and renamed into place, so any
+ * number of threads and processes can share a directory and readers only
+ * ever see whole entries. Hits refresh an entry's modification time, and
+ * once the directory grows past max_bytes the least recently used entries
+ * are removed until it's back under 90% of it.
+ */
+class ConversionCache
+{
+public:
+    ConversionCache(const std::string &dir, uint64_t max_bytes);
+
+    ConversionCache(const ConversionCache &) = delete;
+    ConversionCache &operator=(const ConversionCache &) = delete;
+
+    /* Creates the directory if needed; returns 0, or 1 with an error printed */
+    int open();
+
+    /*
+     * params as stable text, for telling whether the options behind an
+     * output have changed
+     */
+    static std::string describe(const struct heif2jpg_cache_params &params);
+
+    /* The key for converting the size bytes of data with params */
+    static std::string key(const void *data, size_t size,
+                           const struct heif2jpg_cache_params &params);
+
+    /* Reads the entry for key into out; false if there isn't one */
+    bool lookup(const std::string &key, std::vector<uint8_t> &out);
+
+    /*
+     * Stores buffers, one after another, as the entry for key. Failures only
+     * mean the next lookup misses, so they aren't reported.
+     */
+    void store(const std::string &key,
+               const std::vector<std::pair<const void *, size_t>> &buffers);
+
+    uint64_t hits() const { return hits_; }
+    uint64_t misses() const { return misses_; }
+
+private:
+    std::string entry_path(const std::string &key) const;
+    /* Removes least recently used entries; called with nothing locked */
+    void evict();
+
+    std::string dir_;
+    uint64_t max_bytes_;
+    /* Bytes in the directory as of the last scan, plus what's stored since */
+    std::atomic<uint64_t> total_bytes_{0};
+    /* Held while scanning, so one thread evicts at a time */
+    std::mutex evict_mutex_;
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+};
+
+#endif /* HEIF2JPG_CACHE_H */
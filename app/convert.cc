@@ -0,0 +1,1581 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * HEIF to ultra HDR jpg / P010 conversion routines shared by the single-file
+ * and batch code paths
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <iostream>
+#include <memory>
+
+#include "convert.h"
+#include "decoder.h"
+#include "downscale.h"
+#include "log.h"
+#include "p010_pack.h"
+#include "trace.h"
+
+/*
+ * Progress functions obtained from libheif's examples/heif_dec.cc. They're
+ * also traced; progress_user_data is only set when they should print.
+ */
+static int max_value_progress = 0;
+
+void start_progress(enum heif_progress_step step, int max_progress,
+                    void *progress_user_data)
+{
+    if (trace_enabled())
+        trace_instant("heif start_progress", "{\"step\": " + std::to_string(step) +
+                                             ", \"max\": " + std::to_string(max_progress) + "}");
+    if (progress_user_data)
+        max_value_progress = max_progress;
+}
+
+void on_progress(enum heif_progress_step step, int progress,
+                 void *progress_user_data)
+{
+    if (trace_enabled())
+        trace_instant("heif on_progress", "{\"step\": " + std::to_string(step) +
+                                          ", \"progress\": " + std::to_string(progress) + "}");
+    if (!progress_user_data || !max_value_progress)
+        return;
+
+    log_out() << "decoding image... " << progress * 100 / max_value_progress << "%\r";
+    log_out().flush();
+}
+
+void end_progress(enum heif_progress_step step, void *progress_user_data)
+{
+    if (trace_enabled())
+        trace_instant("heif end_progress", "{\"step\": " + std::to_string(step) + "}");
+    if (progress_user_data)
+        log_out() << std::endl;
+}
+
+std::string derive_output_filename(const std::string &input_filename,
+                                   const std::string &suffix)
+{
+    std::string input_stem;
+    size_t dot_pos = input_filename.rfind('.');
+
+    if (dot_pos != std::string::npos)
+        input_stem = input_filename.substr(0, dot_pos);
+    else
+        input_stem = input_filename;
+
+    return std::string(input_stem + "." + suffix);
+}
+
+std::string output_suffix(bool output_p010, bool preview)
+{
+    if (preview)
+        return output_p010 ? "preview.p010" : "preview.jpg";
+
+    return output_p010 ? "p010" : "uhdr.jpg";
+}
+
+/* Decoded planes and dimensions of an image that is about to be packed */
+struct p010_source {
+    const uint8_t *yp, *cbp, *crp;
+    size_t y_stride, cb_stride, cr_stride;
+    int yw, yh, cw, ch;
+    /* 8 or 10; 8-bit samples are widened as they're packed */
+    int bits;
+    /*
+     * Chroma at full horizontal/vertical resolution, as decoded from 4:4:4
+     * (both) or 4:2:2 (vertical) images; it's halved as it's packed
+     */
+    bool full_cw, full_ch;
+};
+
+/* Chroma plane size of the 4:2:0 P010 image packed from src */
+static void get_p010_chroma_size(const struct p010_source &src, int &width, int &height)
+{
+    width = src.full_cw ? (src.cw + 1) / 2 : src.cw;
+    height = src.full_ch ? (src.ch + 1) / 2 : src.ch;
+}
+
+static int get_p010_source(heif_image *image, struct p010_source &src)
+{
+    /* Get HEIF image parameters, arrays, pointers */
+    int y_bpp = heif_image_get_bits_per_pixel_range(image, heif_channel_Y);
+
+    src.yp = heif_image_get_plane_readonly2(image, heif_channel_Y, &src.y_stride);
+    src.cbp = heif_image_get_plane_readonly2(image, heif_channel_Cb, &src.cb_stride);
+    src.crp = heif_image_get_plane_readonly2(image, heif_channel_Cr, &src.cr_stride);
+
+    assert(src.y_stride > 0);
+    assert(src.cb_stride > 0);
+    assert(src.cr_stride > 0);
+
+    src.yw = heif_image_get_width(image, heif_channel_Y);
+    src.yh = heif_image_get_height(image, heif_channel_Y);
+    src.cw = heif_image_get_width(image, heif_channel_Cb);
+    src.ch = heif_image_get_height(image, heif_channel_Cb);
+
+    if (src.yw < 0 || src.cw < 0)
+    {
+        error_out() << "Invalid Y or C plane width in decoded image." << std::endl;
+        return 10;
+    }
+
+    if (y_bpp != 8 && y_bpp != 10)
+    {
+        error_out() << y_bpp << "-bit input not supported; only 8 and 10-bit are." << std::endl;
+        return 10;
+    }
+    src.bits = y_bpp;
+
+    enum heif_chroma chroma = heif_image_get_chroma_format(image);
+    src.full_cw = chroma == heif_chroma_444;
+    src.full_ch = chroma == heif_chroma_444 || chroma == heif_chroma_422;
+
+    return 0;
+}
+
+/*
+ * Rows of 4:2:0 chroma packed from src, averaging rows and columns of 4:2:2
+ * and 4:4:4 chroma in the same pass. T is the sample type.
+ */
+template <typename T>
+static void pack_p010_chroma(const struct p010_source &src, uint16_t *uv_dst,
+                             size_t uv_dst_stride,
+                             void (*pack)(const T *, const T *, uint16_t *, size_t),
+                             void (*pack_422)(const T *, const T *, const T *, const T *,
+                                              uint16_t *, size_t),
+                             void (*pack_444)(const T *, const T *, const T *, const T *,
+                                              uint16_t *, size_t))
+{
+    int width, height;
+    get_p010_chroma_size(src, width, height);
+
+    for (int y = 0; y < height; y++) {
+        int r0 = src.full_ch ? 2 * y : y;
+        int r1 = src.full_ch ? std::min(r0 + 1, src.ch - 1) : r0;
+        const T *cb0 = (const T *)(src.cbp + r0 * src.cb_stride);
+        const T *cr0 = (const T *)(src.crp + r0 * src.cr_stride);
+        const T *cb1 = (const T *)(src.cbp + r1 * src.cb_stride);
+        const T *cr1 = (const T *)(src.crp + r1 * src.cr_stride);
+        uint16_t *dst = uv_dst + y * uv_dst_stride;
+
+        if (!src.full_cw && !src.full_ch) {
+            pack(cb0, cr0, dst, src.cw);
+        } else if (!src.full_cw) {
+            pack_422(cb0, cr0, cb1, cr1, dst, src.cw);
+        } else {
+            size_t pairs = src.cw / 2;
+            pack_444(cb0, cr0, cb1, cr1, dst, pairs);
+            /* An odd last column only has itself to average */
+            if (src.cw % 2)
+                pack_422(cb0 + 2 * pairs, cr0 + 2 * pairs, cb1 + 2 * pairs, cr1 + 2 * pairs,
+                         dst + 2 * pairs, 1);
+        }
+    }
+}
+
+static void pack_p010_uv(const struct p010_source &src, uint16_t *uv_dst, size_t uv_dst_stride)
+{
+    const struct p010_pack_kernels &kernels = get_p010_pack_kernels();
+
+    if (src.bits == 8)
+        pack_p010_chroma<uint8_t>(src, uv_dst, uv_dst_stride, kernels.pack_uv8,
+                                  kernels.pack_uv8_422, kernels.pack_uv8_444);
+    else
+        pack_p010_chroma<uint16_t>(src, uv_dst, uv_dst_stride, kernels.pack_uv,
+                                   kernels.pack_uv_422, kernels.pack_uv_444);
+}
+
+/* Strides are in 16-bit words */
+static void pack_p010_planes(const struct p010_source &src,
+                             uint16_t *y_dst, size_t y_dst_stride,
+                             uint16_t *uv_dst, size_t uv_dst_stride)
+{
+    const struct p010_pack_kernels &kernels = get_p010_pack_kernels();
+
+    if (src.bits == 8) {
+        for (int y = 0; y < src.yh; y++)
+            kernels.pack_y8(src.yp + y * src.y_stride, y_dst + y * y_dst_stride, src.yw);
+    } else {
+        for (int y = 0; y < src.yh; y++)
+            kernels.pack_y((const uint16_t *)(src.yp + y * src.y_stride),
+                           y_dst + y * y_dst_stride, src.yw);
+    }
+
+    pack_p010_uv(src, uv_dst, uv_dst_stride);
+}
+
+int pack_p010_image(heif_image *image, P010Image &packed, bool verbose)
+{
+    struct p010_source src;
+    int ret;
+
+    ret = get_p010_source(image, src);
+    if (ret)
+        return ret;
+
+    if (verbose)
+        log_out() << "Encoding image in P010 format in memory" << std::endl;
+
+    int chroma_width, chroma_height;
+    get_p010_chroma_size(src, chroma_width, chroma_height);
+
+    TraceSpan span("pack_p010_image");
+    packed.allocate(src.yw, src.yh, chroma_width, chroma_height);
+    pack_p010_planes(src, packed.y.get(), packed.y_stride, packed.uv.get(), packed.uv_stride);
+
+    return 0;
+}
+
+int pack_p010_image_in_place(heif_image *image, P010Image &packed, bool verbose)
+{
+    struct p010_source src;
+    int ret;
+
+    ret = get_p010_source(image, src);
+    if (ret)
+        return ret;
+
+    /* An 8-bit Y plane is too narrow to hold P010, so it gets its own */
+    if (src.bits == 8)
+        return pack_p010_image(image, packed, verbose);
+
+    TraceSpan span("pack_p010_image_in_place");
+    size_t y_stride;
+    uint16_t *y_plane = (uint16_t *)heif_image_get_plane2(image, heif_channel_Y, &y_stride);
+    assert(y_stride % 2 == 0);
+
+    if (verbose)
+        log_out() << "Encoding image in P010 format in memory" << std::endl;
+
+    int chroma_width, chroma_height;
+    get_p010_chroma_size(src, chroma_width, chroma_height);
+
+    packed.allocate_with_y_plane(y_plane, (int)(y_stride / 2), src.yw, src.yh, chroma_width,
+                                 chroma_height);
+
+    /* The Y plane becomes P010 with just the shift; no new memory is touched */
+    const struct p010_pack_kernels &kernels = get_p010_pack_kernels();
+
+    for (int y = 0; y < src.yh; y++) {
+        uint16_t *row = y_plane + y * (y_stride / 2);
+        kernels.pack_y(row, row, src.yw);
+    }
+
+    pack_p010_uv(src, packed.uv.get(), packed.uv_stride);
+
+    return 0;
+}
+
+bool get_downscaled_size(heif_image *image,
+                         const struct heif2jpg_encode_options &encode_options,
+                         int &width, int &height)
+{
+    int image_width = heif_image_get_width(image, heif_channel_Y);
+    int image_height = heif_image_get_height(image, heif_channel_Y);
+
+    if (encode_options.new_width == 0 || encode_options.new_width >= image_width)
+        return false;
+
+    width = encode_options.new_width;
+    height = 2 * (int)std::lround((double)image_height * width / image_width / 2);
+    height = std::max(height, 2);
+
+    return true;
+}
+
+int pack_p010_image_scaled(heif_image *image, P010Image &packed, int width, int height,
+                           enum heif2jpg_resize_filter filter, bool verbose)
+{
+    struct p010_source src;
+    int ret;
+
+    ret = get_p010_source(image, src);
+    if (ret)
+        return ret;
+
+    if (verbose)
+        log_out() << "Downscaling to " << width << "x" << height
+                  << " and encoding in P010 format in memory" << std::endl;
+
+    TraceSpan span("pack_p010_image_scaled");
+    int chroma_width = (width + 1) / 2;
+    int chroma_height = (height + 1) / 2;
+    packed.allocate(width, height, chroma_width, chroma_height);
+
+    /* Resampled rows are quantized and shifted straight into the P010 planes */
+    const struct resample_kernels &kernels = get_resample_kernels();
+    PlaneResampler y(src.yp, src.y_stride, src.yw, src.yh, src.bits, width, height, filter);
+    PlaneResampler cb(src.cbp, src.cb_stride, src.cw, src.ch, src.bits,
+                      chroma_width, chroma_height, filter);
+    PlaneResampler cr(src.crp, src.cr_stride, src.cw, src.ch, src.bits,
+                      chroma_width, chroma_height, filter);
+
+    for (int row = 0; row < height; row++)
+        kernels.store_y(y.row(row), packed.y.get() + (size_t)row * packed.y_stride, width, 6);
+
+    for (int row = 0; row < chroma_height; row++)
+        kernels.store_uv(cb.row(row), cr.row(row),
+                         packed.uv.get() + (size_t)row * packed.uv_stride, chroma_width, 6);
+
+    return 0;
+}
+
+bool parse_encode_preset(const std::string &name, struct heif2jpg_encode_options &encode_options)
+{
+    if (name == "quality") {
+        encode_options.uhdr_preset = UHDR_USAGE_BEST_QUALITY;
+        encode_options.gainmap_scale = 1;
+    } else if (name == "balanced") {
+        encode_options.uhdr_preset = UHDR_USAGE_BEST_QUALITY;
+        encode_options.gainmap_scale = 2;
+    } else if (name == "speed") {
+        encode_options.uhdr_preset = UHDR_USAGE_REALTIME;
+        encode_options.gainmap_scale = 4;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+int encode_uhdr_image(P010Image &packed,
+                      const struct heif2jpg_encode_options &encode_options,
+                      ConversionWorker &worker,
+                      const uhdr_compressed_image_t **encoded,
+                      const struct heif2jpg_image_metadata *metadata)
+{
+    uhdr_error_info_t status;
+
+    /* Setup libultrahdr structures for output */
+    uhdr_raw_image_t raw_uhdr_image{};
+
+    raw_uhdr_image.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
+    raw_uhdr_image.range = encode_options.color_range;
+    raw_uhdr_image.cg = encode_options.color_gamut;
+    raw_uhdr_image.ct = encode_options.color_transfer;
+    if (metadata && encode_options.color_from_file) {
+        if (metadata->color_range != UHDR_CR_UNSPECIFIED)
+            raw_uhdr_image.range = metadata->color_range;
+        if (metadata->color_gamut != UHDR_CG_UNSPECIFIED)
+            raw_uhdr_image.cg = metadata->color_gamut;
+        if (metadata->color_transfer != UHDR_CT_UNSPECIFIED)
+            raw_uhdr_image.ct = metadata->color_transfer;
+    }
+    raw_uhdr_image.w = packed.width;
+    raw_uhdr_image.h = packed.height;
+
+    raw_uhdr_image.planes[UHDR_PLANE_Y] = packed.y.get();
+    raw_uhdr_image.planes[UHDR_PLANE_UV] = packed.uv.get();
+    raw_uhdr_image.planes[UHDR_PLANE_V] = nullptr;
+    raw_uhdr_image.stride[UHDR_PLANE_Y] = packed.y_stride;
+    raw_uhdr_image.stride[UHDR_PLANE_UV] = packed.uv_stride;
+    raw_uhdr_image.stride[UHDR_PLANE_V] = 0;
+
+    /* Raw image memory is set; setup the worker's encoder */
+    uhdr_codec_private_t* handle = worker.encoder;
+    if (!handle) {
+        error_out() << "UHDR encoder: could not create encoder" << std::endl;
+        return 11;
+    }
+    uhdr_reset_encoder(handle);
+
+    status = uhdr_enc_set_raw_image(handle, &raw_uhdr_image, UHDR_HDR_IMG);
+    if (status.error_code != UHDR_CODEC_OK) {
+        if (status.has_detail) {
+            error_out() << "UHDR encoder: " << status.detail << std::endl;
+        }
+        uhdr_reset_encoder(handle);
+        return 11;
+    }
+
+    if (encode_options.new_width > 0 && encode_options.new_width != packed.width) {
+        float scale_factor = (float)encode_options.new_width / packed.width;
+        uint16_t new_height = (uint16_t)std::round(packed.height * scale_factor);
+
+        uhdr_add_effect_resize(handle, encode_options.new_width, new_height);
+    }
+
+    /* The preset goes first, so the settings after it aren't replaced by its defaults */
+    uhdr_enc_set_preset(handle, encode_options.uhdr_preset);
+    uhdr_enc_set_quality(handle, encode_options.quality, UHDR_BASE_IMG);
+    uhdr_enc_set_quality(handle, encode_options.gainmap_quality ? encode_options.gainmap_quality
+                                                                : encode_options.quality,
+                         UHDR_GAIN_MAP_IMG);
+    uhdr_enc_set_using_multi_channel_gainmap(handle, false);
+    uhdr_enc_set_gainmap_scale_factor(handle, encode_options.gainmap_scale);
+    uhdr_enc_set_gainmap_gamma(handle, 1.0f);
+
+    /* Copied by the encoder, and written out as one APP1 segment */
+    if (metadata && encode_options.copy_metadata && !metadata->exif.empty()) {
+        uhdr_mem_block_t exif{const_cast<uint8_t *>(metadata->exif.data()), metadata->exif.size(),
+                              metadata->exif.size()};
+        status = uhdr_enc_set_exif_data(handle, &exif);
+        if (status.error_code != UHDR_CODEC_OK) {
+            if (status.has_detail) {
+                error_out() << "UHDR encoder: " << status.detail << std::endl;
+            }
+            uhdr_reset_encoder(handle);
+            return 11;
+        }
+    }
+
+    if (worker.verbose)
+        log_out() << "Encoding as ultra HDR jpeg..." << std::endl;
+
+    {
+        TraceSpan span("uhdr_encode");
+        status = uhdr_encode(handle);
+    }
+    if (status.error_code != UHDR_CODEC_OK) {
+        if (status.has_detail) {
+            error_out() << "UHDR encoder: " << status.detail << std::endl;
+        }
+        uhdr_reset_encoder(handle);
+        return 12;
+    }
+
+    /* The stream stays owned by the encoder; it's reset before the next image */
+    *encoded = uhdr_get_encoded_stream(handle);
+    if (!*encoded) {
+        error_out() << "UHDR encoder: no encoded stream" << std::endl;
+        return 12;
+    }
+
+    return 0;
+}
+
+bool is_sdr_jpeg_image(heif_image *image, const struct heif2jpg_encode_options &encode_options)
+{
+    return !encode_options.upconvert_8bit &&
+           heif_image_get_bits_per_pixel_range(image, heif_channel_Y) == 8;
+}
+
+int encode_sdr_jpeg(heif_image *image, const struct heif2jpg_encode_options &encode_options,
+                    ConversionWorker &worker, const uhdr_compressed_image_t **encoded,
+                    const struct heif2jpg_image_metadata *metadata)
+{
+    int width = heif_image_get_width(image, heif_channel_Y);
+    int height = heif_image_get_height(image, heif_channel_Y);
+
+    /* The resampler also enlarges, so -w is honored either way */
+    if (encode_options.new_width > 0 && encode_options.new_width != width) {
+        height = std::max(2, 2 * (int)std::lround((double)height * encode_options.new_width /
+                                                  width / 2));
+        width = encode_options.new_width;
+    }
+
+    if (worker.verbose)
+        log_out() << "Encoding 8-bit image as a plain jpeg..." << std::endl;
+
+    int ret;
+    {
+        TraceSpan span("sdr_jpeg_encode");
+        ret = worker.sdr_encoder.encode(image, width, height, encode_options.quality,
+                                        encode_options.resize_filter,
+                                        encode_options.copy_metadata ? metadata : nullptr);
+    }
+    if (ret)
+        return ret;
+
+    worker.sdr_encoded.data = const_cast<uint8_t *>(worker.sdr_encoder.data());
+    worker.sdr_encoded.data_sz = worker.sdr_encoder.size();
+    worker.sdr_encoded.capacity = worker.sdr_encoder.size();
+    /* The jpeg is tagged with the image's own primaries, by its ICC profile */
+    worker.sdr_encoded.cg = metadata && metadata->color_gamut != UHDR_CG_UNSPECIFIED ?
+                            metadata->color_gamut : UHDR_CG_BT_709;
+    worker.sdr_encoded.ct = UHDR_CT_SRGB;
+    worker.sdr_encoded.range = UHDR_CR_FULL_RANGE;
+    *encoded = &worker.sdr_encoded;
+
+    return 0;
+}
+
+/* Encodes image as a plain jpeg and writes it */
+static int save_sdr_jpg_file(heif_image *image,
+                             const struct heif2jpg_encode_options &encode_options,
+                             const std::string &output_filename,
+                             ConversionWorker &worker,
+                             const struct heif2jpg_image_metadata *metadata,
+                             struct heif2jpg_conversion_stats *stats)
+{
+    const uhdr_compressed_image_t *encoded;
+    int ret;
+
+    auto start = std::chrono::steady_clock::now();
+    ret = encode_sdr_jpeg(image, encode_options, worker, &encoded, metadata);
+    if (ret)
+        return ret;
+    if (stats)
+        stats->encode_ms = elapsed_ms(start);
+
+    start = std::chrono::steady_clock::now();
+    ret = write_output_file(output_filename, {{encoded->data, encoded->data_sz}},
+                            worker.write_mode);
+    if (stats) {
+        stats->write_ms = elapsed_ms(start);
+        stats->output_bytes = encoded->data_sz;
+    }
+
+    return ret;
+}
+
+/* Encodes packed, releasing it once it's been encoded, and writes the result */
+static int write_uhdr_jpg_file(P010Image &packed,
+                               const struct heif2jpg_encode_options &encode_options,
+                               const std::string &output_filename,
+                               ConversionWorker &worker,
+                               const struct heif2jpg_image_metadata *metadata,
+                               struct heif2jpg_conversion_stats *stats)
+{
+    const uhdr_compressed_image_t *encoded;
+    int ret;
+
+    auto start = std::chrono::steady_clock::now();
+    ret = encode_uhdr_image(packed, encode_options, worker, &encoded, metadata);
+    if (ret)
+        return ret;
+    if (stats)
+        stats->encode_ms = elapsed_ms(start);
+
+    packed = P010Image();
+
+    /* Written straight from the encoder's buffer */
+    start = std::chrono::steady_clock::now();
+    ret = write_output_file(output_filename, {{encoded->data, encoded->data_sz}},
+                            worker.write_mode);
+    if (stats) {
+        stats->write_ms = elapsed_ms(start);
+        stats->output_bytes = encoded->data_sz;
+    }
+    uhdr_reset_encoder(worker.encoder);
+
+    return ret;
+}
+
+/* Writes packed as a raw P010 file: the Y plane, then the UV plane */
+static int write_p010_file(const P010Image &packed, const std::string &output_filename,
+                           ConversionWorker &worker,
+                           struct heif2jpg_conversion_stats *stats)
+{
+    auto start = std::chrono::steady_clock::now();
+    int ret = write_output_file(output_filename,
+                                {{packed.y.get(), packed.y_size()},
+                                 {packed.uv.get(), packed.uv_size()}},
+                                worker.write_mode);
+    if (stats) {
+        stats->write_ms = elapsed_ms(start);
+        stats->output_bytes = packed.y_size() + packed.uv_size();
+    }
+
+    return ret;
+}
+
+int encode_heif_jpeg(DecodedImage &decoded,
+                     const struct heif2jpg_encode_options &encode_options,
+                     ConversionWorker &worker, const uhdr_compressed_image_t **encoded,
+                     struct heif2jpg_conversion_stats *stats)
+{
+    int ret;
+
+    if (is_sdr_jpeg_image(decoded.image, encode_options)) {
+        auto start = std::chrono::steady_clock::now();
+        ret = encode_sdr_jpeg(decoded.image, encode_options, worker, encoded,
+                              decoded.metadata.get());
+        if (!ret && stats) {
+            stats->encode_ms = elapsed_ms(start);
+            stats->output_bytes = (*encoded)->data_sz;
+        }
+        return ret;
+    }
+
+    P010Image packed;
+    int width, height;
+
+    auto start = std::chrono::steady_clock::now();
+    if (get_downscaled_size(decoded.image, encode_options, width, height))
+        ret = pack_p010_image_scaled(decoded.image, packed, width, height,
+                                     encode_options.resize_filter, worker.verbose);
+    else
+        ret = pack_p010_image_in_place(decoded.image, packed, worker.verbose);
+    if (ret)
+        return ret;
+    if (stats)
+        stats->pack_ms = elapsed_ms(start);
+
+    start = std::chrono::steady_clock::now();
+    ret = encode_uhdr_image(packed, encode_options, worker, encoded, decoded.metadata.get());
+    if (!ret && stats) {
+        stats->encode_ms = elapsed_ms(start);
+        stats->output_bytes = (*encoded)->data_sz;
+    }
+
+    return ret;
+}
+
+int save_uhdr_jpg_file(struct heif_image_handle *handle,
+    heif_image *image,
+    struct heif2jpg_encode_options encode_options,
+    std::string output_filename,
+    ConversionWorker &worker,
+    struct heif2jpg_conversion_stats *stats,
+    const struct heif2jpg_image_metadata *metadata)
+{
+    P010Image packed;
+    int width, height;
+    int ret;
+
+    auto start = std::chrono::steady_clock::now();
+    if (get_downscaled_size(image, encode_options, width, height))
+        ret = pack_p010_image_scaled(image, packed, width, height,
+                                     encode_options.resize_filter, worker.verbose);
+    else
+        ret = pack_p010_image_in_place(image, packed, worker.verbose);
+    if (ret)
+        return ret;
+    if (stats)
+        stats->pack_ms = elapsed_ms(start);
+
+    return write_uhdr_jpg_file(packed, encode_options, output_filename, worker, metadata, stats);
+}
+
+int save_p010_file(struct heif_image_handle *handle, heif_image *image,
+                   std::string output_filename,
+                   ConversionWorker &worker,
+                   struct heif2jpg_conversion_stats *stats)
+{
+    struct p010_source src;
+    int ret;
+
+    int y_bpp = heif_image_get_bits_per_pixel_range(image, heif_channel_Y);
+    int cb_bpp = heif_image_get_bits_per_pixel_range(image, heif_channel_Cb);
+    int cr_bpp = heif_image_get_bits_per_pixel_range(image, heif_channel_Cr);
+
+    if (worker.verbose)
+        fprintf(log_file(), "Encoding image with Y=%d, Cb=%d, Cr=%d bits per pixel\n", y_bpp, cb_bpp, cr_bpp);
+
+    /* If 10-bit image output, use P010 format as output */
+    ret = get_p010_source(image, src);
+    if (ret)
+        return ret;
+
+    if (worker.verbose)
+        log_out() << "Output in P010 YUV format" << std::endl;
+
+    int chroma_width, chroma_height;
+    get_p010_chroma_size(src, chroma_width, chroma_height);
+
+    size_t y_words = (size_t)src.yw * src.yh;
+    size_t uv_words = (size_t)2 * chroma_width * chroma_height;
+
+    if (stats)
+        stats->output_bytes = 2 * (y_words + uv_words);
+
+    /* Pack straight into the page cache; nothing is copied after packing */
+    if (worker.write_mode == HEIF2JPG_WRITE_MMAP && !is_stdout_output(output_filename)) {
+        MappedOutputFile out;
+
+        ret = out.open(output_filename, 2 * (y_words + uv_words));
+        if (ret)
+            return ret;
+
+        uint16_t *y_dst = reinterpret_cast<uint16_t *>(out.data());
+        auto start = std::chrono::steady_clock::now();
+        pack_p010_planes(src, y_dst, src.yw, y_dst + y_words, 2 * chroma_width);
+        if (stats)
+            stats->pack_ms = elapsed_ms(start);
+
+        /* Closing is where the mapped pages get written back */
+        start = std::chrono::steady_clock::now();
+        ret = out.close();
+        if (stats)
+            stats->write_ms = elapsed_ms(start);
+
+        return ret;
+    }
+
+    /* Otherwise the whole image is packed, then written with one large write
+     * (or a single writev()) per plane
+     */
+    P010Image packed;
+    auto start = std::chrono::steady_clock::now();
+    packed.allocate(src.yw, src.yh, chroma_width, chroma_height);
+    pack_p010_planes(src, packed.y.get(), packed.y_stride, packed.uv.get(), packed.uv_stride);
+    if (stats)
+        stats->pack_ms = elapsed_ms(start);
+
+    return write_p010_file(packed, output_filename, worker, stats);
+}
+
+using DecodingOptions = std::unique_ptr<heif_decoding_options, void (*)(heif_decoding_options *)>;
+
+static DecodingOptions make_decoding_options(bool verbose)
+{
+    // This is a spectacularly odd construction -- from libheif's heif_dec.cc
+    DecodingOptions decode_options(heif_decoding_options_alloc(), heif_decoding_options_free);
+    decode_options->strict_decoding = true;
+    decode_options->decoder_id = selected_heif_decoder();
+    decode_options->convert_hdr_to_8bit = false;
+#if LIBHEIF_HAVE_VERSION(1, 21, 0)
+    if (heif_decoding_threads() > 0)
+        decode_options->num_codec_threads = heif_decoding_threads();
+#endif
+
+    /* The progress callbacks share global state, so only a single verbose
+     * conversion may have them print at a time; tracing just records them
+     */
+    static char print_progress;
+    if (verbose || trace_enabled()) {
+        decode_options->start_progress = start_progress;
+        decode_options->on_progress = on_progress;
+        decode_options->end_progress = end_progress;
+        decode_options->progress_user_data = verbose ? &print_progress : nullptr;
+    }
+
+    return decode_options;
+}
+
+/*
+ * Runs decode with the selected decoder and, if that fails, again with the
+ * one it falls back to. The fallback stays in options, so the rest of an
+ * image's tiles go straight to it.
+ */
+template <typename Decode>
+static struct heif_error decode_with_fallback(heif_decoding_options *options, Decode decode)
+{
+    struct heif_error err = decode();
+    while (err.code) {
+        const char *fallback = fall_back_heif_decoder(options->decoder_id, err);
+        if (!fallback)
+            break;
+        options->decoder_id = fallback;
+        err = decode();
+    }
+
+    return err;
+}
+
+static void record_image_stats(struct heif_image_handle *handle, heif_colorspace colorspace,
+                               heif_chroma chroma, struct heif2jpg_conversion_stats *stats)
+{
+    stats->width = heif_image_handle_get_width(handle);
+    stats->height = heif_image_handle_get_height(handle);
+    stats->bit_depth = heif_image_handle_get_luma_bits_per_pixel(handle);
+    stats->chroma = colorspace == heif_colorspace_monochrome ?
+        "monochrome" : heif_chroma_name(chroma);
+}
+
+int open_heif_file(const std::string &input_filename, HeifContextPtr &ctx,
+                   std::vector<heif_item_id> &image_ids,
+                   struct heif2jpg_conversion_stats *stats)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    auto input = std::make_shared<MappedInputFile>();
+    int ret = input->open(input_filename);
+    if (ret)
+        return ret;
+
+    ret = open_heif_file(input_filename, input, ctx, image_ids, stats);
+    if (stats)
+        stats->read_ms = elapsed_ms(start);
+
+    return ret;
+}
+
+int open_heif_file(const std::string &input_filename, std::shared_ptr<MappedInputFile> input,
+                   HeifContextPtr &ctx, std::vector<heif_item_id> &image_ids,
+                   struct heif2jpg_conversion_stats *stats)
+{
+    struct heif_error err;
+    auto start = std::chrono::steady_clock::now();
+
+    /*
+     * libheif parses the file in place, so the input has to outlive the
+     * context; the context's deleter holds on to it until then
+     */
+    ctx = HeifContextPtr(heif_context_alloc(), [input](struct heif_context *c) {
+        heif_context_free(c);
+    });
+    if (!ctx.get())
+    {
+        error_out() << "libheif: HEIF context allocation failed." << std::endl;
+        return 3;
+    }
+
+    apply_heif_decoding_threads(ctx.get());
+
+    {
+        TraceSpan span("heif_context_read", input_filename);
+        err = heif_context_read_from_memory_without_copy(ctx.get(), input->data(),
+                                                         input->size(), nullptr);
+    }
+    if (err.code != 0)
+    {
+        error_out() << "libheif: Could not read HEIF/AVIF file: " <<
+            err.message << std::endl;
+        return 4;
+    }
+
+    int num_images = heif_context_get_number_of_top_level_images(ctx.get());
+    if (num_images == 0)
+    {
+        error_out() << "libheif: File doesn't contain any images!" << std::endl;
+        return 5;
+    }
+
+    image_ids.resize(num_images);
+    num_images = heif_context_get_list_of_top_level_image_IDs(ctx.get(), image_ids.data(),
+                                                              num_images);
+    image_ids.resize(num_images);
+
+    if (stats) {
+        stats->read_ms = elapsed_ms(start);
+        stats->input_filename = input_filename;
+        stats->input_bytes = input->size();
+    }
+
+    return 0;
+}
+
+int read_heif_image(const HeifContextPtr &ctx, heif_item_id image_id, DecodedImage &decoded)
+{
+    struct heif_error err;
+
+    decoded.ctx = ctx;
+
+    err = heif_context_get_image_handle(ctx.get(), image_id, &decoded.handle);
+    if (err.code)
+    {
+        error_out() << "libheif: Could not read HEIF image: " << err.message << std::endl;
+        return 7;
+    }
+
+    decoded.metadata = read_heif_metadata(decoded.handle);
+
+    return 0;
+}
+
+/* Parses a 1-based image number; false if s isn't one */
+static bool parse_image_number(const std::string &s, size_t &number)
+{
+    auto end = s.data() + s.size();
+    auto [p, ec] = std::from_chars(s.data(), end, number);
+    return ec == std::errc() && p == end && number > 0;
+}
+
+/* Parses an image number or range like 3-5; false if item isn't one */
+static bool parse_image_range(const std::string &item, size_t &first, size_t &last)
+{
+    size_t dash = item.find('-');
+    if (dash == std::string::npos)
+        return parse_image_number(item, first) && parse_image_number(item, last);
+
+    return parse_image_number(item.substr(0, dash), first) &&
+           parse_image_number(item.substr(dash + 1), last) && first <= last;
+}
+
+size_t count_selected_images(const std::string &spec)
+{
+    if (spec.empty() || spec == "all")
+        return SIZE_MAX;
+    if (spec == "primary")
+        return 1;
+
+    size_t count = 0;
+    size_t begin = 0;
+    while (begin <= spec.size()) {
+        size_t end = spec.find(',', begin);
+        if (end == std::string::npos)
+            end = spec.size();
+        size_t first, last;
+        if (!parse_image_range(spec.substr(begin, end - begin), first, last))
+            return SIZE_MAX;
+        begin = end + 1;
+
+        count = last - first + 1 > SIZE_MAX - count ? SIZE_MAX : count + (last - first + 1);
+    }
+
+    return count;
+}
+
+bool select_heif_images(const std::string &spec, const HeifContextPtr &ctx,
+                        const std::vector<heif_item_id> &image_ids,
+                        std::vector<size_t> &selected)
+{
+    selected.clear();
+
+    if (spec.empty() || spec == "all") {
+        for (size_t i = 0; i < image_ids.size(); i++)
+            selected.push_back(i);
+        return true;
+    }
+
+    if (spec == "primary") {
+        heif_item_id primary_id;
+        struct heif_error err = heif_context_get_primary_image_ID(ctx.get(), &primary_id);
+        for (size_t i = 0; !err.code && i < image_ids.size(); i++) {
+            if (image_ids[i] == primary_id)
+                selected.push_back(i);
+        }
+        if (selected.empty())
+            error_out() << "libheif: File has no primary image" << std::endl;
+        return !selected.empty();
+    }
+
+    std::vector<bool> picked(image_ids.size(), false);
+    size_t begin = 0;
+    while (begin <= spec.size()) {
+        size_t end = spec.find(',', begin);
+        if (end == std::string::npos)
+            end = spec.size();
+        std::string item = spec.substr(begin, end - begin);
+        begin = end + 1;
+
+        size_t first, last;
+        if (!parse_image_range(item, first, last)) {
+            error_out() << "Bad image selection (" << item << "); use e.g. 1,3-5, all or primary"
+                      << std::endl;
+            return false;
+        }
+        if (last > image_ids.size()) {
+            error_out() << "Image " << last << " selected, but the file only has "
+                      << image_ids.size() << std::endl;
+            return false;
+        }
+
+        for (size_t number = first; number <= last; number++)
+            picked[number - 1] = true;
+    }
+
+    for (size_t i = 0; i < picked.size(); i++) {
+        if (picked[i])
+            selected.push_back(i);
+    }
+
+    return true;
+}
+
+std::string image_output_filename(const std::string &output_filename, size_t image_number)
+{
+    /* Only look for the extension in the file name, not in its directories */
+    size_t name_pos = output_filename.find_last_of("/\\");
+    size_t dot_pos = output_filename.rfind('.');
+    if (dot_pos == std::string::npos ||
+        (name_pos != std::string::npos && dot_pos < name_pos))
+        dot_pos = output_filename.size();
+
+    return output_filename.substr(0, dot_pos) + "." + std::to_string(image_number) +
+           output_filename.substr(dot_pos);
+}
+
+bool parse_renditions(const std::string &spec, uint8_t default_quality,
+                      std::vector<struct heif2jpg_rendition> &renditions)
+{
+    renditions.clear();
+
+    size_t begin = 0;
+    while (begin <= spec.size()) {
+        size_t end = spec.find(',', begin);
+        if (end == std::string::npos)
+            end = spec.size();
+        std::string item = spec.substr(begin, end - begin);
+        begin = end + 1;
+
+        size_t colon = item.find(':');
+        std::string width = item.substr(0, colon);
+        size_t number = 0, quality = default_quality;
+        bool ok = width == "full" || (parse_image_number(width, number) && number <= UINT16_MAX);
+        if (ok && colon != std::string::npos)
+            ok = parse_image_number(item.substr(colon + 1), quality) && quality <= 100;
+        if (!ok) {
+            error_out() << "Bad rendition (" << item << "); use e.g. full,2048:90,512:80"
+                      << std::endl;
+            return false;
+        }
+
+        for (const auto &rendition : renditions) {
+            if (rendition.width == number) {
+                error_out() << "Rendition " << item << " is given twice" << std::endl;
+                return false;
+            }
+        }
+
+        renditions.push_back({(uint16_t)number, (uint8_t)quality});
+    }
+
+    return true;
+}
+
+std::string rendition_output_filename(const std::string &output_filename,
+                                      const struct heif2jpg_rendition &rendition)
+{
+    if (rendition.width == 0)
+        return output_filename;
+
+    std::string extension = std::filesystem::path(output_filename).extension().string();
+    if (extension.empty())
+        return output_filename + "." + std::to_string(rendition.width);
+
+    return derive_output_filename(output_filename, std::to_string(rendition.width) + extension);
+}
+
+int read_heif_file(const std::string &input_filename, DecodedImage &decoded,
+                   bool verbose, struct heif2jpg_conversion_stats *stats)
+{
+    std::vector<heif_item_id> image_ids;
+    HeifContextPtr ctx;
+    int ret;
+
+    ret = open_heif_file(input_filename, ctx, image_ids, stats);
+    if (ret)
+        return ret;
+
+    if (image_ids.size() != 1)
+    {
+        error_out() << "libheif: No support for more than 1 image." << std::endl;
+        return 6;
+    }
+
+    return read_heif_image(ctx, image_ids[0], decoded);
+}
+
+/*
+ * Chroma to decode an image in. 4:2:2 and 4:4:4 images are decoded as
+ * they're stored and downsampled as they're packed, which saves libheif a
+ * conversion pass; everything else comes out as 4:2:0.
+ */
+static enum heif_chroma get_decoding_chroma(enum heif_colorspace colorspace,
+                                            enum heif_chroma chroma)
+{
+    if (colorspace == heif_colorspace_YCbCr &&
+        (chroma == heif_chroma_422 || chroma == heif_chroma_444))
+        return chroma;
+
+    return heif_chroma_420;
+}
+
+int decode_heif_image(DecodedImage &decoded, bool verbose,
+                      struct heif2jpg_conversion_stats *stats)
+{
+    struct heif_error err;
+    struct heif_image_handle *handle = decoded.handle;
+    auto start = std::chrono::steady_clock::now();
+
+    heif_colorspace colorspace;
+    heif_chroma chroma;
+    err = heif_image_handle_get_preferred_decoding_colorspace(handle, &colorspace, &chroma);
+    if (err.code) {
+      error_out() << err.message << std::endl;
+      return 10;
+    }
+
+    if (verbose) {
+        int width = heif_image_handle_get_width(handle);
+        int height = heif_image_handle_get_height(handle);
+        int primary = heif_image_handle_is_primary_image(handle);
+        fprintf(log_file(), "Image info: %dx%d%s\n", width, height, primary ? ", primary" : ", not primary");
+
+        fprintf(log_file(), "Image colorspace: ");
+        switch (colorspace) {
+          case heif_colorspace_YCbCr:
+            fprintf(log_file(), "YCbCr, ");
+            break;
+          case heif_colorspace_RGB:
+            fprintf(log_file(), "RGB");
+            break;
+          case heif_colorspace_monochrome:
+            fprintf(log_file(), "monochrome");
+            break;
+          case heif_colorspace_nonvisual:
+            fprintf(log_file(), "non-visual");
+            break;
+          default:
+            fprintf(log_file(), "unknown");
+            break;
+        }
+
+        if (colorspace == heif_colorspace_YCbCr) {
+          switch (chroma) {
+            case heif_chroma_420:
+              fprintf(log_file(), "4:2:0");
+              break;
+            case heif_chroma_422:
+              fprintf(log_file(), "4:2:2");
+              break;
+            case heif_chroma_444:
+              fprintf(log_file(), "4:4:4");
+              break;
+            default:
+              fprintf(log_file(), "unknown");
+              break;
+          }
+        }
+
+        fprintf(log_file(), "\n");
+
+        int bit_depth = heif_image_handle_get_luma_bits_per_pixel(handle);
+        log_out() << "Input luma bit depth: " << bit_depth << std::endl;
+    }
+
+    DecodingOptions decode_options = make_decoding_options(verbose);
+
+    // This is only supposed to go out to libultrahdr to make a jpg via P010 data, so we want YUV format planes
+    enum heif_chroma decode_chroma = get_decoding_chroma(colorspace, chroma);
+    {
+        TraceSpan span("heif_decode_image");
+        err = decode_with_fallback(decode_options.get(), [&] {
+            return heif_decode_image(handle, &decoded.image, heif_colorspace_YCbCr,
+                                     decode_chroma, decode_options.get());
+        });
+    }
+    if (err.code)
+    {
+        error_out() << "libheif: Could not decode HEIF image: " << err.message << std::endl;
+        return 8;
+    }
+
+    if (stats) {
+        stats->decode_ms = elapsed_ms(start);
+        stats->decoder = heif_decoder_name(decode_options->decoder_id);
+        record_image_stats(handle, colorspace, chroma, stats);
+    }
+
+    return 0;
+}
+
+/* Smallest thumbnail of handle that's at least width pixels wide, or 0 */
+static heif_item_id find_preview_thumbnail(struct heif_image_handle *handle, int width)
+{
+    int count = heif_image_handle_get_number_of_thumbnails(handle);
+    if (count <= 0)
+        return 0;
+
+    std::vector<heif_item_id> ids(count);
+    count = heif_image_handle_get_list_of_thumbnail_IDs(handle, ids.data(), count);
+
+    heif_item_id best_id = 0;
+    int best_width = 0;
+    for (int i = 0; i < count; i++) {
+        struct heif_image_handle *thumbnail;
+        struct heif_error err = heif_image_handle_get_thumbnail(handle, ids[i], &thumbnail);
+        if (err.code)
+            continue;
+
+        int thumbnail_width = heif_image_handle_get_width(thumbnail);
+        if (thumbnail_width >= width && (!best_id || thumbnail_width < best_width)) {
+            best_id = ids[i];
+            best_width = thumbnail_width;
+        }
+        heif_image_handle_release(thumbnail);
+    }
+
+    return best_id;
+}
+
+int decode_heif_preview(DecodedImage &decoded, int width, bool verbose,
+                        struct heif2jpg_conversion_stats *stats)
+{
+    int ret;
+
+    heif_item_id thumbnail_id = find_preview_thumbnail(decoded.handle, width);
+    if (thumbnail_id) {
+        struct heif_image_handle *thumbnail;
+        struct heif_error err = heif_image_handle_get_thumbnail(decoded.handle, thumbnail_id,
+                                                                &thumbnail);
+        if (err.code) {
+            error_out() << "libheif: Could not read thumbnail: " << err.message << std::endl;
+            return 7;
+        }
+
+        heif_image_handle_release(decoded.handle);
+        decoded.handle = thumbnail;
+    }
+
+    if (verbose)
+        fprintf(log_file(), "Preview from %s (%dx%d)\n", thumbnail_id ? "thumbnail" : "full image",
+                heif_image_handle_get_width(decoded.handle),
+                heif_image_handle_get_height(decoded.handle));
+
+    ret = decode_heif_image(decoded, verbose, stats);
+    if (ret)
+        return ret;
+
+    auto start = std::chrono::steady_clock::now();
+    int src_width = heif_image_get_width(decoded.image, heif_channel_Y);
+    int src_height = heif_image_get_height(decoded.image, heif_channel_Y);
+
+    /*
+     * Small enough already. 8-bit images stay 8-bit either way, so they're
+     * encoded as plain jpegs unless --upconvert-8bit widens them when packed.
+     */
+    if (src_width <= width)
+        return 0;
+
+    int dst_width = std::min(width, src_width);
+    int dst_height = std::max(1, (int)std::lround((double)src_height * dst_width / src_width));
+
+    heif_image *preview;
+    ret = downscale_heif_image(decoded.image, dst_width, dst_height, &preview);
+    if (ret)
+        return ret;
+
+    heif_image_release(decoded.image);
+    decoded.image = preview;
+
+    if (stats) {
+        stats->decode_ms += elapsed_ms(start);
+        stats->width = dst_width;
+        stats->height = dst_height;
+    }
+
+    return 0;
+}
+
+bool get_heif_tiling(DecodedImage &decoded, bool output_p010,
+                     const struct heif2jpg_encode_options &encode_options,
+                     struct heif_image_tiling &tiling)
+{
+    /* Tiles are only ever packed to P010 */
+    if (!output_p010 && !encode_options.upconvert_8bit &&
+        heif_image_handle_get_luma_bits_per_pixel(decoded.handle) == 8)
+        return false;
+
+    struct heif_error err = heif_image_handle_get_image_tiling(decoded.handle, 1, &tiling);
+    if (err.code)
+        return false;
+
+    /* Tiles must land on whole chroma samples of the 4:2:0 frame */
+    return tiling.num_columns * tiling.num_rows > 1 &&
+           tiling.tile_width % 2 == 0 && tiling.tile_height % 2 == 0 &&
+           tiling.left_offset == 0 && tiling.top_offset == 0;
+}
+
+uint64_t estimate_conversion_bytes(const struct heif_image_handle *handle,
+                                   const std::vector<int> &output_widths,
+                                   const struct heif2jpg_encode_options &encode_options,
+                                   bool output_p010, bool tiled)
+{
+    uint64_t width = heif_image_handle_get_width(handle);
+    uint64_t height = heif_image_handle_get_height(handle);
+    int bits = heif_image_handle_get_luma_bits_per_pixel(handle);
+    bool sdr = !output_p010 && !encode_options.upconvert_8bit && bits == 8;
+
+    heif_colorspace colorspace = heif_colorspace_undefined;
+    heif_chroma chroma = heif_chroma_undefined;
+    heif_image_handle_get_preferred_decoding_colorspace(handle, &colorspace, &chroma);
+
+    uint64_t decoded_width = width, decoded_height = height;
+    struct heif_image_tiling tiling;
+    if (tiled && !sdr && !heif_image_handle_get_image_tiling(handle, 1, &tiling).code &&
+        tiling.num_columns * tiling.num_rows > 1) {
+        decoded_width = tiling.tile_width;
+        decoded_height = tiling.tile_height;
+    }
+
+    /* Samples per luma sample across both chroma planes */
+    double chroma_samples;
+    switch (get_decoding_chroma(colorspace, chroma)) {
+    case heif_chroma_444:
+        chroma_samples = 2;
+        break;
+    case heif_chroma_422:
+        chroma_samples = 1;
+        break;
+    default:
+        chroma_samples = 0.5;
+        break;
+    }
+
+    uint64_t total = (uint64_t)(decoded_width * decoded_height * (1 + chroma_samples) *
+                                (bits > 8 ? 2 : 1));
+
+    for (int output_width : output_widths) {
+        uint64_t out_width = width, out_height = height;
+        if (output_width > 0 && (uint64_t)output_width < width) {
+            out_width = output_width;
+            out_height = std::max<uint64_t>(2, height * out_width / width);
+        }
+        uint64_t pixels = out_width * out_height;
+
+        if (output_p010)
+            total += width * height * 3;
+        else if (sdr)
+            /* libjpeg-turbo works a few rows at a time; this is mostly the output */
+            total += pixels;
+        else
+            /* P010 frame, then the SDR base image, gainmap and both encoded jpegs */
+            total += pixels * 6;
+    }
+
+    return total;
+}
+
+/* Strides are in 16-bit words */
+static int decode_tiles_to_p010(DecodedImage &decoded, const struct heif_image_tiling &tiling,
+                                uint16_t *y_dst, size_t y_dst_stride,
+                                uint16_t *uv_dst, size_t uv_dst_stride,
+                                bool verbose, struct heif2jpg_conversion_stats *stats)
+{
+    int width = tiling.image_width;
+    int height = tiling.image_height;
+    double decode_ms = 0, pack_ms = 0;
+    int ret;
+
+    heif_colorspace colorspace;
+    heif_chroma chroma;
+    heif_image_handle_get_preferred_decoding_colorspace(decoded.handle, &colorspace, &chroma);
+    enum heif_chroma decode_chroma = get_decoding_chroma(colorspace, chroma);
+
+    if (verbose)
+        fprintf(log_file(), "Decoding %ux%u tiles of %ux%u\n", tiling.num_columns,
+                tiling.num_rows, tiling.tile_width, tiling.tile_height);
+
+    /* Progress is per tile, so it isn't reported here */
+    DecodingOptions decode_options = make_decoding_options(false);
+
+    for (uint32_t tile_y = 0; tile_y < tiling.num_rows; tile_y++) {
+        for (uint32_t tile_x = 0; tile_x < tiling.num_columns; tile_x++) {
+            heif_image *tile = nullptr;
+
+            auto start = std::chrono::steady_clock::now();
+            struct heif_error err;
+            {
+                TraceSpan span("heif_image_handle_decode_image_tile");
+                err = decode_with_fallback(decode_options.get(), [&] {
+                    return heif_image_handle_decode_image_tile(
+                        decoded.handle, &tile, heif_colorspace_YCbCr, decode_chroma,
+                        decode_options.get(), tile_x, tile_y);
+                });
+            }
+            if (err.code) {
+                error_out() << "libheif: Could not decode HEIF image tile " << tile_x << ","
+                          << tile_y << ": " << err.message << std::endl;
+                return 8;
+            }
+            std::unique_ptr<heif_image, void (*)(const heif_image *)> tile_image(tile, heif_image_release);
+            decode_ms += elapsed_ms(start);
+
+            start = std::chrono::steady_clock::now();
+            TraceSpan pack_span("pack_p010_tile");
+            struct p010_source src;
+            ret = get_p010_source(tile, src);
+            if (ret)
+                return ret;
+
+            /* Edge tiles are coded at full size and hang over the frame */
+            int x0 = tile_x * tiling.tile_width;
+            int y0 = tile_y * tiling.tile_height;
+            src.yw = std::min(src.yw, width - x0);
+            src.yh = std::min(src.yh, height - y0);
+            if (src.yw <= 0 || src.yh <= 0)
+                continue;
+            /* Tile origins are even, so cropped chroma follows from the luma */
+            src.cw = src.full_cw ? src.yw : (src.yw + 1) / 2;
+            src.ch = src.full_ch ? src.yh : (src.yh + 1) / 2;
+
+            /* Interleaved UV has two words per chroma sample, so x0 / 2 * 2 */
+            pack_p010_planes(src, y_dst + (size_t)y0 * y_dst_stride + x0, y_dst_stride,
+                             uv_dst + (size_t)(y0 / 2) * uv_dst_stride + x0, uv_dst_stride);
+            pack_ms += elapsed_ms(start);
+        }
+    }
+
+    if (stats) {
+        stats->decode_ms = decode_ms;
+        stats->pack_ms = pack_ms;
+        stats->decoder = heif_decoder_name(decode_options->decoder_id);
+        record_image_stats(decoded.handle, colorspace, chroma, stats);
+    }
+
+    return 0;
+}
+
+int decode_p010_image_tiled(DecodedImage &decoded, const struct heif_image_tiling &tiling,
+                            P010Image &packed, bool verbose,
+                            struct heif2jpg_conversion_stats *stats)
+{
+    int width = tiling.image_width;
+    int height = tiling.image_height;
+
+    packed.allocate(width, height, (width + 1) / 2, (height + 1) / 2);
+
+    return decode_tiles_to_p010(decoded, tiling, packed.y.get(), packed.y_stride,
+                                packed.uv.get(), packed.uv_stride, verbose, stats);
+}
+
+/* convert_heif_file() for images decoded tile by tile */
+static int convert_tiled_image(DecodedImage &decoded, const struct heif_image_tiling &tiling,
+                               const std::string &output_filename,
+                               bool output_p010,
+                               const struct heif2jpg_encode_options &encode_options,
+                               ConversionWorker &worker,
+                               struct heif2jpg_conversion_stats *stats)
+{
+    int ret;
+
+    /* Tiles are packed straight into the page cache, so no frame is ever held */
+    if (output_p010 && worker.write_mode == HEIF2JPG_WRITE_MMAP &&
+        !is_stdout_output(output_filename)) {
+        size_t width = tiling.image_width;
+        size_t chroma_width = (width + 1) / 2;
+        size_t y_words = width * tiling.image_height;
+        size_t uv_words = 2 * chroma_width * ((tiling.image_height + 1) / 2);
+        MappedOutputFile out;
+
+        ret = out.open(output_filename, 2 * (y_words + uv_words));
+        if (ret)
+            return ret;
+
+        uint16_t *y_dst = reinterpret_cast<uint16_t *>(out.data());
+        ret = decode_tiles_to_p010(decoded, tiling, y_dst, width, y_dst + y_words,
+                                   2 * chroma_width, worker.verbose, stats);
+        if (ret)
+            return ret;
+
+        auto start = std::chrono::steady_clock::now();
+        ret = out.close();
+        if (stats) {
+            stats->write_ms = elapsed_ms(start);
+            stats->output_bytes = 2 * (y_words + uv_words);
+        }
+
+        return ret;
+    }
+
+    P010Image packed;
+    ret = decode_p010_image_tiled(decoded, tiling, packed, worker.verbose, stats);
+    if (ret)
+        return ret;
+
+    if (output_p010)
+        return write_p010_file(packed, output_filename, worker, stats);
+
+    return write_uhdr_jpg_file(packed, encode_options, output_filename, worker,
+                               decoded.metadata.get(), stats);
+}
+
+int convert_heif_file(const std::string &input_filename,
+                      const std::string &output_filename,
+                      bool output_p010,
+                      const struct heif2jpg_encode_options &encode_options,
+                      ConversionWorker &worker,
+                      struct heif2jpg_conversion_stats *stats)
+{
+    DecodedImage decoded;
+    int ret;
+
+    ret = read_heif_file(input_filename, decoded, worker.verbose, stats);
+    if (ret)
+        return ret;
+
+    return convert_heif_image(decoded, output_filename, output_p010, encode_options,
+                              worker, stats);
+}
+
+int convert_heif_image(DecodedImage &decoded,
+                       const std::string &output_filename,
+                       bool output_p010,
+                       const struct heif2jpg_encode_options &encode_options,
+                       ConversionWorker &worker,
+                       struct heif2jpg_conversion_stats *stats)
+{
+    int ret;
+
+    if (stats)
+        stats->output_filename = output_filename;
+
+    struct heif_image_tiling tiling;
+    if (worker.preview_width)
+        ret = decode_heif_preview(decoded, worker.preview_width, worker.verbose, stats);
+    else if (worker.tiled && get_heif_tiling(decoded, output_p010, encode_options, tiling))
+        return convert_tiled_image(decoded, tiling, output_filename, output_p010,
+                                   encode_options, worker, stats);
+    else
+        ret = decode_heif_image(decoded, worker.verbose, stats);
+    if (ret)
+        return ret;
+
+    /* Determine output file format */
+    if (output_p010)
+        ret = save_p010_file(decoded.handle, decoded.image, output_filename, worker, stats);
+    else if (is_sdr_jpeg_image(decoded.image, encode_options))
+        ret = save_sdr_jpg_file(decoded.image, encode_options, output_filename, worker,
+                                decoded.metadata.get(), stats);
+    else
+        ret = save_uhdr_jpg_file(decoded.handle, decoded.image, encode_options, output_filename,
+                                 worker, stats, decoded.metadata.get());
+
+    return ret;
+}
+
+static void append_bytes(std::vector<uint8_t> &out, const void *data, size_t size)
+{
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    out.insert(out.end(), bytes, bytes + size);
+}
+
+int convert_heif_image_to_buffer(DecodedImage &decoded, std::vector<uint8_t> &out,
+                                 bool output_p010,
+                                 const struct heif2jpg_encode_options &encode_options,
+                                 ConversionWorker &worker,
+                                 struct heif2jpg_conversion_stats *stats)
+{
+    /* Tiled decodes go straight to packed and leave decoded.image null */
+    P010Image packed;
+    int ret;
+
+    struct heif_image_tiling tiling;
+    if (worker.preview_width)
+        ret = decode_heif_preview(decoded, worker.preview_width, worker.verbose, stats);
+    else if (worker.tiled && get_heif_tiling(decoded, output_p010, encode_options, tiling))
+        ret = decode_p010_image_tiled(decoded, tiling, packed, worker.verbose, stats);
+    else
+        ret = decode_heif_image(decoded, worker.verbose, stats);
+    if (ret)
+        return ret;
+
+    if (output_p010) {
+        if (decoded.image) {
+            auto start = std::chrono::steady_clock::now();
+            ret = pack_p010_image(decoded.image, packed, worker.verbose);
+            if (ret)
+                return ret;
+            if (stats)
+                stats->pack_ms = elapsed_ms(start);
+        }
+
+        /* Both packings allocate their planes without row padding */
+        append_bytes(out, packed.y.get(), packed.y_size());
+        append_bytes(out, packed.uv.get(), packed.uv_size());
+        if (stats)
+            stats->output_bytes = packed.y_size() + packed.uv_size();
+
+        return 0;
+    }
+
+    const uhdr_compressed_image_t *encoded;
+    if (decoded.image) {
+        ret = encode_heif_jpeg(decoded, encode_options, worker, &encoded, stats);
+    } else {
+        auto start = std::chrono::steady_clock::now();
+        ret = encode_uhdr_image(packed, encode_options, worker, &encoded, decoded.metadata.get());
+        if (!ret && stats) {
+            stats->encode_ms = elapsed_ms(start);
+            stats->output_bytes = encoded->data_sz;
+        }
+    }
+    if (!ret)
+        append_bytes(out, encoded->data, encoded->data_sz);
+    uhdr_reset_encoder(worker.encoder);
+
+    return ret;
+}
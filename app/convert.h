@@ -0,0 +1,467 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * HEIF to ultra HDR jpg / P010 conversion routines shared by the single-file
+ * and batch code paths
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#ifndef HEIF2JPG_CONVERT_H
+#define HEIF2JPG_CONVERT_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <libheif/heif.h>
+#include <libheif/heif_image.h>
+
+#include <ultrahdr_api.h>
+
+#include "downscale.h"
+#include "input_file.h"
+#include "metadata.h"
+#include "output_file.h"
+#include "plane_pool.h"
+#include "sdr_jpeg.h"
+#include "stats.h"
+
+/* Progress functions obtained from libheif's examples/heif_dec.cc */
+void start_progress(enum heif_progress_step step, int max_progress,
+                    void *progress_user_data);
+void on_progress(enum heif_progress_step step, int progress,
+                 void *progress_user_data);
+void end_progress(enum heif_progress_step step, void *progress_user_data);
+
+/* Obtained from libheif's examples/heif_dec.cc */
+class LibHeifInitializer
+{
+public:
+    LibHeifInitializer() { heif_init(nullptr); }
+    ~LibHeifInitializer() { heif_deinit(); }
+};
+
+/* Obtained from libheif's examples/heif_dec.cc */
+class ContextReleaser
+{
+public:
+    ContextReleaser(struct heif_context *ctx) : ctx_(ctx) {}
+
+    ~ContextReleaser()
+    {
+        heif_context_free(ctx_);
+    }
+
+private:
+    struct heif_context *ctx_;
+};
+
+/* Defaults match the heif2jpg executable's */
+struct heif2jpg_encode_options {
+    uhdr_color_gamut_t color_gamut = UHDR_CG_BT_2100;
+    uhdr_color_range_t color_range = UHDR_CR_FULL_RANGE;
+    uhdr_color_transfer_t color_transfer = UHDR_CT_HLG;
+    /*
+     * Take the color gamut, range and transfer from the image's nclx profile
+     * where it has them; the fields above fill in the rest
+     */
+    bool color_from_file = true;
+    /* Copy EXIF, and for plain jpegs XMP and ICC too, from the image */
+    bool copy_metadata = true;
+    /* 0 keeps the decoded width */
+    uint16_t new_width = 0;
+    /* Filter used to shrink images to new_width as they're packed */
+    enum heif2jpg_resize_filter resize_filter = HEIF2JPG_RESIZE_LANCZOS;
+    /* Base image quality, and the gainmap's unless gainmap_quality is set */
+    uint8_t quality = 95;
+    /* 0 encodes the gainmap at quality */
+    uint8_t gainmap_quality = 0;
+    /* The gainmap is this many times smaller than the image on each side, 1-128 */
+    uint8_t gainmap_scale = 1;
+    /* libultrahdr's speed/quality tradeoff for the gainmap */
+    uhdr_enc_preset_t uhdr_preset = UHDR_USAGE_BEST_QUALITY;
+    /*
+     * Widen 8-bit images to P010 and encode them as ultra HDR like 10-bit
+     * ones, instead of writing them as plain jpegs
+     */
+    bool upconvert_8bit = false;
+};
+
+/*
+ * Sets the ultra HDR encoder settings for a named preset: "quality" (the
+ * default: full size gainmap), "balanced" (gainmap at half size) or "speed"
+ * (libultrahdr's realtime mode and a quarter size gainmap). Returns false
+ * if the name is unknown.
+ */
+bool parse_encode_preset(const std::string &name, struct heif2jpg_encode_options &encode_options);
+
+/* One output size of a conversion that writes several from one decode */
+struct heif2jpg_rendition {
+    /* 0 keeps the decoded size */
+    uint16_t width;
+    uint8_t quality;
+};
+
+/*
+ * Parses a comma-separated rendition list, e.g. "full,2048:90,512:80": each
+ * item is "full" or a width, optionally followed by ":quality", which
+ * otherwise defaults to default_quality. Returns false and prints an error
+ * if the list is bad.
+ */
+bool parse_renditions(const std::string &spec, uint8_t default_quality,
+                      std::vector<struct heif2jpg_rendition> &renditions);
+
+/*
+ * Output path for one rendition, from derive_output_filename(): full size
+ * keeps output_filename, others get their width, out.jpg -> out.2048.jpg
+ */
+std::string rendition_output_filename(const std::string &output_filename,
+                                      const struct heif2jpg_rendition &rendition);
+
+/*
+ * State owned by one thread that is reused from one conversion to the next.
+ *
+ * The ultra HDR encoder is created once and reset between images instead of
+ * being created and torn down for every file. libheif contexts are tied to the
+ * file they were read from, so those are still allocated per conversion.
+ */
+class ConversionWorker
+{
+public:
+    ConversionWorker(bool verbose = true)
+        : encoder(uhdr_create_encoder()), verbose(verbose) {}
+
+    ~ConversionWorker()
+    {
+        if (encoder)
+            uhdr_release_encoder(encoder);
+    }
+
+    ConversionWorker(const ConversionWorker &) = delete;
+    ConversionWorker &operator=(const ConversionWorker &) = delete;
+
+    uhdr_codec_private_t *encoder;
+    /* For 8-bit images; sdr_encoded describes its output like an ultra HDR stream */
+    SdrJpegEncoder sdr_encoder;
+    uhdr_compressed_image_t sdr_encoded{};
+    /* Print informational/progress messages to stdout */
+    bool verbose;
+    /* How output files are written */
+    enum heif2jpg_write_mode write_mode = HEIF2JPG_WRITE_BUFFERED;
+    /* Decode grid images one tile at a time instead of as a whole */
+    bool tiled = false;
+    /* If set, convert a preview this many pixels wide instead of the image */
+    uint16_t preview_width = 0;
+};
+
+/*
+ * A parsed HEIF file. It's shared by every image taken from it, so a
+ * multi-image file is only read once, and freed with the last of them.
+ */
+using HeifContextPtr = std::shared_ptr<struct heif_context>;
+
+/*
+ * A HEIF file's context, one of its image handles and, once decoded, the
+ * decoded image. The handle and image are released together; the context
+ * goes with the last image that uses it.
+ */
+class DecodedImage
+{
+public:
+    DecodedImage() = default;
+
+    ~DecodedImage()
+    {
+        if (image)
+            heif_image_release(image);
+        if (handle)
+            heif_image_handle_release(handle);
+    }
+
+    DecodedImage(const DecodedImage &) = delete;
+    DecodedImage &operator=(const DecodedImage &) = delete;
+
+    HeifContextPtr ctx;
+    struct heif_image_handle *handle = nullptr;
+    heif_image *image = nullptr;
+    /* Read with the handle; kept apart from it so it can outlive the planes */
+    std::shared_ptr<const struct heif2jpg_image_metadata> metadata;
+};
+
+/*
+ * A 10-bit 4:2:0 image packed in P010 format: Y and interleaved UV planes with
+ * each sample stored in the 10 most significant bits of a little endian word.
+ * Plane memory comes from, and goes back to, the default plane pool.
+ */
+class P010Image
+{
+public:
+    void allocate(int width, int height, int chroma_width, int chroma_height)
+    {
+        this->width = width;
+        this->height = height;
+        y_stride = width;
+        uv_stride = 2 * chroma_width;
+        uv_height = chroma_height;
+        /* Not initialized; every sample is written when packing */
+        y = default_plane_pool().acquire(y_size());
+        uv = default_plane_pool().acquire(uv_size());
+    }
+
+    /*
+     * Uses an existing Y plane, with its own stride, instead of allocating
+     * one. The plane must outlive this image.
+     */
+    void allocate_with_y_plane(uint16_t *y_plane, int y_plane_stride, int width, int height,
+                               int chroma_width, int chroma_height)
+    {
+        this->width = width;
+        this->height = height;
+        y_stride = y_plane_stride;
+        uv_stride = 2 * chroma_width;
+        uv_height = chroma_height;
+        y = PlaneBuffer(nullptr, y_plane, y_size());
+        uv = default_plane_pool().acquire(uv_size());
+    }
+
+    size_t y_size() const { return (size_t)y_stride * height * sizeof(uint16_t); }
+    size_t uv_size() const { return (size_t)uv_stride * uv_height * sizeof(uint16_t); }
+
+    int width = 0;
+    int height = 0;
+    int uv_height = 0;
+    /* Strides are in 16-bit words */
+    int y_stride = 0;
+    int uv_stride = 0;
+    PlaneBuffer y;
+    PlaneBuffer uv;
+};
+
+std::string derive_output_filename(const std::string &input_filename,
+                                   const std::string &suffix);
+
+/* Suffix for derive_output_filename(): "uhdr.jpg", "p010", "preview.jpg"... */
+std::string output_suffix(bool output_p010, bool preview);
+
+/*
+ * Conversion stages. Each returns 0 on success, or the same non-zero code the
+ * heif2jpg executable exits with on failure. Stages that take a stats pointer
+ * record their timings and what they learn about the image in it when it
+ * isn't null.
+ */
+
+/*
+ * Opens and parses input_filename and lists its top-level images in
+ * image_ids.
+ */
+int open_heif_file(const std::string &input_filename, HeifContextPtr &ctx,
+                   std::vector<heif_item_id> &image_ids,
+                   struct heif2jpg_conversion_stats *stats = nullptr);
+
+/* As above, parsing input, which holds input_filename read ahead of time */
+int open_heif_file(const std::string &input_filename, std::shared_ptr<MappedInputFile> input,
+                   HeifContextPtr &ctx, std::vector<heif_item_id> &image_ids,
+                   struct heif2jpg_conversion_stats *stats = nullptr);
+
+/* Gets the handle of image_id in a file from open_heif_file() */
+int read_heif_image(const HeifContextPtr &ctx, heif_item_id image_id, DecodedImage &decoded);
+
+/*
+ * Picks images out of image_ids by spec:
+ *   - "" or "all": every image
+ *   - "primary": just the primary image
+ *   - a comma-separated list of 1-based indices and ranges, e.g. "1,3-5"
+ *
+ * Selected 0-based indices into image_ids are returned in order. Returns
+ * false and prints an error if the spec is bad or selects nothing.
+ */
+bool select_heif_images(const std::string &spec, const HeifContextPtr &ctx,
+                        const std::vector<heif_item_id> &image_ids,
+                        std::vector<size_t> &selected);
+
+/*
+ * Most images spec can select from one file: 1 for "primary", the numbers
+ * listed otherwise, and SIZE_MAX for every image or a bad spec
+ */
+size_t count_selected_images(const std::string &spec);
+
+/* Output path for one image of a multi-image file: out.jpg -> out.3.jpg */
+std::string image_output_filename(const std::string &output_filename, size_t image_number);
+
+/*
+ * Opens input_filename and gets its primary image handle. Files with more
+ * than one top-level image are refused; use open_heif_file() for those.
+ */
+int read_heif_file(const std::string &input_filename, DecodedImage &decoded,
+                   bool verbose, struct heif2jpg_conversion_stats *stats = nullptr);
+
+/* Decodes the primary image of an opened file into decoded.image */
+int decode_heif_image(DecodedImage &decoded, bool verbose,
+                      struct heif2jpg_conversion_stats *stats = nullptr);
+
+/*
+ * Decodes a preview of an opened image that is at most width pixels wide.
+ * The smallest embedded thumbnail at least that wide is used if there is
+ * one, replacing decoded.handle; otherwise the full image is decoded. Either
+ * way the result is box-filtered down to width right after decoding, so
+ * packing and encoding only see preview-sized data.
+ */
+int decode_heif_preview(DecodedImage &decoded, int width, bool verbose,
+                        struct heif2jpg_conversion_stats *stats = nullptr);
+
+/*
+ * Gets the tile grid of an opened image for --tiled. Returns false if the
+ * image isn't split into tiles that can be decoded into a 4:2:0 frame one at
+ * a time, or if it's 8-bit and written as a plain jpeg, which is encoded
+ * from the decoded planes; either way it has to be decoded as a whole.
+ */
+bool get_heif_tiling(DecodedImage &decoded, bool output_p010,
+                     const struct heif2jpg_encode_options &encode_options,
+                     struct heif_image_tiling &tiling);
+
+/*
+ * Roughly the most memory converting an opened image holds at once, from its
+ * handle alone: the decoded planes, or one tile of them for tiled decodes,
+ * plus for each output width (0 for full size) the P010 frame and
+ * libultrahdr's working buffers, or the plain jpeg being written. Previews
+ * are counted as if decoded from the full image.
+ */
+uint64_t estimate_conversion_bytes(const struct heif_image_handle *handle,
+                                   const std::vector<int> &output_widths,
+                                   const struct heif2jpg_encode_options &encode_options,
+                                   bool output_p010, bool tiled);
+
+/*
+ * Decodes an opened image tile by tile, packing each tile into packed before
+ * the next one is decoded. packed is allocated to hold the whole frame, but
+ * only one decoded tile is in memory at a time and decoded.image stays null.
+ */
+int decode_p010_image_tiled(DecodedImage &decoded, const struct heif_image_tiling &tiling,
+                            P010Image &packed, bool verbose,
+                            struct heif2jpg_conversion_stats *stats = nullptr);
+
+/* Converts a decoded 10-bit YCbCr 4:2:0 image to P010; 8-bit images are widened */
+int pack_p010_image(heif_image *image, P010Image &packed, bool verbose);
+
+/*
+ * Like pack_p010_image, but shifts the decoded Y plane in place and points
+ * packed at it with libheif's stride, so only the interleaved UV plane is
+ * written to new memory. This modifies image, which must stay alive until
+ * packed is no longer used. 8-bit images are copied like pack_p010_image.
+ */
+int pack_p010_image_in_place(heif_image *image, P010Image &packed, bool verbose);
+
+/*
+ * Gets the size image is packed at for encode_options. Returns true if
+ * new_width shrinks it, in which case it should be packed with
+ * pack_p010_image_scaled(); the height keeps the aspect ratio, rounded to an
+ * even number of rows for 4:2:0.
+ */
+bool get_downscaled_size(heif_image *image,
+                         const struct heif2jpg_encode_options &encode_options,
+                         int &width, int &height);
+
+/*
+ * Like pack_p010_image, but resamples the decoded planes to width x height
+ * on the way, so only output-sized P010 planes are ever written. image is
+ * left untouched.
+ */
+int pack_p010_image_scaled(heif_image *image, P010Image &packed, int width, int height,
+                           enum heif2jpg_resize_filter filter, bool verbose);
+
+/*
+ * Encodes a P010 image as an ultra HDR jpg using the worker's encoder.
+ * Images already packed at new_width are encoded as they are; anything else
+ * (upscales, and tiled decodes packed at full size) is resized by libultrahdr.
+ * *encoded points into the encoder and stays valid until the worker's encoder
+ * is reset or used for another image.
+ *
+ * metadata, if given, supplies the color description and EXIF as
+ * encode_options asks. libultrahdr writes its own XMP for the gainmap and
+ * an ICC profile for the base image, so the image's XMP and ICC are left
+ * out.
+ */
+int encode_uhdr_image(P010Image &packed,
+                      const struct heif2jpg_encode_options &encode_options,
+                      ConversionWorker &worker,
+                      const uhdr_compressed_image_t **encoded,
+                      const struct heif2jpg_image_metadata *metadata = nullptr);
+
+/*
+ * True if image is written as a plain jpeg by encode_sdr_jpeg() rather than
+ * packed to P010: it's 8-bit and encode_options doesn't upconvert it.
+ */
+bool is_sdr_jpeg_image(heif_image *image, const struct heif2jpg_encode_options &encode_options);
+
+/*
+ * Encodes an 8-bit image as a plain jpeg at the output size, with the
+ * worker's SdrJpegEncoder, copying metadata's EXIF, XMP and ICC into it if
+ * encode_options asks. *encoded stays valid until the worker encodes
+ * another image.
+ */
+int encode_sdr_jpeg(heif_image *image, const struct heif2jpg_encode_options &encode_options,
+                    ConversionWorker &worker, const uhdr_compressed_image_t **encoded,
+                    const struct heif2jpg_image_metadata *metadata = nullptr);
+
+/*
+ * Encodes a decoded image as a jpeg the way convert_heif_image() would,
+ * packing it first if it's written as ultra HDR, without writing it
+ * anywhere. *encoded stays valid until the worker's encoder is reset or
+ * either of its encoders is used for another image.
+ */
+int encode_heif_jpeg(DecodedImage &decoded,
+                     const struct heif2jpg_encode_options &encode_options,
+                     ConversionWorker &worker, const uhdr_compressed_image_t **encoded,
+                     struct heif2jpg_conversion_stats *stats = nullptr);
+
+int save_uhdr_jpg_file(struct heif_image_handle *handle,
+    heif_image *image,
+    struct heif2jpg_encode_options encode_options,
+    std::string output_filename,
+    ConversionWorker &worker,
+    struct heif2jpg_conversion_stats *stats = nullptr,
+    const struct heif2jpg_image_metadata *metadata = nullptr);
+
+int save_p010_file(struct heif_image_handle *handle, heif_image *image,
+                   std::string output_filename,
+                   ConversionWorker &worker,
+                   struct heif2jpg_conversion_stats *stats = nullptr);
+
+/*
+ * Decodes an image from read_heif_file() or read_heif_image() and writes it
+ * to output_filename as either an ultra HDR jpg or a raw P010 file. 8-bit
+ * images become plain jpegs unless encode_options upconverts them.
+ */
+int convert_heif_image(DecodedImage &decoded,
+                       const std::string &output_filename,
+                       bool output_p010,
+                       const struct heif2jpg_encode_options &encode_options,
+                       ConversionWorker &worker,
+                       struct heif2jpg_conversion_stats *stats = nullptr);
+
+/*
+ * Like convert_heif_image(), but appends the jpg or raw P010 output to out
+ * instead of writing it to a file, so worker.write_mode doesn't apply.
+ */
+int convert_heif_image_to_buffer(DecodedImage &decoded, std::vector<uint8_t> &out,
+                                 bool output_p010,
+                                 const struct heif2jpg_encode_options &encode_options,
+                                 ConversionWorker &worker,
+                                 struct heif2jpg_conversion_stats *stats = nullptr);
+
+/*
+ * Reads input_filename, decodes its primary image and writes it to
+ * output_filename as either an ultra HDR jpg or a raw P010 file.
+ *
+ * Returns 0 on success, or the same non-zero codes the heif2jpg executable
+ * exits with.
+ */
+int convert_heif_file(const std::string &input_filename,
+                      const std::string &output_filename,
+                      bool output_p010,
+                      const struct heif2jpg_encode_options &encode_options,
+                      ConversionWorker &worker,
+                      struct heif2jpg_conversion_stats *stats = nullptr);
+
+#endif /* HEIF2JPG_CONVERT_H */
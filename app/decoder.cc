@@ -0,0 +1,113 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * Choice of the libheif plugin that decodes HEVC images
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "decoder.h"
+#include "log.h"
+
+#define SOFTWARE_DECODER "libde265"
+#define LIBAVCODEC_DECODER "ffmpeg"
+
+/* Set before any decoding starts and only read afterwards */
+static std::string selected;
+static int decoding_threads = 0;
+
+/* Decoder ids libheif has for HEVC, highest priority first */
+static std::vector<std::string> available_decoders()
+{
+    int count = heif_get_decoder_descriptors(heif_compression_HEVC, nullptr, 0);
+    std::vector<const struct heif_decoder_descriptor *> descriptors(count);
+    count = heif_get_decoder_descriptors(heif_compression_HEVC, descriptors.data(), count);
+
+    std::vector<std::string> ids;
+    for (int i = 0; i < count; i++)
+        ids.push_back(heif_decoder_descriptor_get_id_name(descriptors[i]));
+
+    return ids;
+}
+
+static bool has_decoder(const std::vector<std::string> &ids, const std::string &id)
+{
+    for (const std::string &available : ids) {
+        if (available == id)
+            return true;
+    }
+
+    return false;
+}
+
+bool select_heif_decoder(const std::string &name)
+{
+    std::vector<std::string> ids = available_decoders();
+
+    if (name == "auto") {
+        selected = has_decoder(ids, LIBAVCODEC_DECODER) ? LIBAVCODEC_DECODER : SOFTWARE_DECODER;
+    } else if (has_decoder(ids, name)) {
+        selected = name;
+    } else if (name == LIBAVCODEC_DECODER || name == SOFTWARE_DECODER) {
+        std::cerr << "libheif was built without the " << name << " decoder; using "
+                  << SOFTWARE_DECODER << std::endl;
+        selected = SOFTWARE_DECODER;
+    } else {
+        std::cerr << "Unknown decoder \"" << name << "\"; available: auto";
+        for (const std::string &id : ids)
+            std::cerr << ", " << id;
+        std::cerr << std::endl;
+        return false;
+    }
+
+    /* Even libde265 can be missing from a libheif built without it */
+    if (!has_decoder(ids, selected))
+        selected.clear();
+
+    return true;
+}
+
+const char *selected_heif_decoder()
+{
+    return selected.empty() ? nullptr : selected.c_str();
+}
+
+const char *heif_decoder_name(const char *id)
+{
+    return id ? id : "default";
+}
+
+const char *fall_back_heif_decoder(const char *id, const struct heif_error &err)
+{
+    static std::atomic<bool> warned = false;
+
+    if (!id || strcmp(id, SOFTWARE_DECODER) == 0)
+        return nullptr;
+
+    if (!warned.exchange(true))
+        error_out() << "libheif: " << id << " decoder failed (" << err.message
+                    << "); falling back to " << SOFTWARE_DECODER << std::endl;
+
+    return SOFTWARE_DECODER;
+}
+
+void set_heif_decoding_threads(int threads)
+{
+    decoding_threads = threads;
+}
+
+int heif_decoding_threads()
+{
+    return decoding_threads;
+}
+
+void apply_heif_decoding_threads(struct heif_context *ctx)
+{
+    /* libheif counts threads besides the caller's, so one thread is none */
+    if (decoding_threads > 0)
+        heif_context_set_max_decoding_threads(ctx, decoding_threads > 1 ? decoding_threads : 0);
+}
@@ -0,0 +1,52 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * Choice of the libheif plugin that decodes HEVC images
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#ifndef HEIF2JPG_DECODER_H
+#define HEIF2JPG_DECODER_H
+
+#include <string>
+
+#include <libheif/heif.h>
+
+/*
+ * Picks the decoder every later decode uses. "auto" takes the ffmpeg
+ * plugin, libavcodec's software HEVC decoder, when libheif was built with
+ * it, and libde265 otherwise. Any other name is a libheif decoder id such as
+ * "libde265" or "ffmpeg".
+ *
+ * A known decoder this build of libheif doesn't have falls back to libde265
+ * with a warning. Returns false, listing the available decoders, for a name
+ * libheif has never heard of. Call once after heif_init(), before decoding.
+ */
+bool select_heif_decoder(const std::string &name);
+
+/* Id for heif_decoding_options::decoder_id; nullptr leaves it to libheif */
+const char *selected_heif_decoder();
+
+/* Name to report for a decoder_id of id */
+const char *heif_decoder_name(const char *id);
+
+/*
+ * Called when decoding with id failed with err. Returns the decoder to retry
+ * with, or nullptr if id already was the last resort. The first fallback is
+ * reported with error_out(); later ones are quiet.
+ */
+const char *fall_back_heif_decoder(const char *id, const struct heif_error &err);
+
+/*
+ * Threads libheif may use inside one decode: it decodes that many grid
+ * tiles at once and, from libheif 1.21, asks the HEVC decoder for as many
+ * worker threads. 0 keeps libheif's defaults. Set before decoding starts;
+ * contexts that are already open need apply_heif_decoding_threads().
+ */
+void set_heif_decoding_threads(int threads);
+int heif_decoding_threads();
+
+/* Gives ctx the tile thread count from set_heif_decoding_threads() */
+void apply_heif_decoding_threads(struct heif_context *ctx);
+
+#endif /* HEIF2JPG_DECODER_H */
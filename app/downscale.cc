@@ -0,0 +1,472 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * Downscaling of decoded YCbCr planes, for previews and for packing images
+ * straight to their output size, with SIMD row kernels picked at runtime
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "downscale.h"
+#include "log.h"
+#include "p010_pack.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#endif
+
+bool parse_resize_filter(const std::string &name, enum heif2jpg_resize_filter &filter)
+{
+    if (name == "box")
+        filter = HEIF2JPG_RESIZE_BOX;
+    else if (name == "lanczos")
+        filter = HEIF2JPG_RESIZE_LANCZOS;
+    else
+        return false;
+
+    return true;
+}
+
+static void filter_row_scalar(const float *src, const int *first, const float *weights,
+                              int taps, float *out, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        const float *s = src + first[i];
+        const float *w = weights + i * taps;
+        float sum = 0.0f;
+        for (int k = 0; k < taps; k++)
+            sum += s[k] * w[k];
+        out[i] = sum;
+    }
+}
+
+static void filter_rows_scalar(const float *const *rows, const float *weights, int taps,
+                               float *out, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        out[i] = rows[0][i] * weights[0];
+
+    for (int k = 1; k < taps; k++)
+        for (size_t i = 0; i < n; i++)
+            out[i] += rows[k][i] * weights[k];
+}
+
+/* Same order of operations as the SIMD kernels: round, clamp, truncate */
+static inline uint16_t quantize(float v, int shift)
+{
+    v = std::min(std::max(v + 0.5f, 0.0f), 1023.0f);
+    return (uint16_t)((int)v << shift);
+}
+
+static void store_y_scalar(const float *src, uint16_t *dst, size_t n, int shift)
+{
+    for (size_t i = 0; i < n; i++)
+        dst[i] = quantize(src[i], shift);
+}
+
+static void store_uv_scalar(const float *cb, const float *cr, uint16_t *dst, size_t n,
+                            int shift)
+{
+    for (size_t i = 0; i < n; i++) {
+        dst[2 * i] = quantize(cb[i], shift);
+        dst[2 * i + 1] = quantize(cr[i], shift);
+    }
+}
+
+const struct resample_kernels resample_scalar_kernels = {
+    "scalar", filter_row_scalar, filter_rows_scalar, store_y_scalar, store_uv_scalar
+};
+
+#if defined(__x86_64__) || defined(_M_X64)
+static void filter_row_sse2(const float *src, const int *first, const float *weights,
+                            int taps, float *out, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        const float *s = src + first[i];
+        const float *w = weights + i * taps;
+        __m128 sum = _mm_setzero_ps();
+        for (int k = 0; k < taps; k += 4)
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(s + k), _mm_loadu_ps(w + k)));
+
+        sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+        sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+        out[i] = _mm_cvtss_f32(sum);
+    }
+}
+
+static void filter_rows_sse2(const float *const *rows, const float *weights, int taps,
+                             float *out, size_t n)
+{
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m128 sum = _mm_mul_ps(_mm_loadu_ps(rows[0] + i), _mm_set1_ps(weights[0]));
+        for (int k = 1; k < taps; k++)
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(rows[k] + i),
+                                             _mm_set1_ps(weights[k])));
+        _mm_storeu_ps(out + i, sum);
+    }
+
+    for (; i < n; i++) {
+        out[i] = rows[0][i] * weights[0];
+        for (int k = 1; k < taps; k++)
+            out[i] += rows[k][i] * weights[k];
+    }
+}
+
+/* Eight samples to 16 bits; values are clamped to 10 bits so packs can't saturate */
+static inline __m128i quantize_sse2(const float *src, __m128i shift)
+{
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 max = _mm_set1_ps(1023.0f);
+
+    __m128 a = _mm_min_ps(_mm_max_ps(_mm_add_ps(_mm_loadu_ps(src), half), zero), max);
+    __m128 b = _mm_min_ps(_mm_max_ps(_mm_add_ps(_mm_loadu_ps(src + 4), half), zero), max);
+    __m128i v = _mm_packs_epi32(_mm_cvttps_epi32(a), _mm_cvttps_epi32(b));
+
+    return _mm_sll_epi16(v, shift);
+}
+
+static void store_y_sse2(const float *src, uint16_t *dst, size_t n, int shift)
+{
+    __m128i count = _mm_cvtsi32_si128(shift);
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8)
+        _mm_storeu_si128((__m128i *)(dst + i), quantize_sse2(src + i, count));
+
+    store_y_scalar(src + i, dst + i, n - i, shift);
+}
+
+static void store_uv_sse2(const float *cb, const float *cr, uint16_t *dst, size_t n,
+                          int shift)
+{
+    __m128i count = _mm_cvtsi32_si128(shift);
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m128i u = quantize_sse2(cb + i, count);
+        __m128i v = quantize_sse2(cr + i, count);
+        _mm_storeu_si128((__m128i *)(dst + 2 * i), _mm_unpacklo_epi16(u, v));
+        _mm_storeu_si128((__m128i *)(dst + 2 * i + 8), _mm_unpackhi_epi16(u, v));
+    }
+
+    store_uv_scalar(cb + i, cr + i, dst + 2 * i, n - i, shift);
+}
+
+const struct resample_kernels resample_sse2_kernels = {
+    "sse2", filter_row_sse2, filter_rows_sse2, store_y_sse2, store_uv_sse2
+};
+#endif
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+static void filter_row_neon(const float *src, const int *first, const float *weights,
+                            int taps, float *out, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        const float *s = src + first[i];
+        const float *w = weights + i * taps;
+        float32x4_t sum = vdupq_n_f32(0.0f);
+        for (int k = 0; k < taps; k += 4)
+            sum = vmlaq_f32(sum, vld1q_f32(s + k), vld1q_f32(w + k));
+        out[i] = vaddvq_f32(sum);
+    }
+}
+
+static void filter_rows_neon(const float *const *rows, const float *weights, int taps,
+                             float *out, size_t n)
+{
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t sum = vmulq_n_f32(vld1q_f32(rows[0] + i), weights[0]);
+        for (int k = 1; k < taps; k++)
+            sum = vmlaq_n_f32(sum, vld1q_f32(rows[k] + i), weights[k]);
+        vst1q_f32(out + i, sum);
+    }
+
+    for (; i < n; i++) {
+        out[i] = rows[0][i] * weights[0];
+        for (int k = 1; k < taps; k++)
+            out[i] += rows[k][i] * weights[k];
+    }
+}
+
+static inline uint16x8_t quantize_neon(const float *src, int16x8_t shift)
+{
+    const float32x4_t half = vdupq_n_f32(0.5f);
+    const float32x4_t zero = vdupq_n_f32(0.0f);
+    const float32x4_t max = vdupq_n_f32(1023.0f);
+
+    float32x4_t a = vminq_f32(vmaxq_f32(vaddq_f32(vld1q_f32(src), half), zero), max);
+    float32x4_t b = vminq_f32(vmaxq_f32(vaddq_f32(vld1q_f32(src + 4), half), zero), max);
+    uint16x8_t v = vcombine_u16(vmovn_u32(vcvtq_u32_f32(a)), vmovn_u32(vcvtq_u32_f32(b)));
+
+    return vshlq_u16(v, shift);
+}
+
+static void store_y_neon(const float *src, uint16_t *dst, size_t n, int shift)
+{
+    int16x8_t count = vdupq_n_s16((int16_t)shift);
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8)
+        vst1q_u16(dst + i, quantize_neon(src + i, count));
+
+    store_y_scalar(src + i, dst + i, n - i, shift);
+}
+
+static void store_uv_neon(const float *cb, const float *cr, uint16_t *dst, size_t n,
+                          int shift)
+{
+    int16x8_t count = vdupq_n_s16((int16_t)shift);
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        uint16x8x2_t uv;
+        uv.val[0] = quantize_neon(cb + i, count);
+        uv.val[1] = quantize_neon(cr + i, count);
+        vst2q_u16(dst + 2 * i, uv);
+    }
+
+    store_uv_scalar(cb + i, cr + i, dst + 2 * i, n - i, shift);
+}
+
+const struct resample_kernels resample_neon_kernels = {
+    "neon", filter_row_neon, filter_rows_neon, store_y_neon, store_uv_neon
+};
+#endif
+
+static const struct resample_kernels &select_resample_kernels()
+{
+#if defined(__x86_64__) || defined(_M_X64)
+#ifdef HEIF2JPG_HAVE_AVX2
+    if (cpu_has_avx2())
+        return resample_avx2_kernels;
+#endif
+    return resample_sse2_kernels;
+#elif defined(__aarch64__) || defined(_M_ARM64)
+    return resample_neon_kernels;
+#else
+    return resample_scalar_kernels;
+#endif
+}
+
+const struct resample_kernels &get_resample_kernels()
+{
+    static const struct resample_kernels &kernels = select_resample_kernels();
+    return kernels;
+}
+
+static double lanczos3(double x)
+{
+    if (x == 0.0)
+        return 1.0;
+    if (x <= -3.0 || x >= 3.0)
+        return 0.0;
+
+    const double pi = 3.14159265358979323846;
+    double px = pi * x;
+    return 3.0 * std::sin(px) * std::sin(px / 3.0) / (px * px);
+}
+
+/*
+ * Source sample j covers [j, j + 1). When shrinking, the filter is stretched
+ * to the output sample spacing so every source sample contributes; taps
+ * that fall off the edge are folded onto the edge sample.
+ */
+struct PlaneResampler::weights PlaneResampler::make_weights(int src_size, int dst_size,
+                                                             int tap_align,
+                                                             enum heif2jpg_resize_filter filter)
+{
+    double scale = (double)src_size / dst_size;
+    double filter_scale = std::max(scale, 1.0);
+    double support = (filter == HEIF2JPG_RESIZE_BOX ? 0.5 : 3.0) * filter_scale;
+
+    std::vector<std::vector<float>> taps(dst_size);
+    struct weights w;
+    w.first.resize(dst_size);
+    w.count.resize(dst_size);
+
+    for (int i = 0; i < dst_size; i++) {
+        double center = (i + 0.5) * scale;
+        int lo = (int)std::floor(center - support);
+        int hi = (int)std::ceil(center + support);
+        int clamped_lo = std::max(lo, 0);
+        int clamped_hi = std::min(hi, src_size);
+        std::vector<double> acc(clamped_hi - clamped_lo, 0.0);
+
+        for (int j = lo; j < hi; j++) {
+            double weight;
+            if (filter == HEIF2JPG_RESIZE_BOX)
+                weight = std::max(0.0, std::min(j + 1.0, center + support) -
+                                       std::max((double)j, center - support));
+            else
+                weight = lanczos3((j + 0.5 - center) / filter_scale);
+
+            acc[std::clamp(j, clamped_lo, clamped_hi - 1) - clamped_lo] += weight;
+        }
+
+        size_t begin = 0, end = acc.size();
+        while (begin + 1 < end && acc[begin] == 0.0)
+            begin++;
+        while (end - 1 > begin && acc[end - 1] == 0.0)
+            end--;
+
+        double sum = 0.0;
+        for (size_t k = begin; k < end; k++)
+            sum += acc[k];
+
+        w.first[i] = clamped_lo + (int)begin;
+        w.count[i] = (int)(end - begin);
+        for (size_t k = begin; k < end; k++)
+            taps[i].push_back((float)(acc[k] / sum));
+        w.taps = std::max(w.taps, w.count[i]);
+    }
+
+    w.taps = (w.taps + tap_align - 1) / tap_align * tap_align;
+    w.weights.assign((size_t)dst_size * w.taps, 0.0f);
+    for (int i = 0; i < dst_size; i++)
+        std::copy(taps[i].begin(), taps[i].end(), w.weights.begin() + (size_t)i * w.taps);
+
+    return w;
+}
+
+PlaneResampler::PlaneResampler(const uint8_t *src, size_t src_stride, int src_width,
+                               int src_height, int src_bits, int dst_width, int dst_height,
+                               enum heif2jpg_resize_filter filter)
+    : kernels_(get_resample_kernels()), src_(src), src_stride_(src_stride),
+      src_width_(src_width), src_bits_(src_bits), dst_width_(dst_width),
+      xw_(make_weights(src_width, dst_width, RESAMPLE_TAP_ALIGN, filter)),
+      yw_(make_weights(src_height, dst_height, 1, filter))
+{
+    /* The padded taps of the last outputs read past the row; they see zeros */
+    int last = *std::max_element(xw_.first.begin(), xw_.first.end());
+    widened_.assign(std::max(src_width, last + xw_.taps), 0.0f);
+
+    ring_rows_ = yw_.taps;
+    ring_.resize((size_t)ring_rows_ * dst_width);
+    ring_row_.assign(ring_rows_, -1);
+    rows_.resize(yw_.taps);
+    out_.resize(dst_width);
+}
+
+const float *PlaneResampler::source_row(int sy)
+{
+    float *filtered = ring_.data() + (size_t)(sy % ring_rows_) * dst_width_;
+    if (ring_row_[sy % ring_rows_] == sy)
+        return filtered;
+
+    /* Widened to 10-bit units here, so 8-bit planes come out like 10-bit ones */
+    const uint8_t *row = src_ + sy * src_stride_;
+    float scale = (float)(1 << (10 - src_bits_));
+    if (src_bits_ <= 8) {
+        for (int x = 0; x < src_width_; x++)
+            widened_[x] = row[x] * scale;
+    } else {
+        const uint16_t *row16 = reinterpret_cast<const uint16_t *>(row);
+        for (int x = 0; x < src_width_; x++)
+            widened_[x] = row16[x] * scale;
+    }
+
+    kernels_.filter_row(widened_.data(), xw_.first.data(), xw_.weights.data(), xw_.taps,
+                        filtered, dst_width_);
+    ring_row_[sy % ring_rows_] = sy;
+
+    return filtered;
+}
+
+const float *PlaneResampler::row(int y)
+{
+    int first = yw_.first[y];
+    int count = yw_.count[y];
+
+    for (int k = 0; k < count; k++)
+        rows_[k] = source_row(first + k);
+
+    kernels_.filter_rows(rows_.data(), yw_.weights.data() + (size_t)y * yw_.taps, count,
+                         out_.data(), dst_width_);
+
+    return out_.data();
+}
+
+/* Resampled samples in 10-bit units back to 8 bits */
+static void store_row8(const float *src, uint8_t *dst, int n)
+{
+    for (int i = 0; i < n; i++)
+        dst[i] = (uint8_t)std::clamp((int)(src[i] * 0.25f + 0.5f), 0, 255);
+}
+
+int downscale_heif_image(const heif_image *src, int width, int height, heif_image **out)
+{
+    struct heif_error err;
+    int chroma_width = (width + 1) / 2;
+    int chroma_height = (height + 1) / 2;
+    int bits = heif_image_get_bits_per_pixel_range(src, heif_channel_Y) == 8 ? 8 : 10;
+
+    err = heif_image_create(width, height, heif_colorspace_YCbCr, heif_chroma_420, out);
+    if (err.code) {
+        error_out() << "libheif: Could not create preview image: " << err.message << std::endl;
+        return 8;
+    }
+
+    /* The encoders take range, matrix and primaries from here */
+    struct heif_color_profile_nclx *nclx = nullptr;
+    err = heif_image_get_nclx_color_profile(src, &nclx);
+    if (!err.code && nclx) {
+        heif_image_set_nclx_color_profile(*out, nclx);
+        heif_nclx_color_profile_free(nclx);
+    }
+
+    const struct {
+        enum heif_channel channel;
+        int width, height;
+    } planes[] = {
+        {heif_channel_Y, width, height},
+        {heif_channel_Cb, chroma_width, chroma_height},
+        {heif_channel_Cr, chroma_width, chroma_height},
+    };
+
+    const struct resample_kernels &kernels = get_resample_kernels();
+
+    for (const auto &plane : planes) {
+        err = heif_image_add_plane(*out, plane.channel, plane.width, plane.height, bits);
+        if (err.code) {
+            error_out() << "libheif: Could not create preview image: " << err.message << std::endl;
+            heif_image_release(*out);
+            *out = nullptr;
+            return 8;
+        }
+
+        size_t src_stride, dst_stride;
+        const uint8_t *src_plane = heif_image_get_plane_readonly2(src, plane.channel, &src_stride);
+        uint8_t *dst_plane = heif_image_get_plane2(*out, plane.channel, &dst_stride);
+
+        PlaneResampler resampler(src_plane, src_stride,
+                                 heif_image_get_width(src, plane.channel),
+                                 heif_image_get_height(src, plane.channel),
+                                 heif_image_get_bits_per_pixel_range(src, plane.channel),
+                                 plane.width, plane.height, HEIF2JPG_RESIZE_BOX);
+
+        for (int y = 0; y < plane.height; y++) {
+            if (bits == 8)
+                store_row8(resampler.row(y), dst_plane + y * dst_stride, plane.width);
+            else /* LSB-aligned, like a decoded 10-bit image */
+                kernels.store_y(resampler.row(y),
+                                reinterpret_cast<uint16_t *>(dst_plane + y * dst_stride),
+                                plane.width, 0);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,128 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * Downscaling of decoded YCbCr planes, for previews and for packing images
+ * straight to their output size, with SIMD row kernels picked at runtime
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#ifndef HEIF2JPG_DOWNSCALE_H
+#define HEIF2JPG_DOWNSCALE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <libheif/heif.h>
+#include <libheif/heif_image.h>
+
+enum heif2jpg_resize_filter {
+    /* Area average: every output sample averages the source it covers */
+    HEIF2JPG_RESIZE_BOX,
+    /* Lanczos-3: sharper, at about three times the taps of a box */
+    HEIF2JPG_RESIZE_LANCZOS,
+};
+
+/* Parses "box" or "lanczos"; returns false for anything else */
+bool parse_resize_filter(const std::string &name, enum heif2jpg_resize_filter &filter);
+
+/* Horizontal taps are padded with zero weights to a multiple of this */
+#define RESAMPLE_TAP_ALIGN 8
+
+struct resample_kernels {
+    const char *name;
+    /*
+     * out[i] = sum over k < taps of src[first[i] + k] * weights[i * taps + k]
+     * for n outputs; taps is a multiple of RESAMPLE_TAP_ALIGN
+     */
+    void (*filter_row)(const float *src, const int *first, const float *weights, int taps,
+                       float *out, size_t n);
+    /* out[i] = sum over k < taps of rows[k][i] * weights[k] for n samples */
+    void (*filter_rows)(const float *const *rows, const float *weights, int taps,
+                        float *out, size_t n);
+    /* dst[i] = round(clamp(src[i], 0, 1023)) << shift */
+    void (*store_y)(const float *src, uint16_t *dst, size_t n, int shift);
+    /* As store_y, interleaved: dst[2i] from cb[i] and dst[2i + 1] from cr[i] */
+    void (*store_uv)(const float *cb, const float *cr, uint16_t *dst, size_t n, int shift);
+};
+
+/* Plain C++ kernels; the SIMD kernels match them to within float rounding */
+extern const struct resample_kernels resample_scalar_kernels;
+
+/* The fastest kernels the running CPU supports, chosen on first use */
+const struct resample_kernels &get_resample_kernels();
+
+#if defined(__x86_64__) || defined(_M_X64)
+extern const struct resample_kernels resample_sse2_kernels;
+#endif
+#ifdef HEIF2JPG_HAVE_AVX2
+extern const struct resample_kernels resample_avx2_kernels;
+#endif
+#if defined(__aarch64__) || defined(_M_ARM64)
+extern const struct resample_kernels resample_neon_kernels;
+#endif
+
+/*
+ * Resamples one plane of 8- to 10-bit samples as a separable filter. Each
+ * source row is filtered horizontally once, into a ring of just the rows the
+ * vertical filter still needs, so memory stays at a few output-width rows
+ * however large the source is.
+ */
+class PlaneResampler
+{
+public:
+    /* src_stride is in bytes; samples are 1 byte if src_bits is 8, else 2 */
+    PlaneResampler(const uint8_t *src, size_t src_stride, int src_width, int src_height,
+                   int src_bits, int dst_width, int dst_height,
+                   enum heif2jpg_resize_filter filter);
+
+    PlaneResampler(const PlaneResampler &) = delete;
+    PlaneResampler &operator=(const PlaneResampler &) = delete;
+
+    /*
+     * Output row y, in unclamped 10-bit units. Rows must be asked for in
+     * increasing order; the result is valid until the next call.
+     */
+    const float *row(int y);
+
+private:
+    /* Source samples [first[i], first[i] + taps) make up output i */
+    struct weights {
+        std::vector<int> first, count;
+        std::vector<float> weights;
+        int taps = 0;
+    };
+
+    static struct weights make_weights(int src_size, int dst_size, int tap_align,
+                                       enum heif2jpg_resize_filter filter);
+    const float *source_row(int sy);
+
+    const struct resample_kernels &kernels_;
+    const uint8_t *src_;
+    size_t src_stride_;
+    int src_width_, src_bits_, dst_width_;
+    struct weights xw_, yw_;
+
+    /* Source row widened to float, padded for the last output's taps */
+    std::vector<float> widened_;
+    /* Horizontally filtered source rows, slot sy % ring_rows_ */
+    std::vector<float> ring_;
+    std::vector<int> ring_row_;
+    int ring_rows_;
+    std::vector<const float *> rows_;
+    std::vector<float> out_;
+};
+
+/*
+ * Box-filters a decoded YCbCr 4:2:0 image down to width x height. Every
+ * output sample is the average of the source samples it covers, so this is
+ * a single pass over the source with no ringing.
+ *
+ * The result is a new 8-bit image if src is 8-bit, such as most embedded
+ * thumbnails, and a 10-bit one otherwise, with src's nclx profile. Returns
+ * 0, or 8 with an error printed if the image can't be created.
+ */
+int downscale_heif_image(const heif_image *src, int width, int height, heif_image **out);
+
+#endif /* HEIF2JPG_DOWNSCALE_H */
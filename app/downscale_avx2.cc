@@ -0,0 +1,101 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * AVX2 resampling row kernels. This file is built with AVX2 code generation
+ * enabled, so nothing in it may run before get_resample_kernels() has checked
+ * that the CPU supports AVX2.
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#include <immintrin.h>
+
+#include "downscale.h"
+
+static void filter_row_avx2(const float *src, const int *first, const float *weights,
+                            int taps, float *out, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        const float *s = src + first[i];
+        const float *w = weights + i * taps;
+        __m256 sum = _mm256_setzero_ps();
+        for (int k = 0; k < taps; k += 8)
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(s + k),
+                                                   _mm256_loadu_ps(w + k)));
+
+        __m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+        half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+        half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 1));
+        out[i] = _mm_cvtss_f32(half);
+    }
+}
+
+static void filter_rows_avx2(const float *const *rows, const float *weights, int taps,
+                             float *out, size_t n)
+{
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m256 sum = _mm256_mul_ps(_mm256_loadu_ps(rows[0] + i), _mm256_set1_ps(weights[0]));
+        for (int k = 1; k < taps; k++)
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(rows[k] + i),
+                                                   _mm256_set1_ps(weights[k])));
+        _mm256_storeu_ps(out + i, sum);
+    }
+
+    for (; i < n; i++) {
+        out[i] = rows[0][i] * weights[0];
+        for (int k = 1; k < taps; k++)
+            out[i] += rows[k][i] * weights[k];
+    }
+}
+
+/* Sixteen samples to 16 bits, in order; clamped to 10 bits so packs can't saturate */
+static inline __m256i quantize_avx2(const float *src, __m128i shift)
+{
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 max = _mm256_set1_ps(1023.0f);
+
+    __m256 a = _mm256_min_ps(_mm256_max_ps(_mm256_add_ps(_mm256_loadu_ps(src), half), zero), max);
+    __m256 b = _mm256_min_ps(_mm256_max_ps(_mm256_add_ps(_mm256_loadu_ps(src + 8), half), zero), max);
+
+    /* packs works within 128-bit lanes, so put the quadwords back in order */
+    __m256i v = _mm256_packs_epi32(_mm256_cvttps_epi32(a), _mm256_cvttps_epi32(b));
+    v = _mm256_permute4x64_epi64(v, 0xd8);
+
+    return _mm256_sll_epi16(v, shift);
+}
+
+static void store_y_avx2(const float *src, uint16_t *dst, size_t n, int shift)
+{
+    __m128i count = _mm_cvtsi32_si128(shift);
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16)
+        _mm256_storeu_si256((__m256i *)(dst + i), quantize_avx2(src + i, count));
+
+    resample_scalar_kernels.store_y(src + i, dst + i, n - i, shift);
+}
+
+static void store_uv_avx2(const float *cb, const float *cr, uint16_t *dst, size_t n,
+                          int shift)
+{
+    __m128i count = _mm_cvtsi32_si128(shift);
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m256i u = quantize_avx2(cb + i, count);
+        __m256i v = quantize_avx2(cr + i, count);
+
+        __m256i lo = _mm256_unpacklo_epi16(u, v);
+        __m256i hi = _mm256_unpackhi_epi16(u, v);
+        _mm256_storeu_si256((__m256i *)(dst + 2 * i), _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i *)(dst + 2 * i + 16), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+
+    resample_scalar_kernels.store_uv(cb + i, cr + i, dst + 2 * i, n - i, shift);
+}
+
+const struct resample_kernels resample_avx2_kernels = {
+    "avx2", filter_row_avx2, filter_rows_avx2, store_y_avx2, store_uv_avx2
+};
@@ -0,0 +1,212 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * libheif2jpg: HEIF to ultra HDR jpg / P010 conversion as a library, from
+ * memory or files, with errors returned instead of printed
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#include <chrono>
+#include <memory>
+
+#include "heif2jpg.h"
+#include "log.h"
+#include "trace.h"
+
+/* Turns a conversion's return code and the errors it printed into an error */
+static struct heif2jpg_error make_error(int ret, const ErrorCapture &errors)
+{
+    struct heif2jpg_error error;
+
+    error.code = ret;
+    if (ret) {
+        error.message = errors.text();
+        if (error.message.empty())
+            error.message = "conversion failed (" + std::to_string(ret) + ")";
+    }
+
+    return error;
+}
+
+/* Gets the handle of an opened file's primary image */
+static int read_primary_heif_image(const HeifContextPtr &ctx, DecodedImage &decoded)
+{
+    heif_item_id primary_id;
+    struct heif_error err = heif_context_get_primary_image_ID(ctx.get(), &primary_id);
+    if (err.code) {
+        error_out() << "libheif: Could not get primary image: " << err.message << std::endl;
+        return 7;
+    }
+
+    return read_heif_image(ctx, primary_id, decoded);
+}
+
+/* Converters always take a file's primary image */
+static struct heif2jpg_cache_params
+make_cache_params(const struct heif2jpg_convert_options &options)
+{
+    struct heif2jpg_cache_params params;
+
+    params.encode_options = options.encode_options;
+    params.output_p010 = options.output_p010;
+    params.preview_width = options.preview_width;
+    params.images = "primary";
+
+    return params;
+}
+
+/* Writes a converted or cached output to output_filename */
+static int write_output_buffer(const std::string &output_filename,
+                               const std::vector<uint8_t> &out,
+                               enum heif2jpg_write_mode write_mode,
+                               struct heif2jpg_conversion_stats *stats)
+{
+    auto start = std::chrono::steady_clock::now();
+    int ret = write_output_file(output_filename, {{out.data(), out.size()}}, write_mode);
+    if (stats) {
+        stats->output_filename = output_filename;
+        stats->output_bytes = out.size();
+        stats->write_ms = elapsed_ms(start);
+    }
+
+    return ret;
+}
+
+void Heif2JpgConverter::apply(const struct heif2jpg_convert_options &options)
+{
+    worker_.verbose = options.verbose;
+    worker_.write_mode = options.write_mode;
+    worker_.tiled = options.tiled;
+    worker_.preview_width = options.preview_width;
+}
+
+struct heif2jpg_error Heif2JpgConverter::convert(const void *data, size_t size,
+                                                 const struct heif2jpg_convert_options &options,
+                                                 std::vector<uint8_t> &out,
+                                                 struct heif2jpg_conversion_stats *stats)
+{
+    ErrorCapture errors;
+    std::vector<heif_item_id> image_ids;
+    HeifContextPtr ctx;
+    std::string cache_key;
+    int ret;
+
+    apply(options);
+
+    if (options.cache) {
+        std::vector<uint8_t> cached;
+
+        cache_key = ConversionCache::key(data, size, make_cache_params(options));
+        if (options.cache->lookup(cache_key, cached)) {
+            out.insert(out.end(), cached.begin(), cached.end());
+            if (stats) {
+                stats->cache_hit = true;
+                stats->input_bytes = size;
+                stats->output_bytes = cached.size();
+            }
+            return make_error(0, errors);
+        }
+    }
+
+    auto input = std::make_shared<MappedInputFile>();
+    input->borrow(data, size);
+    ret = open_heif_file("buffer", input, ctx, image_ids, stats);
+    if (ret)
+        return make_error(ret, errors);
+
+    /* Released before returning, so nothing refers to data afterwards */
+    DecodedImage decoded;
+    size_t start = out.size();
+    ret = read_primary_heif_image(ctx, decoded);
+    if (!ret)
+        ret = convert_heif_image_to_buffer(decoded, out, options.output_p010,
+                                           options.encode_options, worker_, stats);
+    if (!ret && options.cache)
+        options.cache->store(cache_key, {{out.data() + start, out.size() - start}});
+
+    return make_error(ret, errors);
+}
+
+struct heif2jpg_error Heif2JpgConverter::convert_file(const std::string &input_filename,
+                                                      const std::string &output_filename,
+                                                      const struct heif2jpg_convert_options &options,
+                                                      struct heif2jpg_conversion_stats *stats)
+{
+    TraceSpan span("convert", input_filename);
+    ErrorCapture errors;
+    std::vector<heif_item_id> image_ids;
+    HeifContextPtr ctx;
+    std::string cache_key;
+    std::vector<uint8_t> out;
+    int ret;
+
+    apply(options);
+
+    auto start = std::chrono::steady_clock::now();
+    auto input = std::make_shared<MappedInputFile>();
+    ret = input->open(input_filename);
+    if (ret)
+        return make_error(ret, errors);
+
+    if (options.cache) {
+        cache_key = ConversionCache::key(input->data(), input->size(), make_cache_params(options));
+        if (options.cache->lookup(cache_key, out)) {
+            if (stats) {
+                stats->cache_hit = true;
+                stats->input_filename = input_filename;
+                stats->input_bytes = input->size();
+                stats->read_ms = elapsed_ms(start);
+            }
+            return make_error(write_output_buffer(output_filename, out, options.write_mode, stats),
+                              errors);
+        }
+    }
+
+    ret = open_heif_file(input_filename, input, ctx, image_ids, stats);
+    if (stats)
+        stats->read_ms = elapsed_ms(start);
+    if (ret)
+        return make_error(ret, errors);
+
+    DecodedImage decoded;
+    ret = read_primary_heif_image(ctx, decoded);
+    if (ret)
+        return make_error(ret, errors);
+
+    /* Cached outputs are converted to memory first, so the same bytes can be stored */
+    if (!options.cache) {
+        ret = convert_heif_image(decoded, output_filename, options.output_p010,
+                                 options.encode_options, worker_, stats);
+        return make_error(ret, errors);
+    }
+
+    ret = convert_heif_image_to_buffer(decoded, out, options.output_p010, options.encode_options,
+                                       worker_, stats);
+    if (!ret)
+        ret = write_output_buffer(output_filename, out, options.write_mode, stats);
+    if (!ret)
+        options.cache->store(cache_key, {{out.data(), out.size()}});
+
+    return make_error(ret, errors);
+}
+
+struct heif2jpg_error Heif2JpgConverter::convert_image(const HeifContextPtr &ctx,
+                                                       heif_item_id image_id,
+                                                       const std::string &output_filename,
+                                                       const struct heif2jpg_convert_options &options,
+                                                       struct heif2jpg_conversion_stats *stats)
+{
+    TraceSpan span("convert", output_filename);
+    ErrorCapture errors;
+    DecodedImage decoded;
+    int ret;
+
+    apply(options);
+
+    ret = read_heif_image(ctx, image_id, decoded);
+    if (!ret)
+        ret = convert_heif_image(decoded, output_filename, options.output_p010,
+                                 options.encode_options, worker_, stats);
+
+    return make_error(ret, errors);
+}
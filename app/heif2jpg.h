@@ -0,0 +1,99 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * libheif2jpg: HEIF to ultra HDR jpg / P010 conversion as a library, from
+ * memory or files, with errors returned instead of printed
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#ifndef HEIF2JPG_HEIF2JPG_H
+#define HEIF2JPG_HEIF2JPG_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "cache.h"
+#include "convert.h"
+
+/*
+ * How a conversion failed. code is one of the non-zero codes the heif2jpg
+ * executable exits with, and message what it would have printed; a code of
+ * 0 means it didn't fail.
+ */
+struct heif2jpg_error {
+    int code = 0;
+    std::string message;
+
+    explicit operator bool() const { return code != 0; }
+};
+
+struct heif2jpg_convert_options {
+    struct heif2jpg_encode_options encode_options;
+    /* Raw P010 instead of a jpg; encode_options is then ignored */
+    bool output_p010 = false;
+    /* Decode grid images one tile at a time instead of as a whole */
+    bool tiled = false;
+    /* If set, convert a preview this many pixels wide instead of the image */
+    uint16_t preview_width = 0;
+    /* How output files are written; buffers aren't affected */
+    enum heif2jpg_write_mode write_mode = HEIF2JPG_WRITE_BUFFERED;
+    /* Print informational/progress messages to the log */
+    bool verbose = false;
+    /*
+     * If set, convert() and convert_file() return outputs cached here for
+     * the same input and options, and cache the ones they convert
+     */
+    ConversionCache *cache = nullptr;
+};
+
+/*
+ * Converts one image after another, keeping its encoders warm in between
+ * like a batch worker does. A converter is used by one thread at a time;
+ * give each thread its own to convert in parallel. libheif must be
+ * initialized, e.g. with a LibHeifInitializer, while it's in use.
+ *
+ * Every call returns a heif2jpg_error. The errors a conversion runs into are
+ * collected into its message rather than printed to stderr.
+ */
+class Heif2JpgConverter
+{
+public:
+    Heif2JpgConverter() : worker_(false) {}
+
+    Heif2JpgConverter(const Heif2JpgConverter &) = delete;
+    Heif2JpgConverter &operator=(const Heif2JpgConverter &) = delete;
+
+    /*
+     * Converts the primary image of the HEIF file in data, which is parsed in
+     * place and only has to stay alive for the call, and appends the result
+     * to out.
+     */
+    struct heif2jpg_error convert(const void *data, size_t size,
+                                  const struct heif2jpg_convert_options &options,
+                                  std::vector<uint8_t> &out,
+                                  struct heif2jpg_conversion_stats *stats = nullptr);
+
+    /* Converts the primary image of input_filename; "-" writes to stdout */
+    struct heif2jpg_error convert_file(const std::string &input_filename,
+                                       const std::string &output_filename,
+                                       const struct heif2jpg_convert_options &options,
+                                       struct heif2jpg_conversion_stats *stats = nullptr);
+
+    /*
+     * Converts image_id of a file already opened with open_heif_file(). The
+     * input bytes aren't known here, so options.cache isn't used.
+     */
+    struct heif2jpg_error convert_image(const HeifContextPtr &ctx, heif_item_id image_id,
+                                        const std::string &output_filename,
+                                        const struct heif2jpg_convert_options &options,
+                                        struct heif2jpg_conversion_stats *stats = nullptr);
+
+private:
+    void apply(const struct heif2jpg_convert_options &options);
+
+    ConversionWorker worker_;
+};
+
+#endif /* HEIF2JPG_HEIF2JPG_H */
@@ -0,0 +1,191 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * Input files mapped into memory for libheif to parse in place
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "input_file.h"
+#include "log.h"
+#include "trace.h"
+
+MappedInputFile::~MappedInputFile()
+{
+    close();
+}
+
+int MappedInputFile::load(const std::string &filename)
+{
+    TraceSpan span("read", filename);
+    close();
+
+    FILE *file = fopen(filename.c_str(), "rb");
+    if (!file) {
+        error_out() << "Can't open " << filename << ": " << strerror(errno) << std::endl;
+        return 2;
+    }
+
+    size_t used = 0;
+    buffer_.resize(1 << 20);
+    for (;;) {
+        used += fread(buffer_.data() + used, 1, buffer_.size() - used, file);
+        if (used < buffer_.size())
+            break;
+        buffer_.resize(2 * buffer_.size());
+    }
+
+    bool failed = ferror(file);
+    fclose(file);
+    if (failed) {
+        error_out() << "Can't read " << filename << std::endl;
+        return 2;
+    }
+
+    buffer_.resize(used);
+    data_ = buffer_.data();
+    size_ = used;
+
+    return 0;
+}
+
+void MappedInputFile::assign(std::vector<uint8_t> data)
+{
+    close();
+
+    buffer_ = std::move(data);
+    data_ = buffer_.data();
+    size_ = buffer_.size();
+}
+
+void MappedInputFile::borrow(const void *data, size_t size)
+{
+    close();
+
+    data_ = static_cast<const uint8_t *>(data);
+    size_ = size;
+}
+
+#ifdef _WIN32
+int MappedInputFile::open(const std::string &filename, bool read_ahead)
+{
+    TraceSpan span("map", filename);
+    close();
+
+    DWORD access = read_ahead ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS;
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, access, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        error_out() << "Can't open " << filename << ": error " << GetLastError() << std::endl;
+        return 2;
+    }
+
+    LARGE_INTEGER li;
+    if (GetFileType(file) != FILE_TYPE_DISK || !GetFileSizeEx(file, &li) || li.QuadPart == 0) {
+        CloseHandle(file);
+        return load(filename);
+    }
+    file_ = file;
+    size_ = (size_t)li.QuadPart;
+
+    mapping_ = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping_)
+        data_ = static_cast<const uint8_t *>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+    if (!data_) {
+        error_out() << "Can't map " << filename << ": error " << GetLastError() << std::endl;
+        close();
+        return 2;
+    }
+    mapped_ = true;
+
+    return 0;
+}
+
+void MappedInputFile::close()
+{
+    if (mapped_)
+        UnmapViewOfFile(data_);
+    if (mapping_)
+        CloseHandle(mapping_);
+    if (file_)
+        CloseHandle(file_);
+
+    data_ = nullptr;
+    size_ = 0;
+    mapped_ = false;
+    mapping_ = nullptr;
+    file_ = nullptr;
+    buffer_.clear();
+}
+#else
+int MappedInputFile::open(const std::string &filename, bool read_ahead)
+{
+    TraceSpan span("map", filename);
+    close();
+
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        error_out() << "Can't open " << filename << ": " << strerror(errno) << std::endl;
+        return 2;
+    }
+
+    /* Pipes and the like can't be mapped, and an empty file needn't be */
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        ::close(fd);
+        return load(filename);
+    }
+
+    void *p = ::mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    /* The mapping keeps its own reference to the file */
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        error_out() << "Can't map " << filename << ": " << strerror(errno) << std::endl;
+        return 2;
+    }
+
+    /*
+     * libheif reads the boxes at the front, then the image data, mostly in
+     * order; have all of it read ahead rather than faulted in page by page.
+     * Without read ahead, even the kernel's own read around is turned off.
+     */
+    if (read_ahead) {
+        ::madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+        ::madvise(p, (size_t)st.st_size, MADV_WILLNEED);
+    } else {
+        ::madvise(p, (size_t)st.st_size, MADV_RANDOM);
+    }
+
+    data_ = static_cast<const uint8_t *>(p);
+    size_ = (size_t)st.st_size;
+    mapped_ = true;
+
+    return 0;
+}
+
+void MappedInputFile::close()
+{
+    if (mapped_)
+        ::munmap(const_cast<uint8_t *>(data_), size_);
+
+    data_ = nullptr;
+    size_ = 0;
+    mapped_ = false;
+    buffer_.clear();
+}
+#endif
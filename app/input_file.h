@@ -0,0 +1,67 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * Input files mapped into memory for libheif to parse in place
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#ifndef HEIF2JPG_INPUT_FILE_H
+#define HEIF2JPG_INPUT_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * A whole input file, read-only. Regular files are mapped, with a hint that
+ * they'll be read front to back, so the kernel reads ahead and libheif can
+ * parse the pages straight from the page cache. Anything that can't be
+ * mapped, like a pipe, is read into memory instead.
+ */
+class MappedInputFile
+{
+public:
+    MappedInputFile() = default;
+    ~MappedInputFile();
+
+    MappedInputFile(const MappedInputFile &) = delete;
+    MappedInputFile &operator=(const MappedInputFile &) = delete;
+
+    /*
+     * Returns 0, or 2 with an error printed if filename can't be read. With
+     * read_ahead false there's no read ahead hint, and only the pages that
+     * are actually read get faulted in; for just parsing the boxes up front.
+     */
+    int open(const std::string &filename, bool read_ahead = true);
+
+    /*
+     * Reads all of filename into memory now instead of mapping it, for when
+     * it's read ahead on another thread; returns as open() does
+     */
+    int load(const std::string &filename);
+
+    /* Takes over data that's already in memory, like a request body */
+    void assign(std::vector<uint8_t> data);
+
+    /* Reads data in place; the caller keeps it alive for as long as this is used */
+    void borrow(const void *data, size_t size);
+
+    /* Valid until the file is closed or destroyed */
+    const uint8_t *data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    void close();
+
+    const uint8_t *data_ = nullptr;
+    size_t size_ = 0;
+    bool mapped_ = false;
+    std::vector<uint8_t> buffer_;
+#ifdef _WIN32
+    void *file_ = nullptr;
+    void *mapping_ = nullptr;
+#endif
+};
+
+#endif /* HEIF2JPG_INPUT_FILE_H */
@@ -0,0 +1,55 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * Destination for informational and progress messages
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#include <iostream>
+
+#include "log.h"
+
+/* Only changed from main() before any conversion starts */
+static bool log_to_stderr = false;
+
+void set_log_to_stderr(bool to_stderr)
+{
+    log_to_stderr = to_stderr;
+}
+
+std::ostream &log_out()
+{
+    return log_to_stderr ? std::cerr : std::cout;
+}
+
+FILE *log_file()
+{
+    return log_to_stderr ? stderr : stdout;
+}
+
+/* The innermost ErrorCapture alive on this thread, if any */
+static thread_local std::ostringstream *captured_errors = nullptr;
+
+std::ostream &error_out()
+{
+    return captured_errors ? *captured_errors : std::cerr;
+}
+
+ErrorCapture::ErrorCapture()
+    : previous_(captured_errors)
+{
+    captured_errors = &errors_;
+}
+
+ErrorCapture::~ErrorCapture()
+{
+    captured_errors = previous_;
+}
+
+std::string ErrorCapture::text() const
+{
+    std::string text = errors_.str();
+    while (!text.empty() && text.back() == '\n')
+        text.pop_back();
+    return text;
+}
@@ -0,0 +1,51 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * Destination for informational and progress messages
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#ifndef HEIF2JPG_LOG_H
+#define HEIF2JPG_LOG_H
+
+#include <cstdio>
+#include <ostream>
+#include <sstream>
+#include <string>
+
+/*
+ * Messages go to stdout by default. Once stdout carries image data they are
+ * moved to stderr so they can't corrupt the output stream. Errors go to
+ * error_out().
+ */
+void set_log_to_stderr(bool to_stderr);
+
+std::ostream &log_out();
+FILE *log_file();
+
+/* std::cerr, unless an ErrorCapture is collecting this thread's errors */
+std::ostream &error_out();
+
+/*
+ * Collects the errors printed with error_out() on the creating thread for as
+ * long as it lives, so library callers get them back as text instead of on
+ * stderr. Captures nest; the innermost one gets the errors.
+ */
+class ErrorCapture
+{
+public:
+    ErrorCapture();
+    ~ErrorCapture();
+
+    ErrorCapture(const ErrorCapture &) = delete;
+    ErrorCapture &operator=(const ErrorCapture &) = delete;
+
+    /* Everything captured so far, without the trailing newline */
+    std::string text() const;
+
+private:
+    std::ostringstream errors_;
+    std::ostringstream *previous_;
+};
+
+#endif /* HEIF2JPG_LOG_H */
@@ -5,361 +5,47 @@
  *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
  */
 
-#include <cassert>
-#include <cmath>
-#include <cstring>
+#include <algorithm>
 #include <string>
 #include <iostream>
-#include <fstream>
+#include <thread>
 #include <vector>
 
 #include <argparse/argparse.hpp>
 
-#include <libheif/heif.h>
-#include <libheif/heif_image.h>
-
-#include <ultrahdr_api.h>
-
-/* Progress functions obtained from libheif's examples/heif_dec.cc */
-static int max_value_progress = 0;
-
-void start_progress(enum heif_progress_step step, int max_progress,
-                    void *progress_user_data)
-{
-    max_value_progress = max_progress;
-}
-
-void on_progress(enum heif_progress_step step, int progress,
-                 void *progress_user_data)
-{
-    std::cout << "decoding image... " << progress * 100 / max_value_progress << "%\r";
-    std::cout.flush();
-}
-
-void end_progress(enum heif_progress_step step, void *progress_user_data)
-{
-    std::cout << std::endl;
-}
-
-/* Obtained from libheif's examples/heif_dec.cc */
-class LibHeifInitializer
-{
-public:
-    LibHeifInitializer() { heif_init(nullptr); }
-    ~LibHeifInitializer() { heif_deinit(); }
-};
-
-/* Obtained from libheif's examples/heif_dec.cc */
-class ContextReleaser
-{
-public:
-    ContextReleaser(struct heif_context *ctx) : ctx_(ctx) {}
-
-    ~ContextReleaser()
-    {
-        heif_context_free(ctx_);
-    }
-
-private:
-    struct heif_context *ctx_;
-};
-
-struct heif2jpg_encode_options {
-    uhdr_color_gamut_t color_gamut;
-    uhdr_color_range_t color_range;
-    uhdr_color_transfer_t color_transfer;
-    uint16_t new_width;
-    uint8_t quality;
-};
-
-std::string derive_output_filename(const std::string &input_filename,
-                                   const std::string &suffix)
-{
-    std::string input_stem;
-    size_t dot_pos = input_filename.rfind('.');
-
-    if (dot_pos != std::string::npos)
-        input_stem = input_filename.substr(0, dot_pos);
-    else
-        input_stem = input_filename;
-
-    return std::string(input_stem + "." + suffix);
-}
-
-int save_uhdr_jpg_file(struct heif_image_handle *handle,
-    heif_image *image,
-    struct heif2jpg_encode_options encode_options,
-    std::string output_filename)
-{
-    uhdr_error_info_t status;
-    int ret;
-
-    std::ofstream fp(output_filename, std::ios::out | std::ios::binary);
-    if (!fp.good())
-    {
-        std::cerr << "Can't open " << output_filename << ": "
-                  << strerror(errno) << std::endl;
-        return 9;
-    }
-    
-    /* Get HEIF image parameters, arrays, pointers */  
-    int y_bpp = heif_image_get_bits_per_pixel_range(image, heif_channel_Y);
-    int cb_bpp = heif_image_get_bits_per_pixel_range(image, heif_channel_Cb);
-    int cr_bpp = heif_image_get_bits_per_pixel_range(image, heif_channel_Cr);
-
-    size_t y_stride, cb_stride, cr_stride;
-    const uint8_t *yp = heif_image_get_plane_readonly2(image, heif_channel_Y, &y_stride);
-    const uint8_t *cbp = heif_image_get_plane_readonly2(image, heif_channel_Cb, &cb_stride);
-    const uint8_t *crp = heif_image_get_plane_readonly2(image, heif_channel_Cr, &cr_stride);
-
-    assert(y_stride > 0);
-    assert(cb_stride > 0);
-    assert(cr_stride > 0);
-
-    int yw = heif_image_get_width(image, heif_channel_Y);
-    int yh = heif_image_get_height(image, heif_channel_Y);
-    int cw = heif_image_get_width(image, heif_channel_Cb);
-    int ch = heif_image_get_height(image, heif_channel_Cb);
-
-    if (yw < 0 || cw < 0)
-    {
-        fp.close();
-        std::cerr << "Invalid Y or C plane width in decoded image." << std::endl;
-        return 10;
-    }
-
-    /* Setup libultrahdr structures for output */
-    uhdr_raw_image_t raw_uhdr_image{};
-
-    raw_uhdr_image.fmt = UHDR_IMG_FMT_24bppYCbCrP010;
-    raw_uhdr_image.range = encode_options.color_range;
-    raw_uhdr_image.cg = encode_options.color_gamut;
-    raw_uhdr_image.ct = encode_options.color_transfer;
-    raw_uhdr_image.w = yw;
-    raw_uhdr_image.h = yh;
-
-    raw_uhdr_image.planes[UHDR_PLANE_Y] = malloc(2 * yw * yh);
-    raw_uhdr_image.planes[UHDR_PLANE_UV] = malloc(2 * (yw/2) * (yh/2) * 2);
-    raw_uhdr_image.planes[UHDR_PLANE_V] = nullptr;
-    raw_uhdr_image.stride[UHDR_PLANE_Y] = yw;
-    raw_uhdr_image.stride[UHDR_PLANE_UV] = yw;
-    raw_uhdr_image.stride[UHDR_PLANE_V] = 0;
-
-    /* If 10-bit image output, encode in memory in P010 format for input into libultrahdr */
-    if (y_bpp == 10)
-    {
-        std::cout << "Encoding image in P010 format in memory" << std::endl;
-
-        const uint16_t *yp_16 = (const uint16_t *)yp;
-        const uint16_t *cbp_16 = (const uint16_t *)cbp;
-        const uint16_t *crp_16 = (const uint16_t *)crp;
-
-        size_t word_pos = 0;
-
-        /* In P010, values are encoded in the 10 most significant bits. */
-        for (int y = 0; y < yh; y++)
-        {
-            for (int z = 0; z < yw; z++)
-            {
-                uint16_t word = *(yp_16 + z + (y * (y_stride / 2)));
-                word = (word << 6); // Little Endian
-                
-                ((uint16_t *)(raw_uhdr_image.planes[UHDR_PLANE_Y]))[word_pos] = word;
-                word_pos++;
-            }
-        }
-
-        /* The U and V planes are interleaved in P010;
-         * U == Cb, and V == Cr
-         */
-        word_pos = 0;
-        for (int y = 0; y < ch; y++)
-        {
-            for (int z = 0; z < cw; z++)
-            {
-                uint16_t word = *(cbp_16 + z + (y * (cb_stride / 2)));
-                word = (word << 6); // Little Endian
-
-                ((uint16_t *)(raw_uhdr_image.planes[UHDR_PLANE_UV]))[word_pos] = word;
-                word_pos++;
-
-                word = *(crp_16 + z + (y * (cr_stride / 2)));
-                word = (word << 6); // Little Endian
-
-                ((uint16_t *)(raw_uhdr_image.planes[UHDR_PLANE_UV]))[word_pos] = word;
-                word_pos++;
-            }
-        }
-
-        /* Raw image memory is set; setup encoder */
-        uhdr_codec_private_t* handle = uhdr_create_encoder();
-        status = uhdr_enc_set_raw_image(handle, &raw_uhdr_image, UHDR_HDR_IMG);
-        if (status.error_code != UHDR_CODEC_OK) {
-            if (status.has_detail) {
-                std::cerr << "UHDR encoder: " << status.detail << std::endl;
-            }
-            uhdr_release_encoder(handle);
-            return 11;
-        }
-
-        if (encode_options.new_width > 0) {
-            float scale_factor = (float)encode_options.new_width / yw;
-            uint16_t new_height = (uint16_t)std::round(yh * scale_factor);
-
-            uhdr_add_effect_resize(handle, encode_options.new_width, new_height);
-        }
- 
-        uhdr_enc_set_quality(handle, encode_options.quality, UHDR_BASE_IMG);
-        uhdr_enc_set_quality(handle, encode_options.quality, UHDR_GAIN_MAP_IMG);
-        uhdr_enc_set_using_multi_channel_gainmap(handle, false);
-        uhdr_enc_set_gainmap_scale_factor(handle, 1);
-        uhdr_enc_set_gainmap_gamma(handle, 1.0f);
-        uhdr_enc_set_preset(handle, UHDR_USAGE_BEST_QUALITY);
-
-        std::cout << "Encoding as ultra HDR jpeg..." << std::endl;
-
-        status = uhdr_encode(handle);
-        if (status.error_code != UHDR_CODEC_OK) {
-            if (status.has_detail) {
-                std::cerr << "UHDR encoder: " << status.detail << std::endl;
-            }
-            uhdr_release_encoder(handle);
-            return 12;
-        }
-
-        auto encoded_output = uhdr_get_encoded_stream(handle);
-        uhdr_compressed_image_t output_image{};
-    
-        output_image.data = malloc(encoded_output->data_sz);
-        memcpy(output_image.data, encoded_output->data, encoded_output->data_sz);
-        output_image.capacity = output_image.data_sz = encoded_output->data_sz;
-
-        uhdr_release_encoder(handle);
-
-        if (fp.is_open()) {
-            fp.write(static_cast<char*>(output_image.data), output_image.data_sz);
-        } else {
-            std::cerr << "Unable to write to file after encoding: " << output_filename << std::endl;
-            return 13;
-        }
-
-    } else {
-        std::cerr << "8-bit input not supported yet." << std::endl;
-        return 10;
-    }
-
-    return 0;
-}
-
-int save_p010_file(struct heif_image_handle *handle, heif_image *image,
-                   std::string output_filename)
-{
-    std::ofstream fp(output_filename, std::ios::out | std::ios::binary);
-    if (!fp.good())
-    {
-        std::cerr << "Can't open " << output_filename << ": "
-                  << strerror(errno) << std::endl;
-        return 9;
-    }
-
-    int y_bpp = heif_image_get_bits_per_pixel_range(image, heif_channel_Y);
-    int cb_bpp = heif_image_get_bits_per_pixel_range(image, heif_channel_Cb);
-    int cr_bpp = heif_image_get_bits_per_pixel_range(image, heif_channel_Cr);
-
-    printf("Encoding image with Y=%d, Cb=%d, Cr=%d bits per pixel\n", y_bpp, cb_bpp, cr_bpp);
-
-    size_t y_stride, cb_stride, cr_stride;
-    const uint8_t *yp = heif_image_get_plane_readonly2(image, heif_channel_Y, &y_stride);
-    const uint8_t *cbp = heif_image_get_plane_readonly2(image, heif_channel_Cb, &cb_stride);
-    const uint8_t *crp = heif_image_get_plane_readonly2(image, heif_channel_Cr, &cr_stride);
-
-    assert(y_stride > 0);
-    assert(cb_stride > 0);
-    assert(cr_stride > 0);
-
-    int yw = heif_image_get_width(image, heif_channel_Y);
-    int yh = heif_image_get_height(image, heif_channel_Y);
-    int cw = heif_image_get_width(image, heif_channel_Cb);
-    int ch = heif_image_get_height(image, heif_channel_Cb);
-
-    if (yw < 0 || cw < 0)
-    {
-        fp.close();
-        std::cerr << "Invalid Y or C plane width in decoded image." << std::endl;
-        return 10;
-    }
-
-    /* If 10-bit image output, use P010 format as output */
-    if (y_bpp == 10)
-    {
-        std::cout << "Output in P010 YUV format" << std::endl;
-
-        const uint16_t *yp_16 = (const uint16_t *)yp;
-        const uint16_t *cbp_16 = (const uint16_t *)cbp;
-        const uint16_t *crp_16 = (const uint16_t *)crp;
-
-        /* In P010, values are encoded in the 10 most significant bits, so the decoded plane cannot
-         * be written out to the output file as-is, unlike in 8-bit YUV420 below
-         */
-        for (int y = 0; y < yh; y++)
-        {
-            for (int z = 0; z < yw; z++)
-            {
-                uint16_t word = *(yp_16 + z + (y * (y_stride / 2)));
-                word = (word << 6); // Little Endian
-                fp.write((char *)&word, 2);
-            }
-        }
-
-        /* The U and V planes are interleaved in P010;
-         * U == Cb, and V == Cr
-         */
-        for (int y = 0; y < ch; y++)
-        {
-            for (int z = 0; z < cw; z++)
-            {
-                uint16_t word = *(cbp_16 + z + (y * (cb_stride / 2)));
-                word = (word << 6); // Little Endian
-                fp.write((char *)&word, 2);
-
-                word = *(crp_16 + z + (y * (cr_stride / 2)));
-                word = (word << 6); // Little Endian
-                fp.write((char *)&word, 2);
-            }
-        }
-    }
-    else
-    {
-        std::cerr << "8-bit input not supported yet." << std::endl;
-        return 10;
-    }
-
-    fp.close();
-    return 0;
-}
+#include "batch.h"
+#include "convert.h"
+#include "decoder.h"
+#include "heif2jpg.h"
+#include "log.h"
+#include "probe.h"
+#include "server.h"
+#include "sync.h"
+#include "trace.h"
 
 int main(int argc, char **argv)
 {
     /* Automatically inits and deinits the library in main() scope */
     LibHeifInitializer initializer;
 
-    struct heif_error err;
     int ret;
 
     /* Use imported argparser library to handle input arguments */
     argparse::ArgumentParser argparser("heif2jpg");
     argparser.add_argument("input_file")
+        .nargs(argparse::nargs_pattern::optional)
+        .default_value(std::string(""))
         .help("File path to HEIF file to convert");
     argparser.add_argument("output_file")
-        .default_value(std::string("-"))
-        .help("File path to file to write to");
+        .default_value(std::string(""))
+        .help("File path to file to write to; \"-\" writes to stdout, and if omitted the path is derived from input_file");
     argparser.add_argument("-p")
         .default_value(false)
         .help("Output a p010 encoded raw image instead of a jpeg (All encoding flags are ignored)")
         .flag();
     argparser.add_argument("-c")
         .default_value(2)
-        .help("(JPEG) Input color gamut: 0 = BT709, 1 = Display P3, 2 = BT2100")
+        .help("(JPEG) Input color gamut: 0 = BT709, 1 = Display P3, 2 = BT2100; -c, -r or -t override the image's nclx profile")
         .scan<'i', int>();
     argparser.add_argument("-r")
         .default_value(1)
@@ -373,10 +59,130 @@ int main(int argc, char **argv)
         .default_value((uint16_t)0)
         .help("(JPEG) Output image width, in pixels")
         .scan<'i', uint16_t>();
+    argparser.add_argument("--resize-filter")
+        .default_value(std::string("lanczos"))
+        .help("(JPEG) Filter for shrinking to -w as the image is packed: lanczos or box (faster, softer)");
     argparser.add_argument("-q")
         .default_value((uint8_t)95)
-        .help("(JPEG) Output base image and gainmap image quality, 0-100")
+        .help("(JPEG) Output base image quality, and gainmap image quality unless --gainmap-quality is given, 0-100")
         .scan<'i', uint8_t>();
+    argparser.add_argument("--preset")
+        .default_value(std::string("quality"))
+        .help("(JPEG) Ultra HDR encoder preset: quality, balanced (half size gainmap) or speed (realtime gainmap, quarter size)");
+    argparser.add_argument("--gainmap-quality")
+        .default_value(0)
+        .help("(JPEG) Gainmap image quality, 1-100, if it should differ from -q")
+        .scan<'i', int>();
+    argparser.add_argument("--gainmap-scale")
+        .default_value(0)
+        .help("(JPEG) Make the gainmap this many times smaller than the image on each side, 1-128; overrides --preset")
+        .scan<'i', int>();
+    argparser.add_argument("--no-metadata")
+        .default_value(false)
+        .help("(JPEG) Don't copy EXIF (and for plain jpegs XMP and ICC) from the image")
+        .flag();
+    argparser.add_argument("--upconvert-8bit")
+        .default_value(false)
+        .help("(JPEG) Widen 8-bit images to P010 and encode them as ultra HDR, instead of writing them as plain jpegs")
+        .flag();
+    argparser.add_argument("--renditions")
+        .default_value(std::string(""))
+        .help("(JPEG) Write several sizes from one decode, e.g. full,2048:90,512:80 (width or full, optional :quality, which defaults to -q); each output but the full size gets its width, like out.2048.jpg");
+    argparser.add_argument("--write-mode")
+        .default_value(std::string("buffered"))
+        .help("How output files are written: buffered, writev (POSIX only) or mmap");
+    argparser.add_argument("--huge-pages")
+        .default_value(false)
+        .help("Back image plane buffers with transparent huge pages (Linux only)")
+        .flag();
+    argparser.add_argument("--tiled")
+        .default_value(false)
+        .help("Decode grid images one tile at a time, packing each tile before decoding the next; bounds decode memory for very large images")
+        .flag();
+    argparser.add_argument("--images")
+        .default_value(std::string("all"))
+        .help("Images to convert from multi-image files: all, primary, or 1-based numbers and ranges like 1,3-5; each output gets the image's number when more than one is converted");
+    argparser.add_argument("--preview")
+        .default_value((uint16_t)0)
+        .help("Convert a preview this many pixels wide instead of the full image, from an embedded thumbnail when there's one big enough")
+        .scan<'i', uint16_t>();
+    argparser.add_argument("--decoder")
+        .default_value(std::string("auto"))
+        .help("HEVC decoder: auto (ffmpeg if libheif has it, else libde265), libde265, ffmpeg (libavcodec's software decoder) or another libheif decoder id; images the chosen decoder fails on are retried with libde265");
+    argparser.add_argument("--stats")
+        .default_value(false)
+        .help("Print one JSON record of stage timings, sizes and image properties per converted file instead of progress messages")
+        .flag();
+    argparser.add_argument("--trace")
+        .default_value(std::string(""))
+        .help("Write Chrome trace events (chrome://tracing, ui.perfetto.dev) of every file's read, decode, pack, encode and write on every thread to this JSON file; needs a build configured with -DHEIF2JPG_WITH_TRACING=ON");
+    argparser.add_argument("--probe")
+        .default_value(false)
+        .help("Print one JSON record of dimensions, bit depth, chroma, image count and color description per input, read from the file's header boxes without decoding or converting anything; works with --batch and -j")
+        .flag();
+    argparser.add_argument("-b", "--batch")
+        .nargs(argparse::nargs_pattern::at_least_one)
+        .help("(Batch) Convert many files: each value is a file, a directory, a glob (e.g. 'dir/*.heic'), or @manifest with one path per line");
+    argparser.add_argument("--sync")
+        .nargs(2)
+        .help("(Batch) Convert SRC DST: every HEIF file under SRC to the same path under DST, skipping files unchanged since the last sync; an index in DST records what was converted");
+    argparser.add_argument("--serve")
+        .default_value(std::string(""))
+        .help("(Server) Keep running and convert images sent to this Unix socket on -j warm workers, with --queue-depth requests waiting at most; encoding flags are the defaults for requests");
+    argparser.add_argument("--max-request-size")
+        .default_value(64)
+        .help("(Server) Largest HEIF file a request may send, in MiB; bodies are only read while those in memory fit in this much per worker and --queue-depth slot")
+        .scan<'i', int>();
+    argparser.add_argument("--max-connections")
+        .default_value(64)
+        .help("(Server) Clients served at once; more wait to be accepted")
+        .scan<'i', int>();
+    argparser.add_argument("--request-timeout")
+        .default_value(60)
+        .help("(Server) Seconds a client may take to send each request line, and then its body, before its connection is closed")
+        .scan<'i', int>();
+    argparser.add_argument("--cache")
+        .default_value(std::string(""))
+        .help("(Batch/Server) Directory to cache outputs in, keyed by a hash of the input and encoding flags; repeat inputs are written from it without being decoded or encoded");
+    argparser.add_argument("--cache-size")
+        .default_value(1024)
+        .help("(Batch/Server) Most MiB the --cache directory may hold; least recently used outputs are removed past that")
+        .scan<'i', int>();
+    argparser.add_argument("-o", "--output-dir")
+        .default_value(std::string(""))
+        .help("(Batch) Directory to write outputs to; defaults to next to each input");
+    argparser.add_argument("-j", "--jobs")
+        .default_value(0)
+        .help("(Batch, multi-image files) Number of decode/encode worker threads; 0 = one per hardware thread")
+        .scan<'i', int>();
+    argparser.add_argument("--decode-workers")
+        .default_value(0)
+        .help("(Batch, multi-image files) Images decoded at once; 0 = picked from -j, the number of images and --queue-depth")
+        .scan<'i', int>();
+    argparser.add_argument("--encode-workers")
+        .default_value(0)
+        .help("(Batch, multi-image files) Images encoded at once; 0 = picked from -j")
+        .scan<'i', int>();
+    argparser.add_argument("--decode-threads")
+        .default_value(0)
+        .help("Threads libheif may use inside one decode, for grid tiles and, with libheif 1.21 or later, the HEVC decoder; 0 = the cores -j leaves free, or all of them for a single image")
+        .scan<'i', int>();
+    argparser.add_argument("--queue-depth")
+        .default_value(2)
+        .help("(Batch) Images allowed to wait between pipeline stages; bounds peak memory")
+        .scan<'i', int>();
+    argparser.add_argument("--max-memory")
+        .default_value(0)
+        .help("(Batch, multi-image files) MiB of memory the images being converted may use, estimated from their size before decoding; images wait to be decoded until they fit, and any too big for it run alone; 0 = no limit")
+        .scan<'i', int>();
+    argparser.add_argument("--prefetch")
+        .default_value(0)
+        .help("(Batch) Read this many input files ahead of the decoders, in parallel, to hide open/read latency on network storage; 0 = off")
+        .scan<'i', int>();
+    argparser.add_argument("--write-threads")
+        .default_value(1)
+        .help("(Batch, multi-image files) Outputs written at once, so slow storage doesn't hold up encoding")
+        .scan<'i', int>();
 
     try {
         argparser.parse_args(argc, argv);
@@ -387,169 +193,305 @@ int main(int argc, char **argv)
         return 1;
     }
 
-    std::string input_filename = argparser.get<std::string>("input_file");
-    std::string output_filename = argparser.get<std::string>("output_file");
-
     bool output_p010 = argparser.get<bool>("-p");
-    if (output_filename.starts_with("-")) {
-        if (output_p010)
-            output_filename = derive_output_filename(input_filename, "p010");
-        else
-            output_filename = derive_output_filename(input_filename, "uhdr.jpg");
+    bool stats = argparser.get<bool>("--stats");
+    bool tiled = argparser.get<bool>("--tiled");
+    uint16_t preview_width = argparser.get<uint16_t>("--preview");
+
+    if (!select_heif_decoder(argparser.get<std::string>("--decoder")))
+        return 1;
+
+    default_plane_pool().set_huge_pages(argparser.get<bool>("--huge-pages"));
+
+    enum heif2jpg_write_mode write_mode;
+    if (!parse_write_mode(argparser.get<std::string>("--write-mode"), write_mode)) {
+        std::cerr << "Bad write mode (" << argparser.get<std::string>("--write-mode") <<
+            "); must be buffered, writev or mmap" << std::endl;
+        return 1;
     }
-    std::cout << "Output file path: " << output_filename << std::endl;
-
-    /* Check for valid file */
-    // Can it be opened?
-    std::ifstream istr(input_filename.c_str(), std::ios_base::binary);
-    if (istr.fail())
-    {
-        std::cerr << "Input file doesn't exist!" << std::endl;
-        return 2;
+
+    struct heif2jpg_encode_options encode_options;
+    encode_options.color_gamut = (uhdr_color_gamut_t)argparser.get<int>("-c");
+    encode_options.color_range = (uhdr_color_range_t)argparser.get<int>("-r");
+    encode_options.color_transfer =
+        (uhdr_color_transfer_t)argparser.get<int>("-t");
+    encode_options.new_width = argparser.get<uint16_t>("-w");
+    encode_options.quality = argparser.get<uint8_t>("-q");
+    encode_options.upconvert_8bit = argparser.get<bool>("--upconvert-8bit");
+    encode_options.copy_metadata = !argparser.get<bool>("--no-metadata");
+    /* Colors given on the command line are used as they are */
+    encode_options.color_from_file = !argparser.is_used("-c") && !argparser.is_used("-r") &&
+                                     !argparser.is_used("-t");
+
+    if (!parse_resize_filter(argparser.get<std::string>("--resize-filter"),
+                             encode_options.resize_filter)) {
+        std::cerr << "Bad resize filter (" << argparser.get<std::string>("--resize-filter") <<
+            "); must be lanczos or box" << std::endl;
+        return 1;
     }
-    // Does it have a valid box length?
-    // Does it have a compatible heif filetype? e.g. heic
-
-    /* Read the file */
-    heif_context *ctx = heif_context_alloc();
-    if (!ctx)
-    {
-        std::cerr << "libheif: HEIF context allocation failed." << std::endl;
-        return 3;
+
+    if (!output_p010 && encode_options.quality > 100) {
+        std::cerr << "Bad quality value (" << encode_options.quality <<
+            "); must be between 1 and 100" << std::endl;
+        return 9;
     }
 
-    ContextReleaser cr(ctx);
+    if (!parse_encode_preset(argparser.get<std::string>("--preset"), encode_options)) {
+        std::cerr << "Bad preset (" << argparser.get<std::string>("--preset") <<
+            "); must be quality, balanced or speed" << std::endl;
+        return 1;
+    }
 
-    err = heif_context_read_from_file(ctx, input_filename.c_str(), nullptr);
-    if (err.code != 0)
-    {
-        std::cerr << "libheif: Could not read HEIF/AVIF file: " <<
-            err.message << std::endl;
-        return 4;
+    if (argparser.is_used("--gainmap-quality")) {
+        int gainmap_quality = argparser.get<int>("--gainmap-quality");
+        if (gainmap_quality < 1 || gainmap_quality > 100) {
+            std::cerr << "Bad gainmap quality value (" << gainmap_quality <<
+                "); must be between 1 and 100" << std::endl;
+            return 9;
+        }
+        encode_options.gainmap_quality = (uint8_t)gainmap_quality;
     }
 
-    int num_images = heif_context_get_number_of_top_level_images(ctx);
-    if (num_images == 0)
-    {
-        std::cerr << "libheif: File doesn't contain any images!" << std::endl;
-        return 5;
+    if (argparser.is_used("--gainmap-scale")) {
+        int gainmap_scale = argparser.get<int>("--gainmap-scale");
+        if (gainmap_scale < 1 || gainmap_scale > 128) {
+            std::cerr << "Bad gainmap scale (" << gainmap_scale <<
+                "); must be between 1 and 128" << std::endl;
+            return 1;
+        }
+        encode_options.gainmap_scale = (uint8_t)gainmap_scale;
     }
-    else if (num_images != 1)
-    {
-        std::cerr << "libheif: No support for more than 1 image." << std::endl;
-        return 6;
+
+    std::vector<struct heif2jpg_rendition> renditions;
+    if (argparser.is_used("--renditions")) {
+        if (!parse_renditions(argparser.get<std::string>("--renditions"),
+                              encode_options.quality, renditions))
+            return 1;
+        if (output_p010 || tiled) {
+            std::cerr << "--renditions can't be used with " << (output_p010 ? "-p" : "--tiled")
+                      << std::endl;
+            return 1;
+        }
+    }
+
+    int jobs = argparser.get<int>("-j");
+    if (jobs < 0) {
+        std::cerr << "Bad jobs value (" << jobs << "); must be 0 or more" << std::endl;
+        return 1;
+    }
+
+    int decode_workers = argparser.get<int>("--decode-workers");
+    int encode_workers = argparser.get<int>("--encode-workers");
+    int decode_threads = argparser.get<int>("--decode-threads");
+    if (decode_workers < 0 || encode_workers < 0 || decode_threads < 0) {
+        std::cerr << "Bad thread count; --decode-workers, --encode-workers and --decode-threads "
+                     "must be 0 or more" << std::endl;
+        return 1;
     }
 
-    struct heif_image_handle *handle;
-    err = heif_context_get_primary_image_handle(ctx, &handle);
-    if (err.code)
-    {
-        std::cerr << "libheif: Could not read HEIF image: " << err.message << std::endl;
-        return 7;
+    int queue_depth = argparser.get<int>("--queue-depth");
+    if (queue_depth < 1) {
+        std::cerr << "Bad queue depth (" << queue_depth << "); must be 1 or more" << std::endl;
+        return 1;
     }
 
-    int width = heif_image_handle_get_width(handle);
-    int height = heif_image_handle_get_height(handle);
-    int primary = heif_image_handle_is_primary_image(handle);
-    printf("Image info: %dx%d%s\n", width, height, primary ? ", primary" : ", not primary");
-
-    heif_colorspace colorspace;
-    heif_chroma chroma;
-    err = heif_image_handle_get_preferred_decoding_colorspace(handle, &colorspace, &chroma);
-    if (err.code) {
-      std::cerr << err.message << std::endl;
-      return 10;
+    int max_memory = argparser.get<int>("--max-memory");
+    if (max_memory < 0) {
+        std::cerr << "Bad memory limit (" << max_memory << "); must be 0 MiB or more"
+                  << std::endl;
+        return 1;
     }
 
-    printf("Image colorspace: ");
-    switch (colorspace) {
-      case heif_colorspace_YCbCr:
-        printf("YCbCr, ");
-        break;
-      case heif_colorspace_RGB:
-        printf("RGB");
-        break;
-      case heif_colorspace_monochrome:
-        printf("monochrome");
-        break;
-      case heif_colorspace_nonvisual:
-        printf("non-visual");
-        break;
-      default:
-        printf("unknown");
-        break;
+    int prefetch = argparser.get<int>("--prefetch");
+    int write_threads = argparser.get<int>("--write-threads");
+    if (prefetch < 0 || write_threads < 1) {
+        std::cerr << "Bad I/O settings; --prefetch must be 0 or more and --write-threads 1 or more"
+                  << std::endl;
+        return 1;
     }
 
-    if (colorspace == heif_colorspace_YCbCr) {
-      switch (chroma) {
-        case heif_chroma_420:
-          printf("4:2:0");
-          break;
-        case heif_chroma_422:
-          printf("4:2:2");
-          break;
-        case heif_chroma_444:
-          printf("4:4:4");
-          break;
-        default:
-          printf("unknown");
-          break;
-      }
+    int cache_size = argparser.get<int>("--cache-size");
+    if (cache_size < 1) {
+        std::cerr << "Bad cache size (" << cache_size << "); must be 1 MiB or more" << std::endl;
+        return 1;
     }
 
-    printf("\n");
-    
-    int bit_depth = heif_image_handle_get_luma_bits_per_pixel(handle);
-    std::cout << "Input luma bit depth: " << bit_depth << std::endl;
-
-    // This is a spectacularly odd construction -- from libheif's heif_dec.cc
-    std::unique_ptr<heif_decoding_options, void (*)(heif_decoding_options *)>
-        decode_options(heif_decoding_options_alloc(), heif_decoding_options_free);
-    decode_options->strict_decoding = true;
-    decode_options->decoder_id = nullptr;
-    decode_options->convert_hdr_to_8bit = false;
-
-    decode_options->start_progress = start_progress;
-    decode_options->on_progress = on_progress;
-    decode_options->end_progress = end_progress;
-
-    // This currently only is supposed to work on Nikon HEIF images, so the chroma is hardcoded to 4:2:0
-    // This is also only supposed to go out to libultrahdr to make a jpg via P010 data, so we want YUV format planes
-    heif_image *img;
-    err = heif_decode_image(handle, &img, heif_colorspace_YCbCr, heif_chroma_420, decode_options.get());
-    if (err.code)
-    {
-        std::cerr << "libheif: Could not decode HEIF image: " << err.message << std::endl;
-        return 8;
+    /* Also used for the images of a multi-image file */
+    struct heif2jpg_batch_options batch_options;
+    batch_options.num_workers = jobs;
+    batch_options.decode_workers = decode_workers;
+    batch_options.encode_workers = encode_workers;
+    batch_options.decode_threads = decode_threads;
+    batch_options.queue_depth = queue_depth;
+    batch_options.prefetch = prefetch;
+    batch_options.write_threads = write_threads;
+    batch_options.output_dir = argparser.get<std::string>("-o");
+    batch_options.output_p010 = output_p010;
+    batch_options.write_mode = write_mode;
+    batch_options.stats = stats;
+    batch_options.tiled = tiled;
+    batch_options.images = argparser.get<std::string>("--images");
+    batch_options.preview_width = preview_width;
+    batch_options.encode_options = encode_options;
+    batch_options.renditions = renditions;
+    batch_options.cache_dir = argparser.get<std::string>("--cache");
+    batch_options.cache_max_bytes = (uint64_t)cache_size << 20;
+    batch_options.max_memory = (uint64_t)max_memory << 20;
+
+    /* Written when main returns, after everything it traced is done */
+    TraceSession trace;
+    if (argparser.is_used("--trace") && trace.start(argparser.get<std::string>("--trace")))
+        return 1;
+
+    if (argparser.get<bool>("--probe")) {
+        std::vector<std::string> inputs;
+
+        if (argparser.is_used("--batch")) {
+            if (!expand_batch_inputs(argparser.get<std::vector<std::string>>("--batch"), inputs))
+                return 2;
+        } else if (!argparser.get<std::string>("input_file").empty()) {
+            inputs.push_back(argparser.get<std::string>("input_file"));
+        } else {
+            std::cerr << "No input file given" << std::endl;
+            std::cerr << argparser;
+            return 1;
+        }
+
+        return run_probe(inputs, jobs);
     }
 
-    /* Determine output file format */
-    if (output_p010) {
-        ret = save_p010_file(handle, img, output_filename);
-        if (ret)
-            return ret;
-    } else {
-        struct heif2jpg_encode_options encode_options;
-        encode_options.color_gamut = (uhdr_color_gamut_t)argparser.get<int>("-c");
-        encode_options.color_range = (uhdr_color_range_t)argparser.get<int>("-r");
-        encode_options.color_transfer =
-            (uhdr_color_transfer_t)argparser.get<int>("-t");
-        encode_options.new_width = argparser.get<uint16_t>("-w");
-        encode_options.quality = argparser.get<uint8_t>("-q");
-
-        if (encode_options.quality > 100) {
-            std::cerr << "Bad quality value (" << encode_options.quality <<
-                "); must be between 1 and 100" << std::endl;
-            return 9;
+    if (argparser.is_used("--serve")) {
+        struct heif2jpg_server_options server_options;
+        server_options.socket_path = argparser.get<std::string>("--serve");
+        server_options.num_workers = jobs;
+        server_options.queue_depth = queue_depth;
+        server_options.encode_options = encode_options;
+        server_options.cache_dir = batch_options.cache_dir;
+        server_options.cache_max_bytes = batch_options.cache_max_bytes;
+
+        int max_request_size = argparser.get<int>("--max-request-size");
+        int max_connections = argparser.get<int>("--max-connections");
+        int request_timeout = argparser.get<int>("--request-timeout");
+        if (max_request_size < 1 || max_connections < 1 || request_timeout < 1) {
+            std::cerr << "Bad server limits; --max-request-size, --max-connections and "
+                         "--request-timeout must be 1 or more" << std::endl;
+            return 1;
         }
+        server_options.max_body_bytes = (size_t)max_request_size << 20;
+        server_options.max_connections = max_connections;
+        server_options.request_timeout = request_timeout;
+
+        /* Requests run side by side, so each decode gets its share of the cores */
+        unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+        if (!decode_threads)
+            decode_threads = std::max(1u, cores / (jobs ? jobs : cores));
+        set_heif_decoding_threads(decode_threads);
+
+        return run_server(server_options);
+    }
 
-        ret = save_uhdr_jpg_file(handle, img, encode_options, output_filename);
-        if (ret)
-            return ret;
+    if (argparser.is_used("--sync")) {
+        auto dirs = argparser.get<std::vector<std::string>>("--sync");
+        return run_sync(dirs[0], dirs[1], batch_options);
+    }
+
+    if (argparser.is_used("--batch")) {
+        std::vector<std::string> inputs;
+
+        if (!expand_batch_inputs(argparser.get<std::vector<std::string>>("--batch"), inputs))
+            return 2;
+
+        return run_batch(inputs, batch_options);
+    }
+
+    std::string input_filename = argparser.get<std::string>("input_file");
+    std::string output_filename = argparser.get<std::string>("output_file");
+
+    if (input_filename.empty()) {
+        std::cerr << "No input file given" << std::endl;
+        std::cerr << argparser;
+        return 1;
+    }
+
+    if (output_filename.empty())
+        output_filename = derive_output_filename(input_filename,
+                                                 output_suffix(output_p010, preview_width != 0));
+
+    /*
+     * A single image has the machine to itself; run_batch_files() replans
+     * this if the file turns out to need the pipeline
+     */
+    if (!decode_threads)
+        decode_threads = jobs ? jobs : std::max(1u, std::thread::hardware_concurrency());
+    set_heif_decoding_threads(decode_threads);
+
+    /* The file is parsed once, however many of its images are converted */
+    std::vector<heif_item_id> image_ids;
+    std::vector<size_t> selected;
+    struct heif2jpg_conversion_stats conversion_stats;
+    HeifContextPtr ctx;
+
+    ret = open_heif_file(input_filename, ctx, image_ids, stats ? &conversion_stats : nullptr);
+    if (ret)
+        return ret;
+    if (!select_heif_images(batch_options.images, ctx, image_ids, selected))
+        return 6;
+
+    /* Renditions are encoded in parallel by the pipeline, even for one image */
+    if (selected.size() > 1 || !renditions.empty()) {
+        if (is_stdout_output(output_filename)) {
+            if (selected.size() > 1)
+                std::cerr << "Can't write " << selected.size()
+                          << " images to stdout; pick one with --images" << std::endl;
+            else
+                std::cerr << "Can't write renditions to stdout" << std::endl;
+            return 1;
+        }
+
+        std::vector<struct heif2jpg_pipeline_file> files;
+        for (size_t i : selected)
+            files.push_back({input_filename,
+                             selected.size() > 1 ? image_output_filename(output_filename, i + 1) :
+                                                   output_filename,
+                             ctx, image_ids[i]});
+
+        return run_batch_files(files, batch_options);
+    }
+
+    /* Image data owns stdout, so keep progress text out of it */
+    if (is_stdout_output(output_filename))
+        set_log_to_stderr(true);
+
+    if (!stats) {
+        if (is_stdout_output(output_filename))
+            log_out() << "Output to stdout" << std::endl;
+        else
+            log_out() << "Output file path: " << output_filename << std::endl;
+    }
+
+    struct heif2jpg_convert_options convert_options;
+    convert_options.encode_options = encode_options;
+    convert_options.output_p010 = output_p010;
+    convert_options.tiled = tiled;
+    convert_options.preview_width = preview_width;
+    convert_options.write_mode = write_mode;
+    /* The stats record replaces the progress messages */
+    convert_options.verbose = !stats;
+
+    Heif2JpgConverter converter;
+    struct heif2jpg_error error = converter.convert_image(ctx, image_ids[selected[0]],
+                                                          output_filename, convert_options,
+                                                          stats ? &conversion_stats : nullptr);
+    if (error) {
+        std::cerr << error.message << std::endl;
+        return error.code;
     }
 
     /* Done */
-    std::cout << "Success!" << std::endl;
+    if (stats)
+        log_out() << conversion_stats_json(conversion_stats) << std::endl;
+    else
+        log_out() << "Success!" << std::endl;
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * Admission control that keeps the estimated memory of the conversions in
+ * flight under a budget
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#include <algorithm>
+
+#include "memory_budget.h"
+
+uint64_t MemoryBudget::acquire(uint64_t bytes)
+{
+    /* Fits once the budget is empty, however large it is */
+    bytes = std::min(bytes, max_bytes_);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    uint64_t ahead = waiting_.empty() ? 0 : waiting_.front();
+
+    if (used_bytes_ + ahead + bytes > max_bytes_) {
+        waits_++;
+        auto self = waiting_.insert(waiting_.end(), bytes);
+
+        released_.wait(lock, [&] {
+            ahead = self == waiting_.begin() ? 0 : waiting_.front();
+            return used_bytes_ + ahead + bytes <= max_bytes_;
+        });
+
+        waiting_.erase(self);
+        /* The next oldest may be able to go now, and the others past it */
+        released_.notify_all();
+    }
+
+    used_bytes_ += bytes;
+    peak_bytes_ = std::max(peak_bytes_, used_bytes_);
+
+    return bytes;
+}
+
+void MemoryBudget::release(uint64_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    used_bytes_ -= bytes;
+    released_.notify_all();
+}
+
+uint64_t MemoryBudget::peak_bytes() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return peak_bytes_;
+}
+
+uint64_t MemoryBudget::waits() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return waits_;
+}
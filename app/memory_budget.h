@@ -0,0 +1,69 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * Admission control that keeps the estimated memory of the conversions in
+ * flight under a budget
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#ifndef HEIF2JPG_MEMORY_BUDGET_H
+#define HEIF2JPG_MEMORY_BUDGET_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <mutex>
+
+/*
+ * acquire() blocks until the bytes asked for fit next to what's already
+ * been admitted. The longest waiting request goes first: later ones only get
+ * past it if they fit alongside it, so small conversions keep flowing around
+ * a large one without starving it. A request for more than the whole budget
+ * is admitted once nothing else is, so anything that big runs on its own.
+ */
+class MemoryBudget
+{
+public:
+    explicit MemoryBudget(uint64_t max_bytes) : max_bytes_(max_bytes) {}
+
+    MemoryBudget(const MemoryBudget &) = delete;
+    MemoryBudget &operator=(const MemoryBudget &) = delete;
+
+    /* Returns what was taken, which is what release() must be given back */
+    uint64_t acquire(uint64_t bytes);
+    void release(uint64_t bytes);
+
+    uint64_t max_bytes() const { return max_bytes_; }
+    /* Most bytes admitted at once so far */
+    uint64_t peak_bytes() const;
+    /* Requests that had to wait */
+    uint64_t waits() const;
+
+private:
+    const uint64_t max_bytes_;
+    uint64_t used_bytes_ = 0;
+    uint64_t peak_bytes_ = 0;
+    uint64_t waits_ = 0;
+    /* Sizes of the waiting requests, oldest first */
+    std::list<uint64_t> waiting_;
+    mutable std::mutex mutex_;
+    std::condition_variable released_;
+};
+
+/* Holds bytes of a budget for as long as it lives */
+class MemoryReservation
+{
+public:
+    MemoryReservation(MemoryBudget &budget, uint64_t bytes)
+        : budget_(budget), bytes_(budget.acquire(bytes)) {}
+    ~MemoryReservation() { budget_.release(bytes_); }
+
+    MemoryReservation(const MemoryReservation &) = delete;
+    MemoryReservation &operator=(const MemoryReservation &) = delete;
+
+private:
+    MemoryBudget &budget_;
+    uint64_t bytes_;
+};
+
+#endif /* HEIF2JPG_MEMORY_BUDGET_H */
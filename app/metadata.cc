@@ -0,0 +1,407 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * Metadata carried from a HEIF image to its jpeg: EXIF, XMP and ICC blocks,
+ * and the color description from the nclx profile
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#include <cmath>
+#include <cstring>
+#include <string>
+
+#include "metadata.h"
+
+/* APP1 identifiers */
+static const char exif_id[] = "Exif\0";
+static const char xmp_id[] = "http://ns.adobe.com/xap/1.0/";
+
+/* TIFF tag of the EXIF orientation, a SHORT in IFD0 */
+#define EXIF_ORIENTATION_TAG 0x0112
+
+static uint32_t read_tiff_int(const uint8_t *p, int bytes, bool big_endian)
+{
+    uint32_t value = 0;
+
+    for (int i = 0; i < bytes; i++)
+        value |= (uint32_t)p[big_endian ? i : bytes - 1 - i] << (8 * (bytes - 1 - i));
+
+    return value;
+}
+
+/* Sets the orientation in IFD0 to 1, "normal", if it's there */
+static void reset_exif_orientation(uint8_t *tiff, size_t size)
+{
+    if (size < 8 || (memcmp(tiff, "II", 2) != 0 && memcmp(tiff, "MM", 2) != 0))
+        return;
+
+    bool big_endian = tiff[0] == 'M';
+    uint32_t ifd = read_tiff_int(tiff + 4, 4, big_endian);
+    if (ifd > size - 2)
+        return;
+
+    uint32_t entries = read_tiff_int(tiff + ifd, 2, big_endian);
+    for (uint32_t i = 0; i < entries; i++) {
+        size_t entry = ifd + 2 + (size_t)i * 12;
+        if (entry + 12 > size)
+            return;
+
+        if (read_tiff_int(tiff + entry, 2, big_endian) == EXIF_ORIENTATION_TAG &&
+            read_tiff_int(tiff + entry + 2, 2, big_endian) == 3) {
+            /* A SHORT is left-justified in the value field */
+            tiff[entry + 8] = big_endian ? 0 : 1;
+            tiff[entry + 9] = big_endian ? 1 : 0;
+            return;
+        }
+    }
+}
+
+/* Reads id as an APP1 payload starting with identifier; false if it won't fit */
+static bool read_app1_block(const struct heif_image_handle *handle, heif_item_id id,
+                            const char *identifier, size_t identifier_size,
+                            std::vector<uint8_t> &out)
+{
+    size_t size = heif_image_handle_get_metadata_size(handle, id);
+    if (!size || identifier_size + size > JPEG_MAX_MARKER_BYTES)
+        return false;
+
+    out.resize(identifier_size + size);
+    memcpy(out.data(), identifier, identifier_size);
+    struct heif_error err = heif_image_handle_get_metadata(handle, id,
+                                                           out.data() + identifier_size);
+    if (err.code) {
+        out.clear();
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * HEIF EXIF blocks start with a 32-bit big-endian offset to the TIFF header,
+ * which replaces it; anything between the two is dropped
+ */
+static void read_exif(const struct heif_image_handle *handle, heif_item_id id,
+                      std::vector<uint8_t> &exif)
+{
+    const size_t id_size = sizeof(exif_id);
+
+    if (!read_app1_block(handle, id, exif_id, id_size, exif))
+        return;
+
+    size_t size = exif.size() - id_size;
+    if (size < 4) {
+        exif.clear();
+        return;
+    }
+
+    uint32_t offset = read_tiff_int(exif.data() + id_size, 4, true);
+    if (offset > size - 4) {
+        exif.clear();
+        return;
+    }
+
+    exif.erase(exif.begin() + id_size, exif.begin() + id_size + 4 + offset);
+    reset_exif_orientation(exif.data() + id_size, exif.size() - id_size);
+}
+
+static void read_color(const struct heif_image_handle *handle,
+                       struct heif2jpg_image_metadata &metadata)
+{
+    struct heif_color_profile_nclx *nclx = nullptr;
+    struct heif_error err = heif_image_handle_get_nclx_color_profile(handle, &nclx);
+    if (err.code || !nclx)
+        return;
+
+    switch (nclx->color_primaries) {
+    case heif_color_primaries_ITU_R_BT_709_5:
+        metadata.color_gamut = UHDR_CG_BT_709;
+        break;
+    case heif_color_primaries_SMPTE_EG_432_1:
+        metadata.color_gamut = UHDR_CG_DISPLAY_P3;
+        break;
+    case heif_color_primaries_ITU_R_BT_2020_2_and_2100_0:
+        metadata.color_gamut = UHDR_CG_BT_2100;
+        break;
+    default:
+        break;
+    }
+
+    /* Only HDR transfers; the image is encoded as the HDR intent */
+    switch (nclx->transfer_characteristics) {
+    case heif_transfer_characteristic_ITU_R_BT_2100_0_HLG:
+        metadata.color_transfer = UHDR_CT_HLG;
+        break;
+    case heif_transfer_characteristic_ITU_R_BT_2100_0_PQ:
+        metadata.color_transfer = UHDR_CT_PQ;
+        break;
+    case heif_transfer_characteristic_linear:
+        metadata.color_transfer = UHDR_CT_LINEAR;
+        break;
+    default:
+        break;
+    }
+
+    metadata.color_range = nclx->full_range_flag ? UHDR_CR_FULL_RANGE : UHDR_CR_LIMITED_RANGE;
+
+    heif_nclx_color_profile_free(nclx);
+}
+
+std::shared_ptr<const struct heif2jpg_image_metadata>
+read_heif_metadata(const struct heif_image_handle *handle)
+{
+    auto metadata = std::make_shared<struct heif2jpg_image_metadata>();
+
+    int count = heif_image_handle_get_number_of_metadata_blocks(handle, nullptr);
+    std::vector<heif_item_id> ids(count > 0 ? count : 0);
+    if (count > 0)
+        count = heif_image_handle_get_list_of_metadata_block_IDs(handle, nullptr, ids.data(),
+                                                                 count);
+
+    /* The first block of each kind is used */
+    for (int i = 0; i < count; i++) {
+        const char *type = heif_image_handle_get_metadata_type(handle, ids[i]);
+        const char *content_type = heif_image_handle_get_metadata_content_type(handle, ids[i]);
+
+        if (metadata->exif.empty() && type && strcmp(type, "Exif") == 0)
+            read_exif(handle, ids[i], metadata->exif);
+        else if (metadata->xmp.empty() && type && strcmp(type, "mime") == 0 &&
+                 content_type && strcmp(content_type, "application/rdf+xml") == 0)
+            read_app1_block(handle, ids[i], xmp_id, sizeof(xmp_id), metadata->xmp);
+    }
+
+    enum heif_color_profile_type profile = heif_image_handle_get_color_profile_type(handle);
+    if (profile == heif_color_profile_type_rICC || profile == heif_color_profile_type_prof) {
+        size_t size = heif_image_handle_get_raw_color_profile_size(handle);
+        metadata->icc.resize(size);
+        if (size && heif_image_handle_get_raw_color_profile(handle, metadata->icc.data()).code)
+            metadata->icc.clear();
+    }
+
+    read_color(handle, *metadata);
+
+    return metadata;
+}
+
+/* ICC profiles are big-endian throughout */
+static void put_u16(std::vector<uint8_t> &out, size_t pos, uint16_t value)
+{
+    out[pos] = value >> 8;
+    out[pos + 1] = value & 0xff;
+}
+
+static void put_u32(std::vector<uint8_t> &out, size_t pos, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+        out[pos + i] = (value >> (24 - 8 * i)) & 0xff;
+}
+
+static void put_s15f16(std::vector<uint8_t> &out, size_t pos, double value)
+{
+    put_u32(out, pos, (uint32_t)(int32_t)std::lround(value * 65536));
+}
+
+static void put_sig(std::vector<uint8_t> &out, size_t pos, const char *sig)
+{
+    memcpy(out.data() + pos, sig, 4);
+}
+
+/* Appends a tag's data, padded to 4 bytes as tags must start aligned */
+static size_t add_tag_data(std::vector<uint8_t> &out, size_t size)
+{
+    size_t pos = out.size();
+    out.resize(pos + (size + 3) / 4 * 4);
+    return pos;
+}
+
+static size_t add_xyz(std::vector<uint8_t> &out, const double xyz[3])
+{
+    size_t pos = add_tag_data(out, 20);
+    put_sig(out, pos, "XYZ ");
+    for (int i = 0; i < 3; i++)
+        put_s15f16(out, pos + 8 + 4 * i, xyz[i]);
+    return pos;
+}
+
+/* A multiLocalizedUnicodeType with one en-US string, which must be ASCII */
+static size_t add_mluc(std::vector<uint8_t> &out, const std::string &text, size_t &size)
+{
+    size = 28 + 2 * text.size();
+    size_t pos = add_tag_data(out, size);
+    put_sig(out, pos, "mluc");
+    put_u32(out, pos + 8, 1);
+    put_u32(out, pos + 12, 12);
+    put_sig(out, pos + 16, "enUS");
+    put_u32(out, pos + 20, (uint32_t)(2 * text.size()));
+    put_u32(out, pos + 24, 28);
+    for (size_t i = 0; i < text.size(); i++)
+        put_u16(out, pos + 28 + 2 * i, (uint8_t)text[i]);
+    return pos;
+}
+
+/* Solves the 3x3 system m * x = b by Cramer's rule */
+static bool solve3(const double m[3][3], const double b[3], double x[3])
+{
+    auto det = [](const double a[3][3]) {
+        return a[0][0] * (a[1][1] * a[2][2] - a[1][2] * a[2][1]) -
+               a[0][1] * (a[1][0] * a[2][2] - a[1][2] * a[2][0]) +
+               a[0][2] * (a[1][0] * a[2][1] - a[1][1] * a[2][0]);
+    };
+
+    double d = det(m);
+    if (std::fabs(d) < 1e-12)
+        return false;
+
+    for (int col = 0; col < 3; col++) {
+        double a[3][3];
+        for (int r = 0; r < 3; r++)
+            for (int c = 0; c < 3; c++)
+                a[r][c] = c == col ? b[r] : m[r][c];
+        x[col] = det(a) / d;
+    }
+
+    return true;
+}
+
+bool make_nclx_icc_profile(const struct heif_color_profile_nclx *nclx,
+                           std::vector<uint8_t> &icc)
+{
+    icc.clear();
+
+    const char *name;
+    switch (nclx->color_primaries) {
+    case heif_color_primaries_ITU_R_BT_709_5:
+    case heif_color_primaries_unspecified:
+        return false;
+    case heif_color_primaries_SMPTE_EG_432_1:
+        name = "Display P3";
+        break;
+    case heif_color_primaries_SMPTE_RP_431_2:
+        name = "DCI-P3";
+        break;
+    case heif_color_primaries_ITU_R_BT_2020_2_and_2100_0:
+        name = "BT.2020";
+        break;
+    default:
+        name = "HEIF nclx primaries";
+        break;
+    }
+
+    /* xy chromaticities, filled in by libheif from the primaries code */
+    const double xy[4][2] = {
+        {nclx->color_primary_red_x, nclx->color_primary_red_y},
+        {nclx->color_primary_green_x, nclx->color_primary_green_y},
+        {nclx->color_primary_blue_x, nclx->color_primary_blue_y},
+        {nclx->color_primary_white_x, nclx->color_primary_white_y},
+    };
+    for (const auto &c : xy) {
+        if (c[1] <= 0)
+            return false;
+    }
+
+    /* RGB to XYZ: each primary's XYZ, scaled so RGB 1,1,1 is the white point */
+    double primaries[3][3], white[3], scale[3];
+    for (int i = 0; i < 3; i++) {
+        primaries[0][i] = xy[i][0] / xy[i][1];
+        primaries[1][i] = 1;
+        primaries[2][i] = (1 - xy[i][0] - xy[i][1]) / xy[i][1];
+    }
+    white[0] = xy[3][0] / xy[3][1];
+    white[1] = 1;
+    white[2] = (1 - xy[3][0] - xy[3][1]) / xy[3][1];
+    if (!solve3(primaries, white, scale))
+        return false;
+
+    /* Bradford adaptation from the white point to the D50 of the ICC PCS */
+    static const double bradford[3][3] = {
+        {0.8951, 0.2664, -0.1614},
+        {-0.7502, 1.7135, 0.0367},
+        {0.0389, -0.0685, 1.0296},
+    };
+    static const double bradford_inv[3][3] = {
+        {0.9869929, -0.1470543, 0.1599627},
+        {0.4323053, 0.5183603, 0.0492912},
+        {-0.0085287, 0.0400428, 0.9684867},
+    };
+    static const double d50[3] = {0.9642, 1.0, 0.8249};
+    double white_cone[3] = {}, d50_cone[3] = {};
+    for (int r = 0; r < 3; r++) {
+        for (int c = 0; c < 3; c++) {
+            white_cone[r] += bradford[r][c] * white[c];
+            d50_cone[r] += bradford[r][c] * d50[c];
+        }
+    }
+    double adapt[3][3];
+    for (int r = 0; r < 3; r++) {
+        for (int c = 0; c < 3; c++) {
+            adapt[r][c] = 0;
+            for (int k = 0; k < 3; k++)
+                adapt[r][c] += bradford_inv[r][k] * d50_cone[k] / white_cone[k] * bradford[k][c];
+        }
+    }
+
+    double colorants[3][3];
+    for (int i = 0; i < 3; i++) {
+        for (int r = 0; r < 3; r++) {
+            colorants[i][r] = 0;
+            for (int k = 0; k < 3; k++)
+                colorants[i][r] += adapt[r][k] * primaries[k][i] * scale[i];
+        }
+    }
+
+    /* Header, then a table of 10 tags: 4 bytes of count and 12 for each */
+    const int num_tags = 10;
+    icc.assign(128 + 4 + 12 * num_tags, 0);
+    put_sig(icc, 36, "acsp");
+    put_u32(icc, 8, 0x04300000);
+    put_sig(icc, 12, "mntr");
+    put_sig(icc, 16, "RGB ");
+    put_sig(icc, 20, "XYZ ");
+    /* A fixed creation date keeps outputs the same from run to run */
+    put_u16(icc, 24, 2025);
+    put_u16(icc, 26, 1);
+    put_u16(icc, 28, 1);
+    for (int i = 0; i < 3; i++)
+        put_s15f16(icc, 68 + 4 * i, d50[i]);
+    put_u32(icc, 128, num_tags);
+
+    size_t tag = 132;
+    auto add_tag = [&](const char *sig, size_t pos, size_t size) {
+        put_sig(icc, tag, sig);
+        put_u32(icc, tag + 4, (uint32_t)pos);
+        put_u32(icc, tag + 8, (uint32_t)size);
+        tag += 12;
+    };
+
+    size_t size;
+    size_t pos = add_mluc(icc, name, size);
+    add_tag("desc", pos, size);
+    pos = add_mluc(icc, "No copyright, use freely", size);
+    add_tag("cprt", pos, size);
+    add_tag("wtpt", add_xyz(icc, d50), 20);
+    add_tag("rXYZ", add_xyz(icc, colorants[0]), 20);
+    add_tag("gXYZ", add_xyz(icc, colorants[1]), 20);
+    add_tag("bXYZ", add_xyz(icc, colorants[2]), 20);
+
+    /* The sRGB curve as a parametricCurveType, shared by all three channels */
+    static const double srgb[5] = {2.4, 1 / 1.055, 0.055 / 1.055, 1 / 12.92, 0.04045};
+    pos = add_tag_data(icc, 32);
+    put_sig(icc, pos, "para");
+    put_u16(icc, pos + 8, 3);
+    for (int i = 0; i < 5; i++)
+        put_s15f16(icc, pos + 12 + 4 * i, srgb[i]);
+    add_tag("rTRC", pos, 32);
+    add_tag("gTRC", pos, 32);
+    add_tag("bTRC", pos, 32);
+
+    pos = add_tag_data(icc, 44);
+    put_sig(icc, pos, "sf32");
+    for (int r = 0; r < 3; r++)
+        for (int c = 0; c < 3; c++)
+            put_s15f16(icc, pos + 8 + 4 * (3 * r + c), adapt[r][c]);
+    add_tag("chad", pos, 44);
+
+    put_u32(icc, 0, (uint32_t)icc.size());
+
+    return true;
+}
@@ -0,0 +1,56 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * Metadata carried from a HEIF image to its jpeg: EXIF, XMP and ICC blocks,
+ * and the color description from the nclx profile
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#ifndef HEIF2JPG_METADATA_H
+#define HEIF2JPG_METADATA_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <libheif/heif.h>
+
+#include <ultrahdr_api.h>
+
+/* Largest payload of one jpeg marker segment */
+#define JPEG_MAX_MARKER_BYTES 65533
+
+struct heif2jpg_image_metadata {
+    /*
+     * APP1 payloads, identifier included: "Exif\0\0" then the TIFF header,
+     * and the XMP namespace then the packet. Empty if the image has none or
+     * it doesn't fit in one segment.
+     */
+    std::vector<uint8_t> exif;
+    std::vector<uint8_t> xmp;
+    /* Raw ICC profile; libjpeg-turbo splits it over APP2 segments */
+    std::vector<uint8_t> icc;
+    /* From the nclx profile; unspecified where it has nothing the encoder takes */
+    uhdr_color_gamut_t color_gamut = UHDR_CG_UNSPECIFIED;
+    uhdr_color_range_t color_range = UHDR_CR_UNSPECIFIED;
+    uhdr_color_transfer_t color_transfer = UHDR_CT_UNSPECIFIED;
+};
+
+/*
+ * Reads handle's metadata. Anything missing or unreadable is left empty;
+ * it's never an error. libheif rotates and mirrors images as they're
+ * decoded, so the EXIF orientation is reset to normal to match.
+ */
+std::shared_ptr<const struct heif2jpg_image_metadata>
+read_heif_metadata(const struct heif_image_handle *handle);
+
+/*
+ * Builds a small ICC v4 display profile with nclx's primaries and white
+ * point and the sRGB tone curve, for 8-bit images that have no ICC profile
+ * of their own but aren't BT.709, so viewers don't take them for sRGB.
+ * Returns false, leaving icc empty, for BT.709 and unspecified primaries.
+ */
+bool make_nclx_icc_profile(const struct heif_color_profile_nclx *nclx,
+                           std::vector<uint8_t> &icc);
+
+#endif /* HEIF2JPG_METADATA_H */
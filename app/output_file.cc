@@ -0,0 +1,316 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * Output file writers: large buffered writes, writev() and memory-mapped
+ * output
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <climits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#include "log.h"
+#include "output_file.h"
+#include "trace.h"
+
+bool parse_write_mode(const std::string &name, enum heif2jpg_write_mode &mode)
+{
+    if (name == "buffered")
+        mode = HEIF2JPG_WRITE_BUFFERED;
+    else if (name == "writev")
+        mode = HEIF2JPG_WRITE_WRITEV;
+    else if (name == "mmap")
+        mode = HEIF2JPG_WRITE_MMAP;
+    else
+        return false;
+
+    return true;
+}
+
+bool is_stdout_output(const std::string &output_filename)
+{
+    return output_filename == "-";
+}
+
+static int write_buffered(const std::string &output_filename,
+                          const std::vector<std::pair<const void *, size_t>> &buffers)
+{
+    std::ofstream fp(output_filename, std::ios::out | std::ios::binary);
+    if (!fp.good())
+    {
+        error_out() << "Can't open " << output_filename << ": "
+                  << strerror(errno) << std::endl;
+        return 9;
+    }
+
+    /* Writes this large skip the stream buffer and go straight to the file */
+    for (const auto &buffer : buffers)
+        fp.write(static_cast<const char *>(buffer.first), buffer.second);
+
+    fp.close();
+    if (fp.fail()) {
+        error_out() << "Unable to write to file after encoding: " << output_filename << std::endl;
+        return 13;
+    }
+
+    return 0;
+}
+
+#ifndef _WIN32
+/* Writes every buffer to fd, which can be a file, pipe or socket */
+static int write_fd(int fd, const std::string &output_filename,
+                    const std::vector<std::pair<const void *, size_t>> &buffers)
+{
+    std::vector<struct iovec> iov;
+    for (const auto &buffer : buffers) {
+        if (buffer.second)
+            iov.push_back({const_cast<void *>(buffer.first), buffer.second});
+    }
+
+    /* writev() may stop short, so advance through the vector until done */
+    size_t first = 0;
+    while (first < iov.size()) {
+        int count = (int)std::min<size_t>(iov.size() - first, IOV_MAX);
+        ssize_t written = ::writev(fd, &iov[first], count);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            error_out() << "Unable to write to file after encoding: " << output_filename
+                      << ": " << strerror(errno) << std::endl;
+            return 13;
+        }
+
+        while (first < iov.size() && (size_t)written >= iov[first].iov_len) {
+            written -= iov[first].iov_len;
+            first++;
+        }
+        if (written > 0) {
+            iov[first].iov_base = static_cast<uint8_t *>(iov[first].iov_base) + written;
+            iov[first].iov_len -= written;
+        }
+    }
+
+    return 0;
+}
+
+static int write_gathered(const std::string &output_filename,
+                          const std::vector<std::pair<const void *, size_t>> &buffers)
+{
+    int fd = ::open(output_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        error_out() << "Can't open " << output_filename << ": "
+                  << strerror(errno) << std::endl;
+        return 9;
+    }
+
+    int ret = write_fd(fd, output_filename, buffers);
+
+    if (::close(fd) != 0 && !ret) {
+        error_out() << "Unable to write to file after encoding: " << output_filename << std::endl;
+        return 13;
+    }
+
+    return ret;
+}
+#endif
+
+/*
+ * Streams the buffers to stdout. Nothing can be mapped or seeked, so every
+ * write mode comes down to writing the buffers in order.
+ */
+static int write_stdout(const std::vector<std::pair<const void *, size_t>> &buffers)
+{
+#ifdef _WIN32
+    _setmode(_fileno(stdout), _O_BINARY);
+
+    for (const auto &buffer : buffers) {
+        if (fwrite(buffer.first, 1, buffer.second, stdout) != buffer.second) {
+            error_out() << "Unable to write to stdout after encoding" << std::endl;
+            return 13;
+        }
+    }
+
+    if (fflush(stdout) != 0) {
+        error_out() << "Unable to write to stdout after encoding" << std::endl;
+        return 13;
+    }
+
+    return 0;
+#else
+    return write_fd(STDOUT_FILENO, "stdout", buffers);
+#endif
+}
+
+static int write_mapped(const std::string &output_filename,
+                        const std::vector<std::pair<const void *, size_t>> &buffers)
+{
+    size_t total = 0;
+    for (const auto &buffer : buffers)
+        total += buffer.second;
+
+    MappedOutputFile out;
+    int ret = out.open(output_filename, total);
+    if (ret)
+        return ret;
+
+    uint8_t *dst = out.data();
+    for (const auto &buffer : buffers) {
+        if (buffer.second)
+            memcpy(dst, buffer.first, buffer.second);
+        dst += buffer.second;
+    }
+
+    return out.close();
+}
+
+int write_output_file(const std::string &output_filename,
+                      const std::vector<std::pair<const void *, size_t>> &buffers,
+                      enum heif2jpg_write_mode mode)
+{
+    TraceSpan span("write_output_file", output_filename);
+    if (is_stdout_output(output_filename))
+        return write_stdout(buffers);
+
+    switch (mode) {
+    case HEIF2JPG_WRITE_MMAP:
+        return write_mapped(output_filename, buffers);
+#ifndef _WIN32
+    case HEIF2JPG_WRITE_WRITEV:
+        return write_gathered(output_filename, buffers);
+#endif
+    default:
+        return write_buffered(output_filename, buffers);
+    }
+}
+
+MappedOutputFile::~MappedOutputFile()
+{
+    close();
+}
+
+#ifdef _WIN32
+int MappedOutputFile::open(const std::string &filename, size_t size)
+{
+    filename_ = filename;
+    size_ = size;
+
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr,
+                              CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        error_out() << "Can't open " << filename << ": error " << GetLastError() << std::endl;
+        return 9;
+    }
+    file_ = file;
+
+    /* A zero-length file can't be mapped, and doesn't need to be */
+    if (size == 0)
+        return 0;
+
+    LARGE_INTEGER li;
+    li.QuadPart = (LONGLONG)size;
+    mapping_ = CreateFileMappingA(file, nullptr, PAGE_READWRITE, li.HighPart, li.LowPart, nullptr);
+    if (mapping_)
+        data_ = static_cast<uint8_t *>(MapViewOfFile(mapping_, FILE_MAP_WRITE, 0, 0, size));
+    if (!data_) {
+        error_out() << "Can't map " << filename << ": error " << GetLastError() << std::endl;
+        close();
+        return 9;
+    }
+
+    return 0;
+}
+
+int MappedOutputFile::close()
+{
+    bool ok = true;
+
+    if (data_)
+        ok = UnmapViewOfFile(data_) && ok;
+    if (mapping_)
+        ok = CloseHandle(mapping_) && ok;
+    if (file_)
+        ok = CloseHandle(file_) && ok;
+
+    bool was_open = file_ != nullptr;
+    data_ = nullptr;
+    mapping_ = nullptr;
+    file_ = nullptr;
+
+    if (was_open && !ok) {
+        error_out() << "Unable to write to file after encoding: " << filename_ << std::endl;
+        return 13;
+    }
+
+    return 0;
+}
+#else
+int MappedOutputFile::open(const std::string &filename, size_t size)
+{
+    filename_ = filename;
+    size_ = size;
+
+    fd_ = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fd_ < 0) {
+        error_out() << "Can't open " << filename << ": " << strerror(errno) << std::endl;
+        return 9;
+    }
+
+    /* A zero-length file can't be mapped, and doesn't need to be */
+    if (size == 0)
+        return 0;
+
+    if (::ftruncate(fd_, (off_t)size) != 0) {
+        error_out() << "Can't size " << filename << ": " << strerror(errno) << std::endl;
+        close();
+        return 9;
+    }
+
+    void *p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (p == MAP_FAILED) {
+        error_out() << "Can't map " << filename << ": " << strerror(errno) << std::endl;
+        close();
+        return 9;
+    }
+    data_ = static_cast<uint8_t *>(p);
+
+    return 0;
+}
+
+int MappedOutputFile::close()
+{
+    bool ok = true;
+
+    if (data_)
+        ok = ::munmap(data_, size_) == 0 && ok;
+    if (fd_ >= 0)
+        ok = ::close(fd_) == 0 && ok;
+
+    bool was_open = fd_ >= 0;
+    data_ = nullptr;
+    fd_ = -1;
+
+    if (was_open && !ok) {
+        error_out() << "Unable to write to file after encoding: " << filename_ << std::endl;
+        return 13;
+    }
+
+    return 0;
+}
+#endif
@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * Output file writers: large buffered writes, writev() and memory-mapped
+ * output
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#ifndef HEIF2JPG_OUTPUT_FILE_H
+#define HEIF2JPG_OUTPUT_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+enum heif2jpg_write_mode {
+    /* One large write() per buffer */
+    HEIF2JPG_WRITE_BUFFERED,
+    /* All buffers in a single writev() call; buffered on Windows */
+    HEIF2JPG_WRITE_WRITEV,
+    /* Size the file up front, map it and fill it in place */
+    HEIF2JPG_WRITE_MMAP,
+};
+
+/* Parses "buffered", "writev" or "mmap"; returns false for anything else */
+bool parse_write_mode(const std::string &name, enum heif2jpg_write_mode &mode);
+
+/* "-" names stdout as the output */
+bool is_stdout_output(const std::string &output_filename);
+
+/*
+ * Writes the given buffers to output_filename, one after another. An
+ * output_filename of "-" streams them to stdout instead.
+ *
+ * Returns 0 on success, 9 if the file can't be created or 13 if writing fails.
+ */
+int write_output_file(const std::string &output_filename,
+                      const std::vector<std::pair<const void *, size_t>> &buffers,
+                      enum heif2jpg_write_mode mode = HEIF2JPG_WRITE_BUFFERED);
+
+/*
+ * An output file of a known size that's written through a shared mapping, so
+ * data can be produced directly into the page cache without an intermediate
+ * buffer.
+ */
+class MappedOutputFile
+{
+public:
+    MappedOutputFile() = default;
+    ~MappedOutputFile();
+
+    MappedOutputFile(const MappedOutputFile &) = delete;
+    MappedOutputFile &operator=(const MappedOutputFile &) = delete;
+
+    /* Creates/truncates filename to size bytes and maps it; returns 0 or 9 */
+    int open(const std::string &filename, size_t size);
+
+    /* Unmaps and closes the file; returns 0 or 13 */
+    int close();
+
+    uint8_t *data() { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    std::string filename_;
+    uint8_t *data_ = nullptr;
+    size_t size_ = 0;
+#ifdef _WIN32
+    void *file_ = nullptr;
+    void *mapping_ = nullptr;
+#else
+    int fd_ = -1;
+#endif
+};
+
+#endif /* HEIF2JPG_OUTPUT_FILE_H */
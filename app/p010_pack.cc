@@ -0,0 +1,451 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * Row kernels that convert 10-bit LSB-aligned or 8-bit YCbCr samples to P010,
+ * with SIMD variants picked at runtime
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#include "p010_pack.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#endif
+
+/* In P010, values are encoded in the 10 most significant bits. */
+static void pack_y_scalar(const uint16_t *src, uint16_t *dst, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        dst[i] = (uint16_t)(src[i] << 6); // Little Endian
+}
+
+/* The U and V planes are interleaved in P010; U == Cb, and V == Cr */
+static void pack_uv_scalar(const uint16_t *cb, const uint16_t *cr, uint16_t *dst, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        dst[2 * i] = (uint16_t)(cb[i] << 6);
+        dst[2 * i + 1] = (uint16_t)(cr[i] << 6);
+    }
+}
+
+/* 8-bit samples fill the top byte, the same as scaling them up to 10 bits first */
+static void pack_y8_scalar(const uint8_t *src, uint16_t *dst, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        dst[i] = (uint16_t)(src[i] << 8);
+}
+
+static void pack_uv8_scalar(const uint8_t *cb, const uint8_t *cr, uint16_t *dst, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        dst[2 * i] = (uint16_t)(cb[i] << 8);
+        dst[2 * i + 1] = (uint16_t)(cr[i] << 8);
+    }
+}
+
+/* Each output row averages two source rows; the rounding matches _mm_avg_epu16 */
+static void pack_uv_422_scalar(const uint16_t *cb0, const uint16_t *cr0, const uint16_t *cb1,
+                               const uint16_t *cr1, uint16_t *dst, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        dst[2 * i] = (uint16_t)(((cb0[i] + cb1[i] + 1) >> 1) << 6);
+        dst[2 * i + 1] = (uint16_t)(((cr0[i] + cr1[i] + 1) >> 1) << 6);
+    }
+}
+
+/* And each output sample a 2x2 block of source samples */
+static void pack_uv_444_scalar(const uint16_t *cb0, const uint16_t *cr0, const uint16_t *cb1,
+                               const uint16_t *cr1, uint16_t *dst, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        int cb = cb0[2 * i] + cb0[2 * i + 1] + cb1[2 * i] + cb1[2 * i + 1];
+        int cr = cr0[2 * i] + cr0[2 * i + 1] + cr1[2 * i] + cr1[2 * i + 1];
+        dst[2 * i] = (uint16_t)(((cb + 2) >> 2) << 6);
+        dst[2 * i + 1] = (uint16_t)(((cr + 2) >> 2) << 6);
+    }
+}
+
+static void pack_uv8_422_scalar(const uint8_t *cb0, const uint8_t *cr0, const uint8_t *cb1,
+                                const uint8_t *cr1, uint16_t *dst, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        dst[2 * i] = (uint16_t)(((cb0[i] + cb1[i] + 1) >> 1) << 8);
+        dst[2 * i + 1] = (uint16_t)(((cr0[i] + cr1[i] + 1) >> 1) << 8);
+    }
+}
+
+static void pack_uv8_444_scalar(const uint8_t *cb0, const uint8_t *cr0, const uint8_t *cb1,
+                                const uint8_t *cr1, uint16_t *dst, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        int cb = cb0[2 * i] + cb0[2 * i + 1] + cb1[2 * i] + cb1[2 * i + 1];
+        int cr = cr0[2 * i] + cr0[2 * i + 1] + cr1[2 * i] + cr1[2 * i + 1];
+        dst[2 * i] = (uint16_t)(((cb + 2) >> 2) << 8);
+        dst[2 * i + 1] = (uint16_t)(((cr + 2) >> 2) << 8);
+    }
+}
+
+const struct p010_pack_kernels p010_scalar_kernels = {
+    "scalar", pack_y_scalar, pack_uv_scalar, pack_y8_scalar, pack_uv8_scalar,
+    pack_uv_422_scalar, pack_uv_444_scalar, pack_uv8_422_scalar, pack_uv8_444_scalar
+};
+
+#if defined(__x86_64__) || defined(_M_X64)
+/* SSE2 is part of the x86-64 baseline, so no runtime check is needed */
+static void pack_y_sse2(const uint16_t *src, uint16_t *dst, size_t n)
+{
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_slli_epi16(v, 6));
+    }
+
+    pack_y_scalar(src + i, dst + i, n - i);
+}
+
+static void pack_uv_sse2(const uint16_t *cb, const uint16_t *cr, uint16_t *dst, size_t n)
+{
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m128i u = _mm_slli_epi16(_mm_loadu_si128((const __m128i *)(cb + i)), 6);
+        __m128i v = _mm_slli_epi16(_mm_loadu_si128((const __m128i *)(cr + i)), 6);
+        _mm_storeu_si128((__m128i *)(dst + 2 * i), _mm_unpacklo_epi16(u, v));
+        _mm_storeu_si128((__m128i *)(dst + 2 * i + 8), _mm_unpackhi_epi16(u, v));
+    }
+
+    pack_uv_scalar(cb + i, cr + i, dst + 2 * i, n - i);
+}
+
+/* Unpacking with zero as the low byte does the << 8 */
+static void pack_y8_sse2(const uint8_t *src, uint16_t *dst, size_t n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_unpacklo_epi8(zero, v));
+        _mm_storeu_si128((__m128i *)(dst + i + 8), _mm_unpackhi_epi8(zero, v));
+    }
+
+    pack_y8_scalar(src + i, dst + i, n - i);
+}
+
+static void pack_uv8_sse2(const uint8_t *cb, const uint8_t *cr, uint16_t *dst, size_t n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i u = _mm_loadu_si128((const __m128i *)(cb + i));
+        __m128i v = _mm_loadu_si128((const __m128i *)(cr + i));
+        __m128i lo = _mm_unpacklo_epi8(u, v);
+        __m128i hi = _mm_unpackhi_epi8(u, v);
+        _mm_storeu_si128((__m128i *)(dst + 2 * i), _mm_unpacklo_epi8(zero, lo));
+        _mm_storeu_si128((__m128i *)(dst + 2 * i + 8), _mm_unpackhi_epi8(zero, lo));
+        _mm_storeu_si128((__m128i *)(dst + 2 * i + 16), _mm_unpacklo_epi8(zero, hi));
+        _mm_storeu_si128((__m128i *)(dst + 2 * i + 24), _mm_unpackhi_epi8(zero, hi));
+    }
+
+    pack_uv8_scalar(cb + i, cr + i, dst + 2 * i, n - i);
+}
+
+/* Interleaves 8 Cb and 8 Cr words, already shifted into place, into dst */
+static inline void store_uv_sse2(__m128i u, __m128i v, uint16_t *dst)
+{
+    _mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi16(u, v));
+    _mm_storeu_si128((__m128i *)(dst + 8), _mm_unpackhi_epi16(u, v));
+}
+
+/*
+ * (a + b + 2) >> 2 of each horizontal pair in the 16 words of two row sums,
+ * s0 then s1. Sums of 10-bit samples stay well inside 16 signed bits, so
+ * madd and the signed pack are exact.
+ */
+static inline __m128i average_pairs_sse2(__m128i s0, __m128i s1)
+{
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i two = _mm_set1_epi16(2);
+    __m128i sums = _mm_packs_epi32(_mm_madd_epi16(s0, ones), _mm_madd_epi16(s1, ones));
+
+    return _mm_srli_epi16(_mm_add_epi16(sums, two), 2);
+}
+
+static void pack_uv_422_sse2(const uint16_t *cb0, const uint16_t *cr0, const uint16_t *cb1,
+                             const uint16_t *cr1, uint16_t *dst, size_t n)
+{
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m128i u = _mm_avg_epu16(_mm_loadu_si128((const __m128i *)(cb0 + i)),
+                                  _mm_loadu_si128((const __m128i *)(cb1 + i)));
+        __m128i v = _mm_avg_epu16(_mm_loadu_si128((const __m128i *)(cr0 + i)),
+                                  _mm_loadu_si128((const __m128i *)(cr1 + i)));
+        store_uv_sse2(_mm_slli_epi16(u, 6), _mm_slli_epi16(v, 6), dst + 2 * i);
+    }
+
+    pack_uv_422_scalar(cb0 + i, cr0 + i, cb1 + i, cr1 + i, dst + 2 * i, n - i);
+}
+
+static void pack_uv_444_sse2(const uint16_t *cb0, const uint16_t *cr0, const uint16_t *cb1,
+                             const uint16_t *cr1, uint16_t *dst, size_t n)
+{
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        const uint16_t *rows[4] = {cb0 + 2 * i, cb1 + 2 * i, cr0 + 2 * i, cr1 + 2 * i};
+        __m128i s[4];
+        for (int k = 0; k < 4; k += 2) {
+            s[k] = _mm_add_epi16(_mm_loadu_si128((const __m128i *)rows[k]),
+                                 _mm_loadu_si128((const __m128i *)rows[k + 1]));
+            s[k + 1] = _mm_add_epi16(_mm_loadu_si128((const __m128i *)(rows[k] + 8)),
+                                     _mm_loadu_si128((const __m128i *)(rows[k + 1] + 8)));
+        }
+        __m128i u = average_pairs_sse2(s[0], s[1]);
+        __m128i v = average_pairs_sse2(s[2], s[3]);
+        store_uv_sse2(_mm_slli_epi16(u, 6), _mm_slli_epi16(v, 6), dst + 2 * i);
+    }
+
+    pack_uv_444_scalar(cb0 + 2 * i, cr0 + 2 * i, cb1 + 2 * i, cr1 + 2 * i, dst + 2 * i, n - i);
+}
+
+static void pack_uv8_422_sse2(const uint8_t *cb0, const uint8_t *cr0, const uint8_t *cb1,
+                              const uint8_t *cr1, uint16_t *dst, size_t n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i u = _mm_avg_epu8(_mm_loadu_si128((const __m128i *)(cb0 + i)),
+                                 _mm_loadu_si128((const __m128i *)(cb1 + i)));
+        __m128i v = _mm_avg_epu8(_mm_loadu_si128((const __m128i *)(cr0 + i)),
+                                 _mm_loadu_si128((const __m128i *)(cr1 + i)));
+        __m128i lo = _mm_unpacklo_epi8(u, v);
+        __m128i hi = _mm_unpackhi_epi8(u, v);
+        _mm_storeu_si128((__m128i *)(dst + 2 * i), _mm_unpacklo_epi8(zero, lo));
+        _mm_storeu_si128((__m128i *)(dst + 2 * i + 8), _mm_unpackhi_epi8(zero, lo));
+        _mm_storeu_si128((__m128i *)(dst + 2 * i + 16), _mm_unpacklo_epi8(zero, hi));
+        _mm_storeu_si128((__m128i *)(dst + 2 * i + 24), _mm_unpackhi_epi8(zero, hi));
+    }
+
+    pack_uv8_422_scalar(cb0 + i, cr0 + i, cb1 + i, cr1 + i, dst + 2 * i, n - i);
+}
+
+/* Widened to words, the rows are summed and paired like the 10-bit kernel's */
+static void pack_uv8_444_sse2(const uint8_t *cb0, const uint8_t *cr0, const uint8_t *cb1,
+                              const uint8_t *cr1, uint16_t *dst, size_t n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(cb0 + 2 * i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(cb1 + 2 * i));
+        __m128i u = average_pairs_sse2(
+            _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)),
+            _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)));
+        a = _mm_loadu_si128((const __m128i *)(cr0 + 2 * i));
+        b = _mm_loadu_si128((const __m128i *)(cr1 + 2 * i));
+        __m128i v = average_pairs_sse2(
+            _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)),
+            _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)));
+        store_uv_sse2(_mm_slli_epi16(u, 8), _mm_slli_epi16(v, 8), dst + 2 * i);
+    }
+
+    pack_uv8_444_scalar(cb0 + 2 * i, cr0 + 2 * i, cb1 + 2 * i, cr1 + 2 * i, dst + 2 * i, n - i);
+}
+
+const struct p010_pack_kernels p010_sse2_kernels = {
+    "sse2", pack_y_sse2, pack_uv_sse2, pack_y8_sse2, pack_uv8_sse2,
+    pack_uv_422_sse2, pack_uv_444_sse2, pack_uv8_422_sse2, pack_uv8_444_sse2
+};
+
+#ifdef HEIF2JPG_HAVE_AVX2
+bool cpu_has_avx2()
+{
+#ifdef _MSC_VER
+    int info[4];
+
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+
+    /* OSXSAVE and AVX, then check that the OS saves the YMM registers */
+    __cpuid(info, 1);
+    if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0)
+        return false;
+    if ((_xgetbv(0) & 0x6) != 0x6)
+        return false;
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+#endif
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+/* NEON is part of the AArch64 baseline */
+static void pack_y_neon(const uint16_t *src, uint16_t *dst, size_t n)
+{
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8)
+        vst1q_u16(dst + i, vshlq_n_u16(vld1q_u16(src + i), 6));
+
+    pack_y_scalar(src + i, dst + i, n - i);
+}
+
+static void pack_uv_neon(const uint16_t *cb, const uint16_t *cr, uint16_t *dst, size_t n)
+{
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        uint16x8x2_t uv;
+        uv.val[0] = vshlq_n_u16(vld1q_u16(cb + i), 6);
+        uv.val[1] = vshlq_n_u16(vld1q_u16(cr + i), 6);
+        vst2q_u16(dst + 2 * i, uv);
+    }
+
+    pack_uv_scalar(cb + i, cr + i, dst + 2 * i, n - i);
+}
+
+static void pack_y8_neon(const uint8_t *src, uint16_t *dst, size_t n)
+{
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8)
+        vst1q_u16(dst + i, vshll_n_u8(vld1_u8(src + i), 8));
+
+    pack_y8_scalar(src + i, dst + i, n - i);
+}
+
+static void pack_uv8_neon(const uint8_t *cb, const uint8_t *cr, uint16_t *dst, size_t n)
+{
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        uint16x8x2_t uv;
+        uv.val[0] = vshll_n_u8(vld1_u8(cb + i), 8);
+        uv.val[1] = vshll_n_u8(vld1_u8(cr + i), 8);
+        vst2q_u16(dst + 2 * i, uv);
+    }
+
+    pack_uv8_scalar(cb + i, cr + i, dst + 2 * i, n - i);
+}
+
+/* vrhaddq rounds up like the scalar kernel, and vrshrq_n(.., 2) adds the 2 */
+static void pack_uv_422_neon(const uint16_t *cb0, const uint16_t *cr0, const uint16_t *cb1,
+                             const uint16_t *cr1, uint16_t *dst, size_t n)
+{
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        uint16x8x2_t uv;
+        uv.val[0] = vshlq_n_u16(vrhaddq_u16(vld1q_u16(cb0 + i), vld1q_u16(cb1 + i)), 6);
+        uv.val[1] = vshlq_n_u16(vrhaddq_u16(vld1q_u16(cr0 + i), vld1q_u16(cr1 + i)), 6);
+        vst2q_u16(dst + 2 * i, uv);
+    }
+
+    pack_uv_422_scalar(cb0 + i, cr0 + i, cb1 + i, cr1 + i, dst + 2 * i, n - i);
+}
+
+static inline uint16x8_t average_2x2_neon(const uint16_t *r0, const uint16_t *r1)
+{
+    uint16x8_t s0 = vaddq_u16(vld1q_u16(r0), vld1q_u16(r1));
+    uint16x8_t s1 = vaddq_u16(vld1q_u16(r0 + 8), vld1q_u16(r1 + 8));
+
+    return vrshrq_n_u16(vpaddq_u16(s0, s1), 2);
+}
+
+static void pack_uv_444_neon(const uint16_t *cb0, const uint16_t *cr0, const uint16_t *cb1,
+                             const uint16_t *cr1, uint16_t *dst, size_t n)
+{
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        uint16x8x2_t uv;
+        uv.val[0] = vshlq_n_u16(average_2x2_neon(cb0 + 2 * i, cb1 + 2 * i), 6);
+        uv.val[1] = vshlq_n_u16(average_2x2_neon(cr0 + 2 * i, cr1 + 2 * i), 6);
+        vst2q_u16(dst + 2 * i, uv);
+    }
+
+    pack_uv_444_scalar(cb0 + 2 * i, cr0 + 2 * i, cb1 + 2 * i, cr1 + 2 * i, dst + 2 * i, n - i);
+}
+
+static void pack_uv8_422_neon(const uint8_t *cb0, const uint8_t *cr0, const uint8_t *cb1,
+                              const uint8_t *cr1, uint16_t *dst, size_t n)
+{
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        uint16x8x2_t uv;
+        uv.val[0] = vshll_n_u8(vrhadd_u8(vld1_u8(cb0 + i), vld1_u8(cb1 + i)), 8);
+        uv.val[1] = vshll_n_u8(vrhadd_u8(vld1_u8(cr0 + i), vld1_u8(cr1 + i)), 8);
+        vst2q_u16(dst + 2 * i, uv);
+    }
+
+    pack_uv8_422_scalar(cb0 + i, cr0 + i, cb1 + i, cr1 + i, dst + 2 * i, n - i);
+}
+
+static inline uint16x8_t average8_2x2_neon(const uint8_t *r0, const uint8_t *r1)
+{
+    uint8x16_t a = vld1q_u8(r0), b = vld1q_u8(r1);
+    uint16x8_t s0 = vaddl_u8(vget_low_u8(a), vget_low_u8(b));
+    uint16x8_t s1 = vaddl_u8(vget_high_u8(a), vget_high_u8(b));
+
+    return vrshrq_n_u16(vpaddq_u16(s0, s1), 2);
+}
+
+static void pack_uv8_444_neon(const uint8_t *cb0, const uint8_t *cr0, const uint8_t *cb1,
+                              const uint8_t *cr1, uint16_t *dst, size_t n)
+{
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        uint16x8x2_t uv;
+        uv.val[0] = vshlq_n_u16(average8_2x2_neon(cb0 + 2 * i, cb1 + 2 * i), 8);
+        uv.val[1] = vshlq_n_u16(average8_2x2_neon(cr0 + 2 * i, cr1 + 2 * i), 8);
+        vst2q_u16(dst + 2 * i, uv);
+    }
+
+    pack_uv8_444_scalar(cb0 + 2 * i, cr0 + 2 * i, cb1 + 2 * i, cr1 + 2 * i, dst + 2 * i, n - i);
+}
+
+const struct p010_pack_kernels p010_neon_kernels = {
+    "neon", pack_y_neon, pack_uv_neon, pack_y8_neon, pack_uv8_neon,
+    pack_uv_422_neon, pack_uv_444_neon, pack_uv8_422_neon, pack_uv8_444_neon
+};
+#endif
+
+static const struct p010_pack_kernels &select_p010_pack_kernels()
+{
+#if defined(__x86_64__) || defined(_M_X64)
+#ifdef HEIF2JPG_HAVE_AVX2
+    if (cpu_has_avx2())
+        return p010_avx2_kernels;
+#endif
+    return p010_sse2_kernels;
+#elif defined(__aarch64__) || defined(_M_ARM64)
+    return p010_neon_kernels;
+#else
+    return p010_scalar_kernels;
+#endif
+}
+
+const struct p010_pack_kernels &get_p010_pack_kernels()
+{
+    static const struct p010_pack_kernels &kernels = select_p010_pack_kernels();
+    return kernels;
+}
@@ -0,0 +1,64 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * Row kernels that convert 10-bit LSB-aligned or 8-bit YCbCr samples to P010,
+ * with SIMD variants picked at runtime
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#ifndef HEIF2JPG_P010_PACK_H
+#define HEIF2JPG_P010_PACK_H
+
+#include <cstddef>
+#include <cstdint>
+
+struct p010_pack_kernels {
+    const char *name;
+    /* dst[i] = src[i] << 6 for n samples; src and dst may be the same row */
+    void (*pack_y)(const uint16_t *src, uint16_t *dst, size_t n);
+    /* dst[2i] = cb[i] << 6, dst[2i + 1] = cr[i] << 6 for n sample pairs */
+    void (*pack_uv)(const uint16_t *cb, const uint16_t *cr, uint16_t *dst, size_t n);
+    /* As pack_y and pack_uv for 8-bit samples, which are widened: src[i] << 8 */
+    void (*pack_y8)(const uint8_t *src, uint16_t *dst, size_t n);
+    void (*pack_uv8)(const uint8_t *cb, const uint8_t *cr, uint16_t *dst, size_t n);
+    /*
+     * pack_uv fused with downsampling 4:2:2 or 4:4:4 chroma to 4:2:0, so the
+     * source is only read once. Each output sample averages two source rows,
+     * cb0/cr0 and cb1/cr1 (the same row twice at an odd bottom edge), with
+     * rounding. pack_uv_422 reads n samples from each row; pack_uv_444 reads
+     * 2n and averages horizontal pairs too.
+     */
+    void (*pack_uv_422)(const uint16_t *cb0, const uint16_t *cr0, const uint16_t *cb1,
+                        const uint16_t *cr1, uint16_t *dst, size_t n);
+    void (*pack_uv_444)(const uint16_t *cb0, const uint16_t *cr0, const uint16_t *cb1,
+                        const uint16_t *cr1, uint16_t *dst, size_t n);
+    /* As pack_uv_422 and pack_uv_444 for 8-bit samples */
+    void (*pack_uv8_422)(const uint8_t *cb0, const uint8_t *cr0, const uint8_t *cb1,
+                         const uint8_t *cr1, uint16_t *dst, size_t n);
+    void (*pack_uv8_444)(const uint8_t *cb0, const uint8_t *cr0, const uint8_t *cb1,
+                         const uint8_t *cr1, uint16_t *dst, size_t n);
+};
+
+/* Plain C++ kernels; the reference the SIMD kernels must match bit for bit */
+extern const struct p010_pack_kernels p010_scalar_kernels;
+
+/*
+ * The fastest kernels the running CPU supports. Chosen on first use, after
+ * which this is just a load of a static.
+ */
+const struct p010_pack_kernels &get_p010_pack_kernels();
+
+#if defined(__x86_64__) || defined(_M_X64)
+extern const struct p010_pack_kernels p010_sse2_kernels;
+#endif
+#ifdef HEIF2JPG_HAVE_AVX2
+extern const struct p010_pack_kernels p010_avx2_kernels;
+
+/* True if the CPU and OS both support AVX2; checked before any AVX2 kernel runs */
+bool cpu_has_avx2();
+#endif
+#if defined(__aarch64__) || defined(_M_ARM64)
+extern const struct p010_pack_kernels p010_neon_kernels;
+#endif
+
+#endif /* HEIF2JPG_P010_PACK_H */
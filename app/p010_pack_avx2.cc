@@ -0,0 +1,183 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * AVX2 P010 row kernels. This file is built with AVX2 code generation
+ * enabled, so nothing in it may run before get_p010_pack_kernels() has
+ * checked that the CPU supports AVX2.
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#include <immintrin.h>
+
+#include "p010_pack.h"
+
+static void pack_y_avx2(const uint16_t *src, uint16_t *dst, size_t n)
+{
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_slli_epi16(v, 6));
+    }
+
+    p010_scalar_kernels.pack_y(src + i, dst + i, n - i);
+}
+
+static void pack_uv_avx2(const uint16_t *cb, const uint16_t *cr, uint16_t *dst, size_t n)
+{
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m256i u = _mm256_slli_epi16(_mm256_loadu_si256((const __m256i *)(cb + i)), 6);
+        __m256i v = _mm256_slli_epi16(_mm256_loadu_si256((const __m256i *)(cr + i)), 6);
+
+        /* unpack works within 128-bit lanes, so put the lanes back in order */
+        __m256i lo = _mm256_unpacklo_epi16(u, v);
+        __m256i hi = _mm256_unpackhi_epi16(u, v);
+        _mm256_storeu_si256((__m256i *)(dst + 2 * i), _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i *)(dst + 2 * i + 16), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+
+    p010_scalar_kernels.pack_uv(cb + i, cr + i, dst + 2 * i, n - i);
+}
+
+static void pack_y8_avx2(const uint8_t *src, uint16_t *dst, size_t n)
+{
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m256i v = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(src + i)));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_slli_epi16(v, 8));
+    }
+
+    p010_scalar_kernels.pack_y8(src + i, dst + i, n - i);
+}
+
+static void pack_uv8_avx2(const uint8_t *cb, const uint8_t *cr, uint16_t *dst, size_t n)
+{
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i u = _mm_loadu_si128((const __m128i *)(cb + i));
+        __m128i v = _mm_loadu_si128((const __m128i *)(cr + i));
+
+        /* Interleave the bytes first; widening then keeps them in order */
+        __m256i lo = _mm256_cvtepu8_epi16(_mm_unpacklo_epi8(u, v));
+        __m256i hi = _mm256_cvtepu8_epi16(_mm_unpackhi_epi8(u, v));
+        _mm256_storeu_si256((__m256i *)(dst + 2 * i), _mm256_slli_epi16(lo, 8));
+        _mm256_storeu_si256((__m256i *)(dst + 2 * i + 16), _mm256_slli_epi16(hi, 8));
+    }
+
+    p010_scalar_kernels.pack_uv8(cb + i, cr + i, dst + 2 * i, n - i);
+}
+
+/* Interleaves 16 Cb and 16 Cr words, already shifted into place, into dst */
+static inline void store_uv_avx2(__m256i u, __m256i v, uint16_t *dst)
+{
+    __m256i lo = _mm256_unpacklo_epi16(u, v);
+    __m256i hi = _mm256_unpackhi_epi16(u, v);
+    _mm256_storeu_si256((__m256i *)dst, _mm256_permute2x128_si256(lo, hi, 0x20));
+    _mm256_storeu_si256((__m256i *)(dst + 16), _mm256_permute2x128_si256(lo, hi, 0x31));
+}
+
+/* As average_pairs_sse2(); the pack works per lane, so the quadwords are reordered */
+static inline __m256i average_pairs_avx2(__m256i s0, __m256i s1)
+{
+    const __m256i ones = _mm256_set1_epi16(1);
+    const __m256i two = _mm256_set1_epi16(2);
+    __m256i sums = _mm256_packs_epi32(_mm256_madd_epi16(s0, ones), _mm256_madd_epi16(s1, ones));
+
+    sums = _mm256_permute4x64_epi64(sums, 0xd8);
+    return _mm256_srli_epi16(_mm256_add_epi16(sums, two), 2);
+}
+
+static void pack_uv_422_avx2(const uint16_t *cb0, const uint16_t *cr0, const uint16_t *cb1,
+                             const uint16_t *cr1, uint16_t *dst, size_t n)
+{
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m256i u = _mm256_avg_epu16(_mm256_loadu_si256((const __m256i *)(cb0 + i)),
+                                     _mm256_loadu_si256((const __m256i *)(cb1 + i)));
+        __m256i v = _mm256_avg_epu16(_mm256_loadu_si256((const __m256i *)(cr0 + i)),
+                                     _mm256_loadu_si256((const __m256i *)(cr1 + i)));
+        store_uv_avx2(_mm256_slli_epi16(u, 6), _mm256_slli_epi16(v, 6), dst + 2 * i);
+    }
+
+    p010_scalar_kernels.pack_uv_422(cb0 + i, cr0 + i, cb1 + i, cr1 + i, dst + 2 * i, n - i);
+}
+
+/* Sum of two rows of 16 words at r0 and r1 */
+static inline __m256i add_rows_avx2(const uint16_t *r0, const uint16_t *r1)
+{
+    return _mm256_add_epi16(_mm256_loadu_si256((const __m256i *)r0),
+                            _mm256_loadu_si256((const __m256i *)r1));
+}
+
+static void pack_uv_444_avx2(const uint16_t *cb0, const uint16_t *cr0, const uint16_t *cb1,
+                             const uint16_t *cr1, uint16_t *dst, size_t n)
+{
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        size_t j = 2 * i;
+        __m256i u = average_pairs_avx2(add_rows_avx2(cb0 + j, cb1 + j),
+                                       add_rows_avx2(cb0 + j + 16, cb1 + j + 16));
+        __m256i v = average_pairs_avx2(add_rows_avx2(cr0 + j, cr1 + j),
+                                       add_rows_avx2(cr0 + j + 16, cr1 + j + 16));
+        store_uv_avx2(_mm256_slli_epi16(u, 6), _mm256_slli_epi16(v, 6), dst + 2 * i);
+    }
+
+    p010_scalar_kernels.pack_uv_444(cb0 + 2 * i, cr0 + 2 * i, cb1 + 2 * i, cr1 + 2 * i,
+                                    dst + 2 * i, n - i);
+}
+
+static void pack_uv8_422_avx2(const uint8_t *cb0, const uint8_t *cr0, const uint8_t *cb1,
+                              const uint8_t *cr1, uint16_t *dst, size_t n)
+{
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i u = _mm_avg_epu8(_mm_loadu_si128((const __m128i *)(cb0 + i)),
+                                 _mm_loadu_si128((const __m128i *)(cb1 + i)));
+        __m128i v = _mm_avg_epu8(_mm_loadu_si128((const __m128i *)(cr0 + i)),
+                                 _mm_loadu_si128((const __m128i *)(cr1 + i)));
+
+        __m256i lo = _mm256_cvtepu8_epi16(_mm_unpacklo_epi8(u, v));
+        __m256i hi = _mm256_cvtepu8_epi16(_mm_unpackhi_epi8(u, v));
+        _mm256_storeu_si256((__m256i *)(dst + 2 * i), _mm256_slli_epi16(lo, 8));
+        _mm256_storeu_si256((__m256i *)(dst + 2 * i + 16), _mm256_slli_epi16(hi, 8));
+    }
+
+    p010_scalar_kernels.pack_uv8_422(cb0 + i, cr0 + i, cb1 + i, cr1 + i, dst + 2 * i, n - i);
+}
+
+/* Sum of two rows of 16 bytes at r0 and r1, widened to words */
+static inline __m256i add_rows8_avx2(const uint8_t *r0, const uint8_t *r1)
+{
+    return _mm256_add_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)r0)),
+                            _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)r1)));
+}
+
+static void pack_uv8_444_avx2(const uint8_t *cb0, const uint8_t *cr0, const uint8_t *cb1,
+                              const uint8_t *cr1, uint16_t *dst, size_t n)
+{
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        size_t j = 2 * i;
+        __m256i u = average_pairs_avx2(add_rows8_avx2(cb0 + j, cb1 + j),
+                                       add_rows8_avx2(cb0 + j + 16, cb1 + j + 16));
+        __m256i v = average_pairs_avx2(add_rows8_avx2(cr0 + j, cr1 + j),
+                                       add_rows8_avx2(cr0 + j + 16, cr1 + j + 16));
+        store_uv_avx2(_mm256_slli_epi16(u, 8), _mm256_slli_epi16(v, 8), dst + 2 * i);
+    }
+
+    p010_scalar_kernels.pack_uv8_444(cb0 + 2 * i, cr0 + 2 * i, cb1 + 2 * i, cr1 + 2 * i,
+                                     dst + 2 * i, n - i);
+}
+
+const struct p010_pack_kernels p010_avx2_kernels = {
+    "avx2", pack_y_avx2, pack_uv_avx2, pack_y8_avx2, pack_uv8_avx2,
+    pack_uv_422_avx2, pack_uv_444_avx2, pack_uv8_422_avx2, pack_uv8_444_avx2
+};
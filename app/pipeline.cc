@@ -0,0 +1,637 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * Multi-stage conversion pipeline: decode, P010 pack, ultra HDR encode and
+ * write stages connected by bounded queues
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "bounded_queue.h"
+#include "decoder.h"
+#include "log.h"
+#include "memory_budget.h"
+#include "pipeline.h"
+#include "prefetch.h"
+#include "trace.h"
+
+/*
+ * Encoders travel with their job from the encode stage to the write stage, so
+ * the encoded stream is written from the encoder's own buffer instead of being
+ * copied out. Finished encoders are reset and handed back for reuse; at most
+ * one per encode thread, queued job and writer is ever created.
+ */
+class EncoderPool
+{
+public:
+    std::unique_ptr<ConversionWorker> acquire()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (idle_.empty())
+            return std::make_unique<ConversionWorker>(false);
+
+        auto worker = std::move(idle_.back());
+        idle_.pop_back();
+        return worker;
+    }
+
+    void release(std::unique_ptr<ConversionWorker> worker)
+    {
+        /* Drops the encoded stream so idle encoders don't hold on to it */
+        uhdr_reset_encoder(worker->encoder);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        idle_.push_back(std::move(worker));
+    }
+
+private:
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<ConversionWorker>> idle_;
+};
+
+/* One file as it moves through the pipeline */
+struct PipelineJob {
+    const struct heif2jpg_pipeline_file *file;
+    /* These differ between the renditions of one image */
+    std::string output_filename;
+    struct heif2jpg_encode_options encode_options;
+    /* Shared by the renditions of an image that's encoded from its planes */
+    std::shared_ptr<DecodedImage> decoded;
+    /* decoded's, which is often released before the encode */
+    std::shared_ptr<const struct heif2jpg_image_metadata> metadata;
+    P010Image packed;
+    /* Encoded straight from decoded as a plain jpeg; nothing is packed */
+    bool sdr = false;
+    /* Owner of the encoded stream between the encode and write stages */
+    std::unique_ptr<ConversionWorker> encoder;
+    const uhdr_compressed_image_t *encoded = nullptr;
+    /* Set if the output is to be cached; cached holds it on a hit */
+    std::string cache_key;
+    std::vector<uint8_t> cached;
+    /* The image's share of --max-memory, shared by its renditions */
+    std::shared_ptr<MemoryReservation> reservation;
+    struct heif2jpg_conversion_stats stats;
+};
+
+using JobQueue = BoundedQueue<std::unique_ptr<PipelineJob>>;
+
+/* Totals for one stage, summed over all of its threads */
+struct StageStats {
+    const char *name;
+    std::atomic<uint64_t> busy_ns{0};
+    std::atomic<uint64_t> files{0};
+    std::atomic<uint64_t> bytes{0};
+};
+
+class StageTimer
+{
+public:
+    StageTimer(StageStats &stats)
+        : stats_(stats), start_(std::chrono::steady_clock::now()) {}
+
+    ~StageTimer()
+    {
+        auto elapsed = std::chrono::steady_clock::now() - start_;
+        stats_.busy_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    }
+
+private:
+    StageStats &stats_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+static void print_stage_stats(FILE *out, const StageStats &stats)
+{
+    double busy_s = stats.busy_ns / 1e9;
+    uint64_t files = stats.files;
+
+    fprintf(out, "  %-7s %7llu files %9.2f s busy %9.1f ms/file %9.1f MB/s\n",
+           stats.name, (unsigned long long)files, busy_s,
+           files ? busy_s * 1000 / files : 0.0,
+           busy_s > 0 ? stats.bytes / busy_s / 1e6 : 0.0);
+}
+
+int run_pipeline(const std::vector<struct heif2jpg_pipeline_file> &files,
+                 const struct heif2jpg_pipeline_options &options)
+{
+    JobQueue decoded_queue(options.queue_depth);
+    JobQueue packed_queue(options.queue_depth);
+    JobQueue encoded_queue(options.queue_depth);
+
+    StageStats decode_stats{"decode"}, pack_stats{"pack"},
+               encode_stats{"encode"}, write_stats{"write"};
+
+    EncoderPool encoders;
+
+    std::atomic<size_t> next_file{0};
+    std::atomic<size_t> num_converted{0};
+    std::atomic<size_t> num_failed{0};
+    std::atomic<int> last_error{0};
+    std::mutex log_mutex;
+
+    /*
+     * Jobs not yet written or failed for each input file, for options.converted.
+     * An input starts with one per entry in files; a job split into several
+     * images or renditions adds the rest before it's handed on. Held under
+     * log_mutex.
+     */
+    std::unordered_map<std::string, size_t> unfinished_jobs;
+    std::unordered_set<std::string> failed_inputs;
+    if (options.converted) {
+        for (const auto &file : files)
+            unfinished_jobs[file.input_filename]++;
+    }
+
+    auto add_jobs = [&](const std::string &input_filename, size_t count) {
+        if (!options.converted)
+            return;
+        std::lock_guard<std::mutex> lock(log_mutex);
+        unfinished_jobs[input_filename] += count;
+    };
+
+    /* Called with log_mutex held as each job is written or fails */
+    auto finish_job = [&](const std::string &input_filename, bool written) {
+        if (!options.converted)
+            return;
+        if (!written)
+            failed_inputs.insert(input_filename);
+        if (--unfinished_jobs[input_filename] == 0 && !failed_inputs.count(input_filename))
+            options.converted(input_filename);
+    };
+
+    /* Drops the job, so its memory is freed before the stage waits for the next one */
+    auto fail = [&](std::unique_ptr<PipelineJob> &job, int ret) {
+        {
+            std::lock_guard<std::mutex> lock(log_mutex);
+            num_failed++;
+            last_error = ret;
+            std::cerr << job->file->input_filename << ": failed (" << ret << ")" << std::endl;
+            finish_job(job->file->input_filename, false);
+        }
+        job.reset();
+    };
+
+    /*
+     * Images of multi-image files after the first, queued by whichever
+     * decode thread opened the file and taken before the next file. The list
+     * keeps them at a stable address for job->file.
+     */
+    std::mutex images_mutex;
+    std::list<struct heif2jpg_pipeline_file> image_files;
+    std::deque<const struct heif2jpg_pipeline_file *> pending_images;
+
+    /* Only files the decode stage opens itself are read ahead */
+    std::unique_ptr<InputPrefetcher> prefetcher;
+    if (options.prefetch) {
+        std::vector<std::string> filenames;
+        for (const auto &file : files)
+            filenames.push_back(file.ctx ? std::string() : file.input_filename);
+        prefetcher = std::make_unique<InputPrefetcher>(std::move(filenames), options.prefetch,
+                                                       (unsigned int)options.prefetch);
+    }
+
+    /* Every image has the same outputs, so the same widths go into each estimate */
+    std::unique_ptr<MemoryBudget> budget;
+    std::vector<int> output_widths;
+    if (options.max_memory) {
+        budget = std::make_unique<MemoryBudget>(options.max_memory);
+        if (!options.renditions.empty()) {
+            for (const auto &rendition : options.renditions)
+                output_widths.push_back(rendition.width);
+        } else {
+            output_widths.push_back(options.preview_width ? options.preview_width :
+                                                            options.encode_options.new_width);
+        }
+    }
+
+    struct heif2jpg_cache_params cache_params;
+    cache_params.encode_options = options.encode_options;
+    cache_params.output_p010 = options.output_p010;
+    cache_params.preview_width = options.preview_width;
+    cache_params.images = options.images;
+
+    /* index is set to the file's place in files, or files.size() for queued images */
+    auto next_decode_file = [&](size_t &index) -> const struct heif2jpg_pipeline_file * {
+        index = files.size();
+        {
+            std::lock_guard<std::mutex> lock(images_mutex);
+            if (!pending_images.empty()) {
+                auto file = pending_images.front();
+                pending_images.pop_front();
+                return file;
+            }
+        }
+
+        index = next_file++;
+        return index < files.size() ? &files[index] : nullptr;
+    };
+
+    /* Opens a file, queues all but its first selected image and reads that one */
+    auto open_file = [&](PipelineJob &job, size_t index) {
+        std::vector<heif_item_id> image_ids;
+        std::vector<size_t> selected;
+        HeifContextPtr ctx;
+        int ret;
+
+        /* With prefetching this counts the wait for the read, not the read itself */
+        auto start = std::chrono::steady_clock::now();
+        std::shared_ptr<MappedInputFile> input;
+        if (prefetcher) {
+            input = prefetcher->take(index, ret);
+        } else {
+            input = std::make_shared<MappedInputFile>();
+            ret = input->open(job.file->input_filename);
+        }
+        if (ret)
+            return ret;
+
+        /* A hit is written as it is, without libheif ever seeing the file */
+        if (options.cache && options.renditions.empty()) {
+            job.cache_key = ConversionCache::key(input->data(), input->size(), cache_params);
+            if (options.cache->lookup(job.cache_key, job.cached)) {
+                job.stats.cache_hit = true;
+                job.stats.input_filename = job.file->input_filename;
+                job.stats.input_bytes = input->size();
+                job.stats.read_ms = elapsed_ms(start);
+                return 0;
+            }
+        }
+
+        ret = open_heif_file(job.file->input_filename, input, ctx, image_ids, &job.stats);
+        job.stats.read_ms = elapsed_ms(start);
+        if (ret)
+            return ret;
+        if (!select_heif_images(options.images, ctx, image_ids, selected))
+            return 6;
+
+        if (selected.size() > 1) {
+            job.cache_key.clear();
+            add_jobs(job.file->input_filename, selected.size() - 1);
+            std::lock_guard<std::mutex> lock(images_mutex);
+            const struct heif2jpg_pipeline_file *first = nullptr;
+
+            for (size_t i : selected) {
+                image_files.push_back({job.file->input_filename,
+                                       image_output_filename(job.file->output_filename, i + 1),
+                                       ctx, image_ids[i]});
+                if (first)
+                    pending_images.push_back(&image_files.back());
+                else
+                    first = &image_files.back();
+            }
+            job.file = first;
+        }
+
+        return read_heif_image(ctx, image_ids[selected[0]], *job.decoded);
+    };
+
+    auto decode_stage = [&]() {
+        size_t index;
+        for (auto file = next_decode_file(index); file; file = next_decode_file(index)) {
+            auto job = std::make_unique<PipelineJob>();
+            job->file = file;
+            job->encode_options = options.encode_options;
+            job->decoded = std::make_shared<DecodedImage>();
+
+            int ret;
+            {
+                StageTimer timer(decode_stats);
+                TraceSpan span("open", file->input_filename);
+                if (file->ctx) {
+                    std::error_code ec;
+                    job->stats.input_filename = file->input_filename;
+                    job->stats.input_bytes = std::filesystem::file_size(file->input_filename, ec);
+                    ret = read_heif_image(file->ctx, file->image_id, *job->decoded);
+                } else {
+                    ret = open_file(*job, index);
+                }
+            }
+            /* Sized from the handle, before anything is decoded; the wait isn't decode time */
+            if (!ret && budget && !job->stats.cache_hit) {
+                TraceSpan span("wait for memory", job->file->input_filename);
+                job->reservation = std::make_shared<MemoryReservation>(
+                    *budget, estimate_conversion_bytes(job->decoded->handle, output_widths,
+                                                       options.encode_options,
+                                                       options.output_p010, options.tiled));
+            }
+            {
+                StageTimer timer(decode_stats);
+                TraceSpan span("decode", job->file->input_filename);
+                struct heif_image_tiling tiling;
+                bool decode = !ret && !job->stats.cache_hit;
+                if (decode && options.preview_width)
+                    ret = decode_heif_preview(*job->decoded, options.preview_width, false,
+                                              &job->stats);
+                else if (decode && options.tiled &&
+                         get_heif_tiling(*job->decoded, options.output_p010,
+                                         job->encode_options, tiling))
+                    ret = decode_p010_image_tiled(*job->decoded, tiling, job->packed, false,
+                                                  &job->stats);
+                else if (decode)
+                    ret = decode_heif_image(*job->decoded, false, &job->stats);
+            }
+            job->output_filename = job->file->output_filename;
+            if (ret) {
+                fail(job, ret);
+                continue;
+            }
+
+            if (!job->stats.cache_hit) {
+                decode_stats.files++;
+                decode_stats.bytes += job->stats.input_bytes;
+                job->metadata = job->decoded->metadata;
+            }
+
+            if (!decoded_queue.push(std::move(job)))
+                break;
+        }
+    };
+
+    /*
+     * Packs every rendition of a decoded image into a job of its own, so the
+     * encode threads can work on them at once. Each is copied or resampled
+     * out of the decoded planes, which are left untouched for the next one;
+     * plain jpeg renditions share the decoded image instead.
+     */
+    auto pack_renditions = [&](std::unique_ptr<PipelineJob> job) {
+        add_jobs(job->file->input_filename, options.renditions.size() - 1);
+        for (const auto &rendition : options.renditions) {
+            auto out = std::make_unique<PipelineJob>();
+            out->file = job->file;
+            out->stats = job->stats;
+            out->output_filename = rendition_output_filename(job->output_filename, rendition);
+            out->encode_options = job->encode_options;
+            out->metadata = job->metadata;
+            out->reservation = job->reservation;
+            out->encode_options.new_width = rendition.width;
+            out->encode_options.quality = rendition.quality;
+
+            if (job->sdr) {
+                out->decoded = job->decoded;
+                out->sdr = true;
+                if (!packed_queue.push(std::move(out)))
+                    return false;
+                continue;
+            }
+
+            int width, height;
+            int ret;
+            auto start = std::chrono::steady_clock::now();
+            {
+                StageTimer timer(pack_stats);
+                TraceSpan span("pack", out->output_filename);
+                if (get_downscaled_size(job->decoded->image, out->encode_options, width, height))
+                    ret = pack_p010_image_scaled(job->decoded->image, out->packed, width, height,
+                                                 out->encode_options.resize_filter, false);
+                else
+                    ret = pack_p010_image(job->decoded->image, out->packed, false);
+            }
+            out->stats.pack_ms += elapsed_ms(start);
+            if (ret) {
+                fail(out, ret);
+                continue;
+            }
+
+            pack_stats.files++;
+            pack_stats.bytes += out->packed.y_size() + out->packed.uv_size();
+
+            if (!packed_queue.push(std::move(out)))
+                return false;
+        }
+
+        return true;
+    };
+
+    auto pack_stage = [&]() {
+        std::unique_ptr<PipelineJob> job;
+
+        while (decoded_queue.pop(job)) {
+            int width, height;
+            int ret;
+
+            /* Cache hits pass straight through to the write stage */
+            if (job->stats.cache_hit) {
+                if (!packed_queue.push(std::move(job)))
+                    break;
+                continue;
+            }
+
+            job->sdr = !options.output_p010 && job->decoded->image &&
+                       is_sdr_jpeg_image(job->decoded->image, job->encode_options);
+
+            if (!options.renditions.empty() && job->decoded->image) {
+                if (!pack_renditions(std::move(job)))
+                    break;
+                continue;
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            {
+                StageTimer timer(pack_stats);
+                TraceSpan span("pack", job->output_filename);
+                /*
+                 * JPEG encodes read the Y plane straight out of the decoded
+                 * image, so that's kept until the encode is done. P010 output
+                 * is written as one contiguous file, so it gets its own copy
+                 * and the decoded image can go right away.
+                 */
+                if (!job->decoded->image) {
+                    /* Tiled decodes were packed as they went */
+                    job->decoded.reset();
+                    ret = 0;
+                } else if (job->sdr) {
+                    /* Plain jpegs are encoded from the decoded planes */
+                    ret = 0;
+                } else if (options.output_p010) {
+                    ret = pack_p010_image(job->decoded->image, job->packed, false);
+                    job->decoded.reset();
+                } else if (get_downscaled_size(job->decoded->image, job->encode_options,
+                                               width, height)) {
+                    /* Nothing is borrowed from a downscaled image */
+                    ret = pack_p010_image_scaled(job->decoded->image, job->packed, width,
+                                                 height, job->encode_options.resize_filter,
+                                                 false);
+                    job->decoded.reset();
+                } else {
+                    ret = pack_p010_image_in_place(job->decoded->image, job->packed, false);
+                }
+            }
+            job->stats.pack_ms += elapsed_ms(start);
+            if (ret) {
+                fail(job, ret);
+                continue;
+            }
+
+            pack_stats.files++;
+            pack_stats.bytes += job->packed.y_size() + job->packed.uv_size();
+
+            if (!packed_queue.push(std::move(job)))
+                break;
+        }
+    };
+
+    auto encode_stage = [&]() {
+        std::unique_ptr<PipelineJob> job;
+
+        while (packed_queue.pop(job)) {
+            /* P010 output is written straight from the packed planes */
+            if (!options.output_p010 && !job->stats.cache_hit) {
+                int ret;
+                job->encoder = encoders.acquire();
+                auto start = std::chrono::steady_clock::now();
+                {
+                    StageTimer timer(encode_stats);
+                    TraceSpan span("encode", job->output_filename);
+                    if (job->sdr)
+                        ret = encode_sdr_jpeg(job->decoded->image, job->encode_options,
+                                              *job->encoder, &job->encoded, job->metadata.get());
+                    else
+                        ret = encode_uhdr_image(job->packed, job->encode_options,
+                                                *job->encoder, &job->encoded,
+                                                job->metadata.get());
+                    job->packed = P010Image();
+                    job->decoded.reset();
+                }
+                job->stats.encode_ms = elapsed_ms(start);
+                if (ret) {
+                    encoders.release(std::move(job->encoder));
+                    fail(job, ret);
+                    continue;
+                }
+
+                encode_stats.files++;
+                encode_stats.bytes += job->encoded->data_sz;
+            }
+
+            if (!encoded_queue.push(std::move(job)))
+                break;
+        }
+    };
+
+    auto write_stage = [&]() {
+        std::unique_ptr<PipelineJob> job;
+
+        while (encoded_queue.pop(job)) {
+            std::vector<std::pair<const void *, size_t>> buffers;
+            size_t bytes;
+
+            if (job->stats.cache_hit) {
+                buffers.push_back({job->cached.data(), job->cached.size()});
+                bytes = job->cached.size();
+            } else if (options.output_p010) {
+                buffers.push_back({job->packed.y.get(), job->packed.y_size()});
+                buffers.push_back({job->packed.uv.get(), job->packed.uv_size()});
+                bytes = job->packed.y_size() + job->packed.uv_size();
+            } else {
+                buffers.push_back({job->encoded->data, job->encoded->data_sz});
+                bytes = job->encoded->data_sz;
+            }
+
+            int ret;
+            auto start = std::chrono::steady_clock::now();
+            {
+                StageTimer timer(write_stats);
+                TraceSpan span("write", job->output_filename);
+                ret = write_output_file(job->output_filename, buffers,
+                                        options.write_mode);
+                if (!ret && !job->stats.cache_hit && !job->cache_key.empty())
+                    options.cache->store(job->cache_key, buffers);
+            }
+            job->stats.write_ms = elapsed_ms(start);
+            if (job->encoder)
+                encoders.release(std::move(job->encoder));
+            if (ret) {
+                fail(job, ret);
+                continue;
+            }
+
+            write_stats.files++;
+            write_stats.bytes += bytes;
+
+            num_converted++;
+            job->stats.output_filename = job->output_filename;
+            job->stats.output_bytes = bytes;
+
+            {
+                std::lock_guard<std::mutex> lock(log_mutex);
+                if (options.stats)
+                    log_out() << conversion_stats_json(job->stats) << std::endl;
+                else
+                    log_out() << job->file->input_filename << " -> "
+                              << job->output_filename << std::endl;
+                finish_job(job->file->input_filename, true);
+            }
+            /* Done with it; don't hold its reservation while waiting for the next job */
+            job.reset();
+        }
+    };
+
+    /* Starts a stage's threads; the last one out closes the downstream queue */
+    std::vector<std::thread> threads;
+    auto start_stage = [&](const char *name, unsigned int num_threads,
+                           std::function<void()> stage, JobQueue *output) {
+        auto remaining = std::make_shared<std::atomic<unsigned int>>(num_threads);
+
+        for (unsigned int i = 0; i < num_threads; i++) {
+            threads.emplace_back([name, stage, output, remaining]() {
+                trace_thread_name(name);
+                stage();
+                if (--*remaining == 0 && output)
+                    output->close();
+            });
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+
+    start_stage("decode", std::max(1u, options.decode_threads), decode_stage, &decoded_queue);
+    start_stage("pack", std::max(1u, options.pack_threads), pack_stage, &packed_queue);
+    start_stage("encode", std::max(1u, options.encode_threads), encode_stage, &encoded_queue);
+    start_stage("write", std::max(1u, options.write_threads), write_stage, nullptr);
+
+    for (auto &thread : threads)
+        thread.join();
+
+    double wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    size_t num_images = num_converted + num_failed;
+
+    FILE *summary = options.stats ? stderr : log_file();
+    fprintf(summary, "Converted %zu of %zu images in %.2f s (%.2f images/s)\n",
+           (size_t)num_converted, num_images, wall_s,
+           wall_s > 0 ? num_converted / wall_s : 0.0);
+    fprintf(summary, "  %u decode threads (%d inside each decode), %u encode threads, "
+            "%u write threads\n",
+            std::max(1u, options.decode_threads), std::max(1, heif_decoding_threads()),
+            std::max(1u, options.encode_threads), std::max(1u, options.write_threads));
+    print_stage_stats(summary, decode_stats);
+    print_stage_stats(summary, pack_stats);
+    if (!options.output_p010)
+        print_stage_stats(summary, encode_stats);
+    print_stage_stats(summary, write_stats);
+    if (options.cache)
+        fprintf(summary, "  cache   %7llu hits %8llu misses\n",
+                (unsigned long long)options.cache->hits(),
+                (unsigned long long)options.cache->misses());
+    if (budget)
+        fprintf(summary, "  memory  %7llu MiB peak estimate of %llu MiB, %llu images waited\n",
+                (unsigned long long)(budget->peak_bytes() >> 20),
+                (unsigned long long)(budget->max_bytes() >> 20),
+                (unsigned long long)budget->waits());
+
+    return last_error;
+}
@@ -0,0 +1,109 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * Multi-stage conversion pipeline: decode, P010 pack, ultra HDR encode and
+ * write stages connected by bounded queues
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#ifndef HEIF2JPG_PIPELINE_H
+#define HEIF2JPG_PIPELINE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "cache.h"
+#include "convert.h"
+
+struct heif2jpg_pipeline_file {
+    std::string input_filename;
+    std::string output_filename;
+    /*
+     * Set for one image of a file that has already been opened; otherwise
+     * the decode stage opens input_filename itself
+     */
+    HeifContextPtr ctx;
+    heif_item_id image_id = 0;
+};
+
+struct heif2jpg_pipeline_options {
+    unsigned int decode_threads;
+    unsigned int pack_threads;
+    unsigned int encode_threads;
+    /*
+     * Threads writing outputs, so a slow destination doesn't hold encoders
+     * and their streams while earlier files are still being written
+     */
+    unsigned int write_threads = 1;
+    /*
+     * Number of images that may wait between two stages. At most
+     * 3 * queue_depth images plus one per stage thread are in memory at once.
+     */
+    size_t queue_depth;
+    /*
+     * Files the decode stage opens are read into memory this many ahead of
+     * the one being decoded, on threads of their own; 0 maps each as it's
+     * opened instead
+     */
+    size_t prefetch = 0;
+    bool output_p010;
+    enum heif2jpg_write_mode write_mode;
+    /*
+     * Print a JSON stats record per file instead of a progress line; the
+     * summary moves to stderr so the records can be parsed on their own
+     */
+    bool stats;
+    /*
+     * Decode grid images one tile at a time; the decode stage then packs each
+     * tile as it goes and the pack stage has nothing left to do
+     */
+    bool tiled;
+    /*
+     * Images to convert from files the decode stage opens, as for
+     * select_heif_images(). When more than one is picked, each image's
+     * output gets its number, as from image_output_filename().
+     */
+    std::string images;
+    /* If set, convert previews this many pixels wide instead of the images */
+    uint16_t preview_width;
+    struct heif2jpg_encode_options encode_options;
+    /*
+     * JPEG only: if not empty, every image is decoded once and written at
+     * each of these sizes, overriding encode_options' width and quality
+     */
+    std::vector<struct heif2jpg_rendition> renditions;
+    /*
+     * If not 0, images are only decoded while the estimated memory of every
+     * conversion in flight, from estimate_conversion_bytes(), stays under
+     * this many bytes. An image too big for it on its own is converted once
+     * nothing else is.
+     */
+    uint64_t max_memory = 0;
+    /*
+     * If set, files the decode stage opens are looked up here before they're
+     * parsed, and written to it after converting. Only files with a single
+     * output are cached: renditions and multi-image selections aren't.
+     */
+    ConversionCache *cache = nullptr;
+    /*
+     * If set, called with each input file once every output of it has been
+     * written; inputs with any image that failed are never passed. Calls come
+     * from the write threads, one at a time.
+     */
+    std::function<void(const std::string &input_filename)> converted;
+};
+
+/*
+ * Runs every file through the pipeline so that one file can decode while
+ * another is being encoded, then prints per-stage throughput. The images of
+ * a multi-image file are spread over the decode threads like separate files.
+ *
+ * Returns 0 if every image converted, or the exit code of the last failure.
+ */
+int run_pipeline(const std::vector<struct heif2jpg_pipeline_file> &files,
+                 const struct heif2jpg_pipeline_options &options);
+
+#endif /* HEIF2JPG_PIPELINE_H */
@@ -0,0 +1,130 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * Size-bucketed pool that recycles image plane buffers between conversions
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#include <cstdlib>
+#include <new>
+
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#include "plane_pool.h"
+
+/* Bucket granularity and huge page alignment */
+static constexpr size_t bucket_size = (size_t)2 << 20;
+
+PlaneBuffer &PlaneBuffer::operator=(PlaneBuffer &&other) noexcept
+{
+    if (this != &other) {
+        reset();
+        pool_ = other.pool_;
+        data_ = other.data_;
+        capacity_ = other.capacity_;
+        other.pool_ = nullptr;
+        other.data_ = nullptr;
+        other.capacity_ = 0;
+    }
+
+    return *this;
+}
+
+void PlaneBuffer::reset()
+{
+    if (data_ && pool_)
+        pool_->release(data_, capacity_);
+
+    pool_ = nullptr;
+    data_ = nullptr;
+    capacity_ = 0;
+}
+
+PlanePool::~PlanePool()
+{
+    for (auto &entry : idle_)
+        deallocate(entry.second);
+}
+
+PlaneBuffer PlanePool::acquire(size_t size)
+{
+    size_t capacity = (size + bucket_size - 1) / bucket_size * bucket_size;
+    if (capacity == 0)
+        capacity = bucket_size;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        /* Accept a cached buffer up to 25% larger than needed */
+        auto it = idle_.lower_bound(capacity);
+        if (it != idle_.end() && it->first <= capacity + capacity / 4) {
+            PlaneBuffer buffer(this, it->second, it->first);
+            idle_bytes_ -= it->first;
+            idle_.erase(it);
+            return buffer;
+        }
+    }
+
+    return PlaneBuffer(this, allocate(capacity), capacity);
+}
+
+void PlanePool::release(void *data, size_t capacity)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        /* Make room by dropping the largest idle buffers first */
+        while (!idle_.empty() && idle_bytes_ + capacity > max_idle_bytes_) {
+            auto largest = std::prev(idle_.end());
+            idle_bytes_ -= largest->first;
+            deallocate(largest->second);
+            idle_.erase(largest);
+        }
+
+        if (capacity <= max_idle_bytes_) {
+            idle_.emplace(capacity, data);
+            idle_bytes_ += capacity;
+            return;
+        }
+    }
+
+    deallocate(data);
+}
+
+void *PlanePool::allocate(size_t capacity)
+{
+#ifdef _WIN32
+    void *data = _aligned_malloc(capacity, bucket_size);
+    if (!data)
+        throw std::bad_alloc();
+#else
+    void *data = nullptr;
+    if (posix_memalign(&data, bucket_size, capacity) != 0)
+        throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+    if (huge_pages_)
+        madvise(data, capacity, MADV_HUGEPAGE);
+#endif
+#endif
+
+    return data;
+}
+
+void PlanePool::deallocate(void *data)
+{
+#ifdef _WIN32
+    _aligned_free(data);
+#else
+    free(data);
+#endif
+}
+
+PlanePool &default_plane_pool()
+{
+    static PlanePool pool;
+    return pool;
+}
@@ -0,0 +1,94 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * Size-bucketed pool that recycles image plane buffers between conversions
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#ifndef HEIF2JPG_PLANE_POOL_H
+#define HEIF2JPG_PLANE_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <utility>
+
+class PlanePool;
+
+/*
+ * A block of plane memory that goes back to its pool when it's released. A
+ * buffer made with a null pool only borrows memory owned by someone else and
+ * does nothing on release.
+ */
+class PlaneBuffer
+{
+public:
+    PlaneBuffer() = default;
+    PlaneBuffer(PlanePool *pool, void *data, size_t capacity)
+        : pool_(pool), data_(data), capacity_(capacity) {}
+    ~PlaneBuffer() { reset(); }
+
+    PlaneBuffer(PlaneBuffer &&other) noexcept { *this = std::move(other); }
+    PlaneBuffer &operator=(PlaneBuffer &&other) noexcept;
+
+    PlaneBuffer(const PlaneBuffer &) = delete;
+    PlaneBuffer &operator=(const PlaneBuffer &) = delete;
+
+    uint16_t *get() const { return static_cast<uint16_t *>(data_); }
+    size_t capacity() const { return capacity_; }
+    void reset();
+
+private:
+    PlanePool *pool_ = nullptr;
+    void *data_ = nullptr;
+    size_t capacity_ = 0;
+};
+
+/*
+ * Buffers are rounded up to a 2MB bucket, so every image with the same
+ * dimensions lands in the same bucket and gets memory back that is already
+ * faulted in. Idle buffers are kept up to max_idle_bytes; past that, released
+ * buffers are freed instead.
+ *
+ * Thread-safe: the pipeline packs into a buffer on one thread and releases it
+ * on another.
+ */
+class PlanePool
+{
+public:
+    explicit PlanePool(size_t max_idle_bytes = (size_t)1 << 30)
+        : max_idle_bytes_(max_idle_bytes) {}
+    ~PlanePool();
+
+    PlanePool(const PlanePool &) = delete;
+    PlanePool &operator=(const PlanePool &) = delete;
+
+    /* Returns an uninitialized buffer of at least size bytes */
+    PlaneBuffer acquire(size_t size);
+
+    /*
+     * Ask for transparent huge pages on new buffers (Linux only). Must be set
+     * before the first acquire().
+     */
+    void set_huge_pages(bool huge_pages) { huge_pages_ = huge_pages; }
+    void set_max_idle_bytes(size_t max_idle_bytes) { max_idle_bytes_ = max_idle_bytes; }
+
+private:
+    friend class PlaneBuffer;
+
+    void release(void *data, size_t capacity);
+    void *allocate(size_t capacity);
+    static void deallocate(void *data);
+
+    std::mutex mutex_;
+    std::multimap<size_t, void *> idle_;
+    size_t idle_bytes_ = 0;
+    size_t max_idle_bytes_;
+    bool huge_pages_ = false;
+};
+
+/* Pool used by P010Image and other plane buffers */
+PlanePool &default_plane_pool();
+
+#endif /* HEIF2JPG_PLANE_POOL_H */
@@ -0,0 +1,74 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * Read-ahead of batch input files while earlier ones decode
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#include <algorithm>
+
+#include "prefetch.h"
+#include "trace.h"
+
+InputPrefetcher::InputPrefetcher(std::vector<std::string> filenames, size_t depth,
+                                 unsigned int threads)
+    : filenames_(std::move(filenames)), files_(filenames_.size()), depth_(std::max<size_t>(1, depth))
+{
+    threads = std::min<size_t>(std::max(1u, threads), std::min(depth_, filenames_.size()));
+    for (unsigned int i = 0; i < threads; i++)
+        threads_.emplace_back(&InputPrefetcher::read_files, this);
+}
+
+InputPrefetcher::~InputPrefetcher()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    can_read_.notify_all();
+
+    for (auto &thread : threads_)
+        thread.join();
+}
+
+void InputPrefetcher::read_files()
+{
+    trace_thread_name("prefetch");
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    for (;;) {
+        /* Stay no more than depth files past the furthest one taken */
+        can_read_.wait(lock, [this] {
+            return stopping_ || next_read_ >= files_.size() || next_read_ < taken_end_ + depth_;
+        });
+        if (stopping_ || next_read_ >= files_.size())
+            return;
+
+        size_t i = next_read_++;
+        lock.unlock();
+
+        /* Files opened elsewhere have no name and are skipped */
+        auto file = std::make_shared<MappedInputFile>();
+        int ret = filenames_[i].empty() ? 0 : file->load(filenames_[i]);
+
+        lock.lock();
+        files_[i].file = ret ? nullptr : std::move(file);
+        files_[i].ret = ret;
+        files_[i].done = true;
+        read_done_.notify_all();
+    }
+}
+
+std::shared_ptr<MappedInputFile> InputPrefetcher::take(size_t i, int &ret)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    if (i + 1 > taken_end_) {
+        taken_end_ = i + 1;
+        can_read_.notify_all();
+    }
+    read_done_.wait(lock, [this, i] { return files_[i].done; });
+
+    ret = files_[i].ret;
+    return std::move(files_[i].file);
+}
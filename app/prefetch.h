@@ -0,0 +1,69 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * Read-ahead of batch input files while earlier ones decode
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#ifndef HEIF2JPG_PREFETCH_H
+#define HEIF2JPG_PREFETCH_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "input_file.h"
+
+/*
+ * Reads files on threads of its own, at most depth of them ahead of the
+ * last one taken, so open and read latency on network storage overlaps the
+ * decoding of files already read. Each file is read into memory once and
+ * handed over whole.
+ */
+class InputPrefetcher
+{
+public:
+    /*
+     * Starts reading filenames in order on up to threads threads; empty
+     * names are placeholders that are never read or taken
+     */
+    InputPrefetcher(std::vector<std::string> filenames, size_t depth, unsigned int threads);
+    ~InputPrefetcher();
+
+    InputPrefetcher(const InputPrefetcher &) = delete;
+    InputPrefetcher &operator=(const InputPrefetcher &) = delete;
+
+    /*
+     * Waits for file i to be read and hands it over, or returns nullptr with
+     * ret set to open()'s error. Each file can only be taken once; taking
+     * them roughly in order keeps the readers busy on the right ones.
+     */
+    std::shared_ptr<MappedInputFile> take(size_t i, int &ret);
+
+private:
+    struct prefetched {
+        std::shared_ptr<MappedInputFile> file;
+        int ret = 0;
+        bool done = false;
+    };
+
+    void read_files();
+
+    std::vector<std::string> filenames_;
+    std::vector<struct prefetched> files_;
+    size_t depth_;
+    /* Next file to read, and one past the furthest file taken */
+    size_t next_read_ = 0;
+    size_t taken_end_ = 0;
+    bool stopping_ = false;
+
+    std::mutex mutex_;
+    std::condition_variable can_read_, read_done_;
+    std::vector<std::thread> threads_;
+};
+
+#endif /* HEIF2JPG_PREFETCH_H */
@@ -0,0 +1,180 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * Probe mode: report what's in HEIF files as JSON, from the container boxes
+ * alone, without decoding anything
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "convert.h"
+#include "log.h"
+#include "probe.h"
+#include "stats.h"
+
+static const char *nclx_primaries_name(enum heif_color_primaries primaries)
+{
+    switch (primaries) {
+    case heif_color_primaries_ITU_R_BT_709_5:
+        return "bt709";
+    case heif_color_primaries_SMPTE_EG_432_1:
+        return "display-p3";
+    case heif_color_primaries_SMPTE_RP_431_2:
+        return "dci-p3";
+    case heif_color_primaries_ITU_R_BT_2020_2_and_2100_0:
+        return "bt2020";
+    default:
+        return "unknown";
+    }
+}
+
+static const char *nclx_transfer_name(enum heif_transfer_characteristics transfer)
+{
+    switch (transfer) {
+    case heif_transfer_characteristic_ITU_R_BT_709_5:
+    case heif_transfer_characteristic_ITU_R_BT_601_6:
+    case heif_transfer_characteristic_ITU_R_BT_2020_2_10bit:
+    case heif_transfer_characteristic_ITU_R_BT_2020_2_12bit:
+        return "bt709";
+    case heif_transfer_characteristic_IEC_61966_2_1:
+        return "srgb";
+    case heif_transfer_characteristic_linear:
+        return "linear";
+    case heif_transfer_characteristic_ITU_R_BT_2100_0_PQ:
+        return "pq";
+    case heif_transfer_characteristic_ITU_R_BT_2100_0_HLG:
+        return "hlg";
+    default:
+        return "unknown";
+    }
+}
+
+/* One image's entry in a file's "images" array */
+static std::string probe_image_json(struct heif_image_handle *handle)
+{
+    heif_colorspace colorspace = heif_colorspace_undefined;
+    heif_chroma chroma = heif_chroma_undefined;
+    heif_image_handle_get_preferred_decoding_colorspace(handle, &colorspace, &chroma);
+
+    int columns = 1, rows = 1;
+    struct heif_image_tiling tiling;
+    if (!heif_image_handle_get_image_tiling(handle, 1, &tiling).code) {
+        columns = tiling.num_columns;
+        rows = tiling.num_rows;
+    }
+
+    const char *primaries = "unknown";
+    const char *transfer = "unknown";
+    bool full_range = false;
+    struct heif_color_profile_nclx *nclx = nullptr;
+    if (!heif_image_handle_get_nclx_color_profile(handle, &nclx).code && nclx) {
+        primaries = nclx_primaries_name(nclx->color_primaries);
+        transfer = nclx_transfer_name(nclx->transfer_characteristics);
+        full_range = nclx->full_range_flag;
+        heif_nclx_color_profile_free(nclx);
+    }
+    bool hdr = strcmp(transfer, "pq") == 0 || strcmp(transfer, "hlg") == 0;
+
+    char json[512];
+    snprintf(json, sizeof(json),
+             "{\"id\": %u, \"primary\": %s, \"width\": %d, \"height\": %d, \"bit_depth\": %d, "
+             "\"chroma_bit_depth\": %d, \"chroma\": \"%s\", \"alpha\": %s, \"tile_columns\": %d, "
+             "\"tile_rows\": %d, \"thumbnails\": %d, \"primaries\": \"%s\", "
+             "\"transfer\": \"%s\", \"full_range\": %s, \"hdr\": %s}",
+             (unsigned int)heif_image_handle_get_item_id(handle),
+             heif_image_handle_is_primary_image(handle) ? "true" : "false",
+             heif_image_handle_get_width(handle), heif_image_handle_get_height(handle),
+             heif_image_handle_get_luma_bits_per_pixel(handle),
+             heif_image_handle_get_chroma_bits_per_pixel(handle), heif_chroma_name(chroma),
+             heif_image_handle_has_alpha_channel(handle) ? "true" : "false", columns, rows,
+             heif_image_handle_get_number_of_thumbnails(handle), primaries, transfer,
+             full_range ? "true" : "false", hdr ? "true" : "false");
+
+    return json;
+}
+
+/* The record for one file, without a trailing newline; ret gets the exit code */
+static std::string probe_file(const std::string &input_filename, int &ret)
+{
+    ErrorCapture errors;
+    std::vector<heif_item_id> image_ids;
+    HeifContextPtr ctx;
+
+    /* Only the boxes are parsed, so the image data is never read */
+    auto input = std::make_shared<MappedInputFile>();
+    ret = input->open(input_filename, false);
+    if (!ret)
+        ret = open_heif_file(input_filename, input, ctx, image_ids, nullptr);
+
+    std::string json = "{\"input\": " + json_string(input_filename);
+    if (ret)
+        return json + ", \"error\": " + std::to_string(ret) + ", \"message\": " +
+               json_string(errors.text()) + "}";
+
+    json += ", \"bytes\": " + std::to_string(input->size()) +
+            ", \"image_count\": " + std::to_string(image_ids.size()) + ", \"images\": [";
+    for (size_t i = 0; i < image_ids.size(); i++) {
+        struct heif_image_handle *handle;
+        if (heif_context_get_image_handle(ctx.get(), image_ids[i], &handle).code)
+            continue;
+
+        json += (json.back() == '[' ? "" : ", ") + probe_image_json(handle);
+        heif_image_handle_release(handle);
+    }
+
+    return json + "]}";
+}
+
+int run_probe(const std::vector<std::string> &inputs, unsigned int num_workers)
+{
+    if (!num_workers)
+        num_workers = std::max(1u, std::thread::hardware_concurrency());
+    num_workers = std::min<size_t>(num_workers, std::max<size_t>(inputs.size(), 1));
+
+    std::atomic<size_t> next_input{0};
+    std::mutex print_mutex;
+    /* Records finished out of order wait here until the ones before them print */
+    std::vector<std::string> records(inputs.size());
+    std::vector<bool> finished(inputs.size());
+    std::vector<int> codes(inputs.size());
+    size_t next_print = 0;
+    int ret = 0;
+
+    auto worker = [&]() {
+        size_t i;
+        while ((i = next_input++) < inputs.size()) {
+            int file_ret;
+            std::string record = probe_file(inputs[i], file_ret);
+
+            std::lock_guard<std::mutex> lock(print_mutex);
+            records[i] = std::move(record);
+            codes[i] = file_ret;
+            finished[i] = true;
+            for (; next_print < inputs.size() && finished[next_print]; next_print++) {
+                records[next_print] += '\n';
+                fwrite(records[next_print].data(), 1, records[next_print].size(), stdout);
+                std::string().swap(records[next_print]);
+                if (codes[next_print])
+                    ret = codes[next_print];
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < num_workers; i++)
+        threads.emplace_back(worker);
+    worker();
+    for (auto &thread : threads)
+        thread.join();
+
+    fflush(stdout);
+
+    return ret;
+}
@@ -0,0 +1,30 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * Probe mode: report what's in HEIF files as JSON, from the container boxes
+ * alone, without decoding anything
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#ifndef HEIF2JPG_PROBE_H
+#define HEIF2JPG_PROBE_H
+
+#include <string>
+#include <vector>
+
+/*
+ * Prints one line of JSON per input to stdout, in the order given: its
+ * size and, for each top-level image, the dimensions, bit depth, chroma,
+ * grid layout, thumbnail count and nclx color description, or the error
+ * that kept the file from being parsed.
+ *
+ * Only the header boxes are read; the files are mapped, so their image data
+ * is never paged in. num_workers files are probed at once, 0 meaning one
+ * per hardware thread.
+ *
+ * Returns 0 if every file could be parsed, or the exit code of the last
+ * failure.
+ */
+int run_probe(const std::vector<std::string> &inputs, unsigned int num_workers);
+
+#endif /* HEIF2JPG_PROBE_H */
@@ -0,0 +1,428 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * Plain (SDR) jpeg encoding of 8-bit images with libjpeg-turbo
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <csetjmp>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+/* jpeglib.h needs size_t and FILE declared first */
+#include <jpeglib.h>
+
+#include "log.h"
+#include "sdr_jpeg.h"
+
+struct sdr_jpeg_state {
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    struct jpeg_destination_mgr dest;
+    jmp_buf jump;
+    bool created = false;
+    /* Grows to the largest image encoded so far and stays that size */
+    std::vector<uint8_t> buffer;
+    size_t size = 0;
+};
+
+static struct sdr_jpeg_state *get_state(j_common_ptr cinfo)
+{
+    return static_cast<struct sdr_jpeg_state *>(cinfo->client_data);
+}
+
+/* libjpeg's default exits the process; jump back to the encode instead */
+static void error_exit(j_common_ptr cinfo)
+{
+    char message[JMSG_LENGTH_MAX];
+
+    (*cinfo->err->format_message)(cinfo, message);
+    error_out() << "libjpeg: " << message << std::endl;
+    longjmp(get_state(cinfo)->jump, 1);
+}
+
+static void init_destination(j_compress_ptr cinfo)
+{
+    struct sdr_jpeg_state *state = get_state((j_common_ptr)cinfo);
+
+    cinfo->dest->next_output_byte = state->buffer.data();
+    cinfo->dest->free_in_buffer = state->buffer.size();
+}
+
+static boolean empty_output_buffer(j_compress_ptr cinfo)
+{
+    struct sdr_jpeg_state *state = get_state((j_common_ptr)cinfo);
+    size_t used = state->buffer.size();
+
+    state->buffer.resize(2 * used);
+    cinfo->dest->next_output_byte = state->buffer.data() + used;
+    cinfo->dest->free_in_buffer = state->buffer.size() - used;
+
+    return TRUE;
+}
+
+static void term_destination(j_compress_ptr cinfo)
+{
+    struct sdr_jpeg_state *state = get_state((j_common_ptr)cinfo);
+
+    state->size = state->buffer.size() - cinfo->dest->free_in_buffer;
+}
+
+SdrJpegEncoder::SdrJpegEncoder()
+    : state_(std::make_unique<struct sdr_jpeg_state>())
+{
+    struct jpeg_compress_struct &cinfo = state_->cinfo;
+
+    cinfo.err = jpeg_std_error(&state_->jerr);
+    state_->jerr.error_exit = error_exit;
+    cinfo.client_data = state_.get();
+
+    if (setjmp(state_->jump))
+        return;
+    jpeg_create_compress(&cinfo);
+    state_->created = true;
+
+    state_->dest.init_destination = init_destination;
+    state_->dest.empty_output_buffer = empty_output_buffer;
+    state_->dest.term_destination = term_destination;
+    cinfo.dest = &state_->dest;
+}
+
+SdrJpegEncoder::~SdrJpegEncoder()
+{
+    if (state_->created)
+        jpeg_destroy_compress(&state_->cinfo);
+}
+
+const uint8_t *SdrJpegEncoder::data() const
+{
+    return state_->buffer.data();
+}
+
+size_t SdrJpegEncoder::size() const
+{
+    return state_->size;
+}
+
+/* Copies n samples and repeats the last one out to padded */
+static void pad_row(const uint8_t *src, uint8_t *dst, int n, int padded)
+{
+    memcpy(dst, src, n);
+    memset(dst + n, src[n - 1], padded - n);
+}
+
+/* As pad_row, from resampled rows in 10-bit units */
+static void quantize_row(const float *src, uint8_t *dst, int n, int padded)
+{
+    for (int i = 0; i < n; i++)
+        dst[i] = (uint8_t)std::clamp((int)(src[i] * 0.25f + 0.5f), 0, 255);
+    memset(dst + n, dst[n - 1], padded - n);
+}
+
+/*
+ * How an image's samples relate to the full range BT.601 YCbCr that JFIF
+ * expects, from its nclx profile. Images without one are taken to match.
+ * If make_icc is set, icc is also filled with a profile for the nclx
+ * primaries, unless they're BT.709 like the sRGB a jpeg is assumed to be.
+ */
+struct sdr_color {
+    bool full_range = true;
+    bool bt601 = true;
+    /* Matrix coefficients; only used when bt601 is false */
+    float kr = 0.299f, kb = 0.114f;
+};
+
+static struct sdr_color get_sdr_color(const heif_image *image, bool make_icc,
+                                      std::vector<uint8_t> &icc)
+{
+    struct sdr_color color;
+    struct heif_color_profile_nclx *nclx = nullptr;
+    icc.clear();
+    struct heif_error err = heif_image_get_nclx_color_profile(image, &nclx);
+    if (err.code || !nclx)
+        return color;
+
+    if (make_icc)
+        make_nclx_icc_profile(nclx, icc);
+
+    color.full_range = nclx->full_range_flag;
+
+    /* Like libheif, matrices without fixed coefficients are taken as BT.601 */
+    switch (nclx->matrix_coefficients) {
+    case heif_matrix_coefficients_ITU_R_BT_709_5:
+        color = {color.full_range, false, 0.2126f, 0.0722f};
+        break;
+    case heif_matrix_coefficients_US_FCC_T47:
+        color = {color.full_range, false, 0.30f, 0.11f};
+        break;
+    case heif_matrix_coefficients_SMPTE_240M:
+        color = {color.full_range, false, 0.212f, 0.087f};
+        break;
+    case heif_matrix_coefficients_ITU_R_BT_2020_2_non_constant_luminance:
+    case heif_matrix_coefficients_ITU_R_BT_2020_2_constant_luminance:
+        color = {color.full_range, false, 0.2627f, 0.0593f};
+        break;
+    default:
+        break;
+    }
+
+    heif_nclx_color_profile_free(nclx);
+    return color;
+}
+
+/* Expands limited range samples to full range in place */
+static void expand_row(uint8_t *row, int n, const uint8_t *lut)
+{
+    for (int i = 0; i < n; i++)
+        row[i] = lut[row[i]];
+}
+
+/*
+ * Converts a row to interleaved RGB with color's matrix and range. Chroma is
+ * at 1 / h_samp of the luma width and each sample covers h_samp pixels.
+ */
+static void ycbcr_to_rgb_row(const uint8_t *y, const uint8_t *cb, const uint8_t *cr,
+                             uint8_t *rgb, int n, int h_samp, const struct sdr_color &color)
+{
+    float kg = 1.0f - color.kr - color.kb;
+    float y_scale = color.full_range ? 1.0f : 255.0f / 219.0f;
+    float c_scale = color.full_range ? 1.0f : 255.0f / 224.0f;
+    float y_offset = color.full_range ? 0.0f : 16.0f;
+    float cr_r = 2.0f * (1.0f - color.kr) * c_scale;
+    float cb_b = 2.0f * (1.0f - color.kb) * c_scale;
+    float cb_g = -color.kb * cb_b / kg;
+    float cr_g = -color.kr * cr_r / kg;
+
+    for (int i = 0; i < n; i++) {
+        float luma = (y[i] - y_offset) * y_scale + 0.5f;
+        float u = cb[i / h_samp] - 128.0f;
+        float v = cr[i / h_samp] - 128.0f;
+
+        rgb[3 * i] = (uint8_t)std::clamp((int)(luma + cr_r * v), 0, 255);
+        rgb[3 * i + 1] = (uint8_t)std::clamp((int)(luma + cb_g * u + cr_g * v), 0, 255);
+        rgb[3 * i + 2] = (uint8_t)std::clamp((int)(luma + cb_b * u), 0, 255);
+    }
+}
+
+int SdrJpegEncoder::encode(const heif_image *image, int width, int height, int quality,
+                           enum heif2jpg_resize_filter filter,
+                           const struct heif2jpg_image_metadata *metadata)
+{
+    struct jpeg_compress_struct &cinfo = state_->cinfo;
+    if (!state_->created) {
+        error_out() << "libjpeg: could not create compressor" << std::endl;
+        return 12;
+    }
+
+    size_t y_stride, cb_stride, cr_stride;
+    const uint8_t *yp = heif_image_get_plane_readonly2(image, heif_channel_Y, &y_stride);
+    const uint8_t *cbp = heif_image_get_plane_readonly2(image, heif_channel_Cb, &cb_stride);
+    const uint8_t *crp = heif_image_get_plane_readonly2(image, heif_channel_Cr, &cr_stride);
+    int src_width = heif_image_get_width(image, heif_channel_Y);
+    int src_height = heif_image_get_height(image, heif_channel_Y);
+    int src_chroma_width = heif_image_get_width(image, heif_channel_Cb);
+    int src_chroma_height = heif_image_get_height(image, heif_channel_Cb);
+    if (!yp || !cbp || !crp) {
+        error_out() << "Only YCbCr images can be written as plain jpegs" << std::endl;
+        return 12;
+    }
+
+    /* Chroma keeps the decoded subsampling, so it's never resampled at full size */
+    enum heif_chroma chroma = heif_image_get_chroma_format(image);
+    int h_samp = chroma == heif_chroma_444 ? 1 : 2;
+    int v_samp = chroma == heif_chroma_420 ? 2 : 1;
+    int chroma_width = (width + h_samp - 1) / h_samp;
+    int chroma_height = (height + v_samp - 1) / v_samp;
+    /* Luma rows per MCU row; there are always 8 of each chroma */
+    int mcu_rows = 8 * v_samp;
+
+    /*
+     * libjpeg-turbo reads whole 8x8 blocks, so rows need samples out to the
+     * next multiple of 8; rows past the bottom just repeat the last one.
+     */
+    int y_padded = (width + 7) / 8 * 8;
+    int c_padded = (chroma_width + 7) / 8 * 8;
+    bool scaled = width != src_width || height != src_height;
+
+    /*
+     * Full range BT.601 planes go to libjpeg-turbo as they are. Limited range
+     * BT.601 ones are just expanded, but other matrices need every pixel
+     * converted, so those are handed over as RGB for libjpeg-turbo to convert
+     * and downsample itself.
+     */
+    bool have_icc = metadata && !metadata->icc.empty();
+    struct sdr_color color = get_sdr_color(image, !have_icc, icc_);
+    bool raw = color.bt601;
+    bool expand = raw && !color.full_range;
+    bool y_direct = !scaled && !expand && y_padded == width;
+    bool c_direct = !scaled && !expand && c_padded == chroma_width;
+
+    if (expand) {
+        for (int i = 0; i < 256; i++) {
+            y_lut_[i] = (uint8_t)std::clamp((int)std::lround((i - 16) * 255.0 / 219.0), 0, 255);
+            c_lut_[i] = (uint8_t)std::clamp((int)std::lround((i - 128) * 255.0 / 224.0) + 128,
+                                            0, 255);
+        }
+    }
+
+    std::unique_ptr<PlaneResampler> y_resampler, cb_resampler, cr_resampler;
+    if (scaled) {
+        y_resampler = std::make_unique<PlaneResampler>(yp, y_stride, src_width, src_height, 8,
+                                                       width, height, filter);
+        cb_resampler = std::make_unique<PlaneResampler>(cbp, cb_stride, src_chroma_width,
+                                                        src_chroma_height, 8, chroma_width,
+                                                        chroma_height, filter);
+        cr_resampler = std::make_unique<PlaneResampler>(crp, cr_stride, src_chroma_width,
+                                                        src_chroma_height, 8, chroma_width,
+                                                        chroma_height, filter);
+    }
+    y_strip_.resize((size_t)16 * y_padded);
+    cb_strip_.resize((size_t)8 * c_padded);
+    cr_strip_.resize((size_t)8 * c_padded);
+    if (!raw)
+        rgb_row_.resize((size_t)3 * width);
+
+    /* Start at about a byte per pixel so most images never grow the buffer */
+    if (state_->buffer.size() < (size_t)width * height)
+        state_->buffer.resize(std::max<size_t>((size_t)width * height, 4096));
+
+    /* Nothing with a destructor may be created past this point */
+    if (setjmp(state_->jump)) {
+        jpeg_abort_compress(&cinfo);
+        return 12;
+    }
+
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = raw ? JCS_YCbCr : JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_colorspace(&cinfo, JCS_YCbCr);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+
+    cinfo.raw_data_in = raw ? TRUE : FALSE;
+#if JPEG_LIB_VERSION >= 70
+    cinfo.do_fancy_downsampling = raw ? FALSE : TRUE;
+#endif
+    cinfo.comp_info[0].h_samp_factor = h_samp;
+    cinfo.comp_info[0].v_samp_factor = v_samp;
+    cinfo.comp_info[1].h_samp_factor = 1;
+    cinfo.comp_info[1].v_samp_factor = 1;
+    cinfo.comp_info[2].h_samp_factor = 1;
+    cinfo.comp_info[2].v_samp_factor = 1;
+
+    jpeg_start_compress(&cinfo, TRUE);
+
+    if (metadata) {
+        if (!metadata->exif.empty())
+            jpeg_write_marker(&cinfo, JPEG_APP0 + 1, metadata->exif.data(),
+                              (unsigned int)metadata->exif.size());
+        if (!metadata->xmp.empty())
+            jpeg_write_marker(&cinfo, JPEG_APP0 + 1, metadata->xmp.data(),
+                              (unsigned int)metadata->xmp.size());
+        if (!metadata->icc.empty())
+            jpeg_write_icc_profile(&cinfo, metadata->icc.data(),
+                                   (unsigned int)metadata->icc.size());
+    }
+    if (!icc_.empty())
+        jpeg_write_icc_profile(&cinfo, icc_.data(), (unsigned int)icc_.size());
+
+    if (!raw) {
+        /* One row at a time; chroma rows are reused for v_samp luma rows */
+        const uint8_t *cb_row = nullptr, *cr_row = nullptr;
+        int chroma_row = -1;
+
+        for (int sy = 0; sy < height; sy++) {
+            const uint8_t *y_row = yp + sy * y_stride;
+            if (scaled) {
+                quantize_row(y_resampler->row(sy), y_strip_.data(), width, width);
+                y_row = y_strip_.data();
+            }
+
+            if (sy / v_samp != chroma_row) {
+                chroma_row = sy / v_samp;
+                if (scaled) {
+                    quantize_row(cb_resampler->row(chroma_row), cb_strip_.data(), chroma_width,
+                                 chroma_width);
+                    quantize_row(cr_resampler->row(chroma_row), cr_strip_.data(), chroma_width,
+                                 chroma_width);
+                    cb_row = cb_strip_.data();
+                    cr_row = cr_strip_.data();
+                } else {
+                    cb_row = cbp + chroma_row * cb_stride;
+                    cr_row = crp + chroma_row * cr_stride;
+                }
+            }
+
+            ycbcr_to_rgb_row(y_row, cb_row, cr_row, rgb_row_.data(), width, h_samp, color);
+            JSAMPROW rgb_row = rgb_row_.data();
+            jpeg_write_scanlines(&cinfo, &rgb_row, 1);
+        }
+
+        jpeg_finish_compress(&cinfo);
+
+        return 0;
+    }
+
+    /* One MCU row at a time: up to 16 luma rows and 8 of each chroma */
+    JSAMPROW y_rows[16], cb_rows[8], cr_rows[8];
+    JSAMPARRAY planes[3] = {y_rows, cb_rows, cr_rows};
+
+    for (int row = 0; row < height; row += mcu_rows) {
+        for (int k = 0; k < mcu_rows; k++) {
+            int sy = row + k;
+            uint8_t *strip = y_strip_.data() + (size_t)k * y_padded;
+
+            if (sy >= height) {
+                y_rows[k] = y_rows[k - 1];
+            } else if (y_direct) {
+                y_rows[k] = const_cast<JSAMPROW>(yp + sy * y_stride);
+            } else {
+                y_rows[k] = strip;
+                if (scaled)
+                    quantize_row(y_resampler->row(sy), strip, width, y_padded);
+                else
+                    pad_row(yp + sy * y_stride, strip, width, y_padded);
+                if (expand)
+                    expand_row(strip, y_padded, y_lut_);
+            }
+        }
+
+        for (int k = 0; k < 8; k++) {
+            int sy = row / v_samp + k;
+            uint8_t *cb_strip = cb_strip_.data() + (size_t)k * c_padded;
+            uint8_t *cr_strip = cr_strip_.data() + (size_t)k * c_padded;
+
+            if (sy >= chroma_height) {
+                cb_rows[k] = cb_rows[k - 1];
+                cr_rows[k] = cr_rows[k - 1];
+            } else if (c_direct) {
+                cb_rows[k] = const_cast<JSAMPROW>(cbp + sy * cb_stride);
+                cr_rows[k] = const_cast<JSAMPROW>(crp + sy * cr_stride);
+            } else {
+                cb_rows[k] = cb_strip;
+                cr_rows[k] = cr_strip;
+                if (scaled) {
+                    quantize_row(cb_resampler->row(sy), cb_strip, chroma_width, c_padded);
+                    quantize_row(cr_resampler->row(sy), cr_strip, chroma_width, c_padded);
+                } else {
+                    pad_row(cbp + sy * cb_stride, cb_strip, chroma_width, c_padded);
+                    pad_row(crp + sy * cr_stride, cr_strip, chroma_width, c_padded);
+                }
+                if (expand) {
+                    expand_row(cb_strip, c_padded, c_lut_);
+                    expand_row(cr_strip, c_padded, c_lut_);
+                }
+            }
+        }
+
+        jpeg_write_raw_data(&cinfo, planes, mcu_rows);
+    }
+
+    jpeg_finish_compress(&cinfo);
+
+    return 0;
+}
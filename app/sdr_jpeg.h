@@ -0,0 +1,75 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * Plain (SDR) jpeg encoding of 8-bit images with libjpeg-turbo
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#ifndef HEIF2JPG_SDR_JPEG_H
+#define HEIF2JPG_SDR_JPEG_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <libheif/heif.h>
+#include <libheif/heif_image.h>
+
+#include "downscale.h"
+#include "metadata.h"
+
+struct sdr_jpeg_state;
+
+/*
+ * A libjpeg-turbo compressor and output buffer that are reused from one
+ * image to the next, so steady-state encodes don't allocate.
+ */
+class SdrJpegEncoder
+{
+public:
+    SdrJpegEncoder();
+    ~SdrJpegEncoder();
+
+    SdrJpegEncoder(const SdrJpegEncoder &) = delete;
+    SdrJpegEncoder &operator=(const SdrJpegEncoder &) = delete;
+
+    /*
+     * Encodes a decoded 8-bit YCbCr 4:2:0, 4:2:2 or 4:4:4 image as a
+     * baseline jpeg of width x height with the same chroma subsampling. The
+     * planes go to libjpeg-turbo as raw downsampled
+     * data, so there's no color conversion or 16-bit intermediate; they're
+     * only copied when a row needs edge padding, or resampled a strip at a
+     * time when the size differs from the image's.
+     *
+     * That's only when the image's nclx profile says it's full range BT.601
+     * like JFIF expects. Limited range BT.601 samples are expanded as rows
+     * are copied, and other matrices are converted to RGB a row at a time
+     * for libjpeg-turbo to convert back.
+     *
+     * metadata's EXIF, XMP and ICC are written after the JFIF header if it's
+     * given. Without an ICC profile from metadata, one is made from the nclx
+     * primaries if they aren't BT.709, so wide gamut images don't pass for
+     * sRGB. Returns 0, or 12 with an error printed. The result stays valid
+     * until the next encode.
+     */
+    int encode(const heif_image *image, int width, int height, int quality,
+               enum heif2jpg_resize_filter filter,
+               const struct heif2jpg_image_metadata *metadata = nullptr);
+
+    const uint8_t *data() const;
+    size_t size() const;
+
+private:
+    std::unique_ptr<struct sdr_jpeg_state> state_;
+    /* Rows handed to libjpeg-turbo when they can't come from the image itself */
+    std::vector<uint8_t> y_strip_, cb_strip_, cr_strip_;
+    /* A row of RGB, for images libjpeg-turbo has to color convert */
+    std::vector<uint8_t> rgb_row_;
+    /* ICC profile made from the image's nclx primaries, if it needs one */
+    std::vector<uint8_t> icc_;
+    /* Limited to full range expansion of luma and chroma samples */
+    uint8_t y_lut_[256] = {}, c_lut_[256] = {};
+};
+
+#endif /* HEIF2JPG_SDR_JPEG_H */
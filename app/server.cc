@@ -0,0 +1,530 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * Server mode: a long-running process that converts HEIF images sent over a
+ * Unix socket on a pool of warm workers
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#include <iostream>
+
+#include "server.h"
+
+#ifdef _WIN32
+int run_server(const struct heif2jpg_server_options &)
+{
+    std::cerr << "--serve is only supported on POSIX systems" << std::endl;
+    return 1;
+}
+#else
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "bounded_queue.h"
+#include "heif2jpg.h"
+#include "log.h"
+#include "memory_budget.h"
+#include "stats.h"
+
+/* Largest request line accepted */
+#define SERVER_MAX_LINE_BYTES 1024
+
+/* < 1 ms, < 2 ms, ... < 2^(LATENCY_BUCKETS - 2) ms, and anything slower */
+#define LATENCY_BUCKETS 18
+
+class LatencyHistogram
+{
+public:
+    void add(double ms)
+    {
+        int bucket = 0;
+        while (bucket < LATENCY_BUCKETS - 1 && ms >= (double)(1u << bucket))
+            bucket++;
+        counts_[bucket]++;
+    }
+
+    std::string json() const
+    {
+        std::string out = "[";
+        for (int i = 0; i < LATENCY_BUCKETS; i++)
+            out += (i ? ", " : "") + std::to_string(counts_[i].load());
+        return out + "]";
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, LATENCY_BUCKETS> counts_{};
+};
+
+struct server_result {
+    struct heif2jpg_error error;
+    std::vector<uint8_t> jpeg;
+};
+
+/* One CONVERT request, from the connection that read it to a worker and back */
+struct ServerJob {
+    /* The HEIF file, parsed in place by the converter */
+    std::vector<uint8_t> body;
+    struct heif2jpg_encode_options encode_options;
+    std::chrono::steady_clock::time_point queued;
+    std::promise<struct server_result> result;
+};
+
+struct server_state {
+    explicit server_state(const struct heif2jpg_server_options &options)
+        : options(options), queue(options.queue_depth) {}
+
+    const struct heif2jpg_server_options &options;
+    unsigned int num_workers = 0;
+    std::unique_ptr<ConversionCache> cache;
+    BoundedQueue<std::unique_ptr<ServerJob>> queue;
+    /* Bytes of request bodies in memory, from being read until converted */
+    std::unique_ptr<MemoryBudget> body_budget;
+
+    std::atomic<size_t> queued{0};
+    std::atomic<size_t> converting{0};
+    std::atomic<uint64_t> completed{0};
+    std::atomic<uint64_t> failed{0};
+    LatencyHistogram queue_latency, convert_latency, total_latency;
+
+    /* Open connections, so shutdown can wake the ones waiting on a client */
+    std::mutex connections_mutex;
+    std::condition_variable connections_done;
+    std::set<int> connections;
+};
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void request_stop(int)
+{
+    stop_requested = 1;
+}
+
+using Deadline = std::chrono::steady_clock::time_point;
+
+/* False at end of stream, on an error, or if it's still incomplete at deadline */
+static bool read_full(int fd, void *data, size_t size, Deadline deadline)
+{
+    uint8_t *p = static_cast<uint8_t *>(data);
+
+    while (size) {
+        auto left = std::chrono::ceil<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now()).count();
+        if (left <= 0)
+            return false;
+
+        struct pollfd pfd = {fd, POLLIN, 0};
+        int ready = ::poll(&pfd, 1, (int)std::min<int64_t>(left, INT_MAX));
+        if (ready < 0 && errno == EINTR)
+            continue;
+        if (ready <= 0)
+            return false;
+
+        ssize_t n = ::read(fd, p, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+
+    return true;
+}
+
+static bool write_full(int fd, const void *data, size_t size)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+
+    while (size) {
+        ssize_t n = ::write(fd, p, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+
+    return true;
+}
+
+/*
+ * Reads up to a newline, a byte at a time so nothing of the body after it is
+ * consumed; request lines are short. False at end of stream or if too long.
+ */
+static bool read_line(int fd, std::string &line, Deadline deadline)
+{
+    line.clear();
+
+    char c;
+    while (read_full(fd, &c, 1, deadline)) {
+        if (c == '\n')
+            return true;
+        if (line.size() >= SERVER_MAX_LINE_BYTES)
+            return false;
+        line += c;
+    }
+
+    return false;
+}
+
+static bool send_ok(int fd, const void *data, size_t size)
+{
+    std::string header = "OK " + std::to_string(size) + "\n";
+    return write_full(fd, header.data(), header.size()) && write_full(fd, data, size);
+}
+
+static bool send_error(int fd, int code, const std::string &message)
+{
+    std::string line = "ERROR " + std::to_string(code) + " " + message + "\n";
+    return write_full(fd, line.data(), line.size());
+}
+
+/* Error messages are sent on the response line, so only the first line fits */
+static std::string first_line(const std::string &message)
+{
+    return message.substr(0, message.find('\n'));
+}
+
+static bool parse_number(const std::string &value, size_t max, size_t &out)
+{
+    auto end = value.data() + value.size();
+    auto [p, ec] = std::from_chars(value.data(), end, out);
+    return ec == std::errc() && p == end && out <= max;
+}
+
+/* Applies a CONVERT line's fields; returns false with error set for a bad one */
+static bool parse_convert_fields(std::istringstream &words,
+                                 struct heif2jpg_encode_options &encode_options,
+                                 size_t max_body_bytes, size_t &body_size, std::string &error)
+{
+    bool have_size = false;
+    std::string word;
+
+    while (words >> word) {
+        size_t eq = word.find('=');
+        std::string key = word.substr(0, eq);
+        std::string value = eq == std::string::npos ? "" : word.substr(eq + 1);
+        size_t n;
+
+        if (key == "size" && parse_number(value, SIZE_MAX, n)) {
+            if (n > max_body_bytes) {
+                error = "body larger than " + std::to_string(max_body_bytes) + " bytes";
+                return false;
+            }
+            body_size = n;
+            have_size = true;
+        } else if (key == "quality" && parse_number(value, 100, n)) {
+            encode_options.quality = (uint8_t)n;
+        } else if (key == "width" && parse_number(value, UINT16_MAX, n)) {
+            encode_options.new_width = (uint16_t)n;
+        } else if (key == "gamut" && parse_number(value, 2, n)) {
+            encode_options.color_gamut = (uhdr_color_gamut_t)n;
+            encode_options.color_from_file = false;
+        } else if (key == "range" && parse_number(value, 1, n)) {
+            encode_options.color_range = (uhdr_color_range_t)n;
+            encode_options.color_from_file = false;
+        } else if (key == "transfer" && parse_number(value, 3, n)) {
+            encode_options.color_transfer = (uhdr_color_transfer_t)n;
+            encode_options.color_from_file = false;
+        } else if (key == "metadata" && parse_number(value, 1, n)) {
+            encode_options.copy_metadata = n != 0;
+        } else if (key == "upconvert" && parse_number(value, 1, n)) {
+            encode_options.upconvert_8bit = n != 0;
+        } else if (key == "gainmap_quality" && parse_number(value, 100, n)) {
+            encode_options.gainmap_quality = (uint8_t)n;
+        } else if (key == "gainmap_scale" && parse_number(value, 128, n) && n) {
+            encode_options.gainmap_scale = (uint8_t)n;
+        } else if (key == "filter" && parse_resize_filter(value, encode_options.resize_filter)) {
+            continue;
+        } else if (key == "preset" && parse_encode_preset(value, encode_options)) {
+            continue;
+        } else {
+            error = "bad field " + word;
+            return false;
+        }
+    }
+
+    if (!have_size)
+        error = "missing size";
+
+    return have_size;
+}
+
+/* A worker thread; its encoders are created once and reused for every request */
+static void serve_conversions(struct server_state &state)
+{
+    Heif2JpgConverter converter;
+    struct heif2jpg_convert_options options;
+    std::unique_ptr<ServerJob> job;
+
+    options.cache = state.cache.get();
+
+    while (state.queue.pop(job)) {
+        state.queued--;
+        state.converting++;
+
+        auto start = std::chrono::steady_clock::now();
+        state.queue_latency.add(std::chrono::duration<double, std::milli>(start - job->queued).count());
+
+        struct server_result result;
+        options.encode_options = job->encode_options;
+        result.error = converter.convert(job->body.data(), job->body.size(), options,
+                                         result.jpeg);
+        /* Freed before the connection gives back its share of the body budget */
+        std::vector<uint8_t>().swap(job->body);
+
+        state.convert_latency.add(elapsed_ms(start));
+        state.converting--;
+        if (result.error)
+            state.failed++;
+        else
+            state.completed++;
+
+        job->result.set_value(std::move(result));
+    }
+}
+
+static std::string server_stats_json(struct server_state &state)
+{
+    std::string bounds = "[";
+    for (int i = 0; i < LATENCY_BUCKETS - 1; i++)
+        bounds += (i ? ", " : "") + std::to_string(1u << i);
+    bounds += "]";
+
+    size_t connections;
+    {
+        std::lock_guard<std::mutex> lock(state.connections_mutex);
+        connections = state.connections.size();
+    }
+
+    return "{\"workers\": " + std::to_string(state.num_workers) +
+           ", \"queue_capacity\": " + std::to_string(state.options.queue_depth) +
+           ", \"queued\": " + std::to_string(state.queued.load()) +
+           ", \"converting\": " + std::to_string(state.converting.load()) +
+           ", \"connections\": " + std::to_string(connections) +
+           ", \"max_connections\": " + std::to_string(state.options.max_connections) +
+           ", \"completed\": " + std::to_string(state.completed.load()) +
+           ", \"failed\": " + std::to_string(state.failed.load()) +
+           ", \"cache_hits\": " + std::to_string(state.cache ? state.cache->hits() : 0) +
+           ", \"cache_misses\": " + std::to_string(state.cache ? state.cache->misses() : 0) +
+           ", \"latency_bucket_ms\": " + bounds +
+           ", \"queue_latency\": " + state.queue_latency.json() +
+           ", \"convert_latency\": " + state.convert_latency.json() +
+           ", \"total_latency\": " + state.total_latency.json() + "}";
+}
+
+/* Answers requests on fd until the client hangs up or sends something bad */
+static void serve_connection(int fd, struct server_state &state)
+{
+    std::string line;
+    auto timeout = std::chrono::seconds(state.options.request_timeout);
+
+    /*
+     * The next request line, and then its body once there's room for it,
+     * must each arrive within the timeout, so idle or stalled clients don't
+     * hold on to a connection
+     */
+    Deadline deadline = std::chrono::steady_clock::now() + timeout;
+    while (read_line(fd, line, deadline)) {
+        std::istringstream words(line);
+        std::string command;
+        words >> command;
+
+        if (command == "STATS") {
+            std::string json = server_stats_json(state);
+            if (!send_ok(fd, json.data(), json.size()))
+                break;
+            deadline = std::chrono::steady_clock::now() + timeout;
+            continue;
+        }
+        if (command != "CONVERT") {
+            send_error(fd, 1, "unknown request");
+            break;
+        }
+
+        auto job = std::make_unique<ServerJob>();
+        job->encode_options = state.options.encode_options;
+        size_t body_size = 0;
+        std::string error;
+        if (!parse_convert_fields(words, job->encode_options, state.options.max_body_bytes,
+                                  body_size, error)) {
+            send_error(fd, 1, error);
+            break;
+        }
+
+        /* Held until the body is converted, so slow clients can't pile up bodies */
+        MemoryReservation reservation(*state.body_budget, body_size);
+        deadline = std::chrono::steady_clock::now() + timeout;
+        job->body.resize(body_size);
+        if (!read_full(fd, job->body.data(), body_size, deadline))
+            break;
+
+        /* A full queue blocks the client here rather than piling up requests */
+        auto received = std::chrono::steady_clock::now();
+        job->queued = received;
+        auto future = job->result.get_future();
+        state.queued++;
+        if (!state.queue.push(std::move(job))) {
+            state.queued--;
+            send_error(fd, 1, "shutting down");
+            break;
+        }
+
+        struct server_result result = future.get();
+        state.total_latency.add(elapsed_ms(received));
+
+        bool sent = result.error ? send_error(fd, result.error.code,
+                                              first_line(result.error.message)) :
+                                   send_ok(fd, result.jpeg.data(), result.jpeg.size());
+        if (!sent)
+            break;
+        deadline = std::chrono::steady_clock::now() + timeout;
+    }
+
+    std::lock_guard<std::mutex> lock(state.connections_mutex);
+    state.connections.erase(fd);
+    ::close(fd);
+    state.connections_done.notify_all();
+}
+
+/* Binds path, taking it over if it's a socket nothing is listening on */
+static int listen_on(const std::string &path)
+{
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "Socket path is too long: " << path << std::endl;
+        return -1;
+    }
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        std::cerr << "Can't create socket: " << strerror(errno) << std::endl;
+        return -1;
+    }
+
+    struct stat st;
+    if (::stat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+        if (::connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+            std::cerr << "Another server is already listening on " << path << std::endl;
+            ::close(fd);
+            return -1;
+        }
+        ::unlink(path.c_str());
+    }
+
+    if (::bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || ::listen(fd, SOMAXCONN) != 0) {
+        std::cerr << "Can't listen on " << path << ": " << strerror(errno) << std::endl;
+        ::close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int run_server(const struct heif2jpg_server_options &options)
+{
+    struct server_state state(options);
+
+    state.num_workers = options.num_workers;
+    if (state.num_workers == 0)
+        state.num_workers = std::max(1u, std::thread::hardware_concurrency());
+
+    if (!options.cache_dir.empty()) {
+        state.cache = std::make_unique<ConversionCache>(options.cache_dir,
+                                                        options.cache_max_bytes);
+        if (state.cache->open())
+            return 1;
+    }
+
+    /* Room for a full-size body per worker and queue slot */
+    state.body_budget = std::make_unique<MemoryBudget>(
+        (uint64_t)options.max_body_bytes * (state.num_workers + options.queue_depth));
+
+    int listen_fd = listen_on(options.socket_path);
+    if (listen_fd < 0)
+        return 1;
+
+    /* Clients that hang up mid-response shouldn't take the server down */
+    signal(SIGPIPE, SIG_IGN);
+    struct sigaction sa = {};
+    sa.sa_handler = request_stop;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+
+    std::vector<std::thread> workers;
+    for (unsigned int i = 0; i < state.num_workers; i++)
+        workers.emplace_back(serve_conversions, std::ref(state));
+
+    log_out() << "Serving on " << options.socket_path << " with " << state.num_workers
+              << " workers" << std::endl;
+
+    while (!stop_requested) {
+        /* At the limit, new clients wait in the listen backlog */
+        {
+            std::unique_lock<std::mutex> lock(state.connections_mutex);
+            if (options.max_connections &&
+                state.connections.size() >= options.max_connections) {
+                state.connections_done.wait_for(lock, std::chrono::milliseconds(250));
+                continue;
+            }
+        }
+
+        struct pollfd pfd = {listen_fd, POLLIN, 0};
+        if (::poll(&pfd, 1, 250) <= 0)
+            continue;
+
+        int fd = ::accept(listen_fd, nullptr, nullptr);
+        if (fd < 0)
+            continue;
+
+        std::lock_guard<std::mutex> lock(state.connections_mutex);
+        state.connections.insert(fd);
+        std::thread(serve_connection, fd, std::ref(state)).detach();
+    }
+
+    ::close(listen_fd);
+    ::unlink(options.socket_path.c_str());
+
+    /* Requests already queued are still answered; idle connections are woken and closed */
+    state.queue.close();
+    {
+        std::unique_lock<std::mutex> lock(state.connections_mutex);
+        for (int fd : state.connections)
+            ::shutdown(fd, SHUT_RD);
+        state.connections_done.wait(lock, [&] { return state.connections.empty(); });
+    }
+
+    for (auto &worker : workers)
+        worker.join();
+
+    log_out() << "Served " << state.completed.load() << " conversions, "
+              << state.failed.load() << " failed" << std::endl;
+
+    return 0;
+}
+#endif
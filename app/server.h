@@ -0,0 +1,69 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * Server mode: a long-running process that converts HEIF images sent over a
+ * Unix socket on a pool of warm workers
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#ifndef HEIF2JPG_SERVER_H
+#define HEIF2JPG_SERVER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "convert.h"
+
+/*
+ * Requests and responses on a connection, any number of them one after
+ * another. Each request is one line of space-separated words, then its body:
+ *
+ *   CONVERT size=<bytes> [quality=<0-100>] [width=<pixels>] [gamut=<0-2>]
+ *           [range=<0-1>] [transfer=<0-3>] [filter=lanczos|box]
+ *           [upconvert=<0|1>]
+ *     followed by size bytes of HEIF file. Fields left out take the server's
+ *     defaults, from its command line. The primary image is converted.
+ *
+ *   STATS
+ *     no body; answered with a JSON object of queue and latency counters.
+ *
+ * Each response is either "OK <bytes>\n" followed by that many bytes of jpeg
+ * or JSON, or "ERROR <code> <message>\n", with the code heif2jpg would exit
+ * with. A malformed request gets an error and the connection is closed, as
+ * does one that takes longer than the request timeout to arrive.
+ */
+
+struct heif2jpg_server_options {
+    std::string socket_path;
+    /* Conversions at once; 0 means one per hardware thread */
+    unsigned int num_workers;
+    /* Requests allowed to wait for a worker before connections block */
+    size_t queue_depth;
+    /*
+     * Largest request body accepted. Bodies are only read while the ones
+     * already in memory fit in this many bytes per worker and queue slot.
+     */
+    size_t max_body_bytes = (size_t)64 << 20;
+    /* Connections served at once; later ones wait to be accepted */
+    size_t max_connections = 64;
+    /*
+     * Seconds a connection may take to send its next request line, and then
+     * its body; it's closed when either runs out
+     */
+    unsigned int request_timeout = 60;
+    /* Used for whatever a request doesn't set */
+    struct heif2jpg_encode_options encode_options;
+    /* If set, outputs are cached in this directory, up to cache_max_bytes */
+    std::string cache_dir;
+    uint64_t cache_max_bytes = 0;
+};
+
+/*
+ * Listens on options.socket_path, replacing a stale socket file, until
+ * SIGINT or SIGTERM. Returns 0 after a clean shutdown, or 1 with an error
+ * printed if the socket can't be set up or servers aren't supported here.
+ */
+int run_server(const struct heif2jpg_server_options &options);
+
+#endif /* HEIF2JPG_SERVER_H */
@@ -0,0 +1,69 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * Per-conversion statistics, reported as one JSON record per file
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#include <cstdio>
+
+#include "stats.h"
+
+const char *heif_chroma_name(enum heif_chroma chroma)
+{
+    switch (chroma) {
+    case heif_chroma_420:
+        return "4:2:0";
+    case heif_chroma_422:
+        return "4:2:2";
+    case heif_chroma_444:
+        return "4:4:4";
+    case heif_chroma_monochrome:
+        return "monochrome";
+    case heif_chroma_interleaved_RGB:
+    case heif_chroma_interleaved_RGBA:
+    case heif_chroma_interleaved_RRGGBB_BE:
+    case heif_chroma_interleaved_RRGGBBAA_BE:
+    case heif_chroma_interleaved_RRGGBB_LE:
+    case heif_chroma_interleaved_RRGGBBAA_LE:
+        return "RGB";
+    default:
+        return "unknown";
+    }
+}
+
+std::string json_string(const std::string &s)
+{
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if ((unsigned char)c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+std::string conversion_stats_json(const struct heif2jpg_conversion_stats &stats)
+{
+    char numbers[512];
+
+    snprintf(numbers, sizeof(numbers),
+             "\"input_bytes\": %llu, \"output_bytes\": %llu, \"width\": %d, \"height\": %d, "
+             "\"bit_depth\": %d, \"chroma\": \"%s\", \"decoder\": \"%s\", \"cache_hit\": %s, "
+             "\"read_ms\": %.3f, \"decode_ms\": %.3f, \"pack_ms\": %.3f, \"encode_ms\": %.3f, "
+             "\"write_ms\": %.3f",
+             (unsigned long long)stats.input_bytes, (unsigned long long)stats.output_bytes,
+             stats.width, stats.height, stats.bit_depth, stats.chroma, stats.decoder,
+             stats.cache_hit ? "true" : "false", stats.read_ms, stats.decode_ms, stats.pack_ms,
+             stats.encode_ms, stats.write_ms);
+
+    return "{\"input\": " + json_string(stats.input_filename) +
+           ", \"output\": " + json_string(stats.output_filename) + ", " + numbers + "}";
+}
@@ -0,0 +1,56 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * Per-conversion statistics, reported as one JSON record per file
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#ifndef HEIF2JPG_STATS_H
+#define HEIF2JPG_STATS_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include <libheif/heif.h>
+
+/*
+ * Filled in by the conversion functions when they're given one. Times are
+ * wall-clock milliseconds; stages that didn't run stay at 0.
+ */
+struct heif2jpg_conversion_stats {
+    std::string input_filename;
+    std::string output_filename;
+    uint64_t input_bytes = 0;
+    uint64_t output_bytes = 0;
+    int width = 0;
+    int height = 0;
+    int bit_depth = 0;
+    const char *chroma = "unknown";
+    /* libheif decoder id that decoded the image, after any fallback */
+    const char *decoder = "unknown";
+    /* Written from the conversion cache; nothing was decoded or encoded */
+    bool cache_hit = false;
+    double read_ms = 0;
+    double decode_ms = 0;
+    double pack_ms = 0;
+    double encode_ms = 0;
+    double write_ms = 0;
+};
+
+/* "4:2:0", "4:2:2", "4:4:4", "monochrome", "RGB" or "unknown" */
+const char *heif_chroma_name(enum heif_chroma chroma);
+
+/* Milliseconds since start */
+inline double elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/* s as a quoted, escaped JSON string */
+std::string json_string(const std::string &s);
+
+/* The record as a single line of JSON, without a trailing newline */
+std::string conversion_stats_json(const struct heif2jpg_conversion_stats &stats);
+
+#endif /* HEIF2JPG_STATS_H */
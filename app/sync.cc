@@ -0,0 +1,228 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * Sync mode: mirror a directory tree of HEIF files as converted outputs,
+ * converting only the files that are new or changed since the last run
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+#include "cache.h"
+#include "log.h"
+#include "sync.h"
+#include "xxhash.h"
+
+namespace fs = std::filesystem;
+
+/* First line of the index, followed by the options id */
+#define SYNC_INDEX_HEADER "heif2jpg-sync 1"
+/* Seconds between rewrites of the index while files are converting */
+#define SYNC_INDEX_INTERVAL 30
+
+/* An input as it was when it was last converted */
+struct sync_entry {
+    int64_t mtime;
+    uint64_t size;
+};
+
+/* Keyed by path relative to the source directory, with '/' separators */
+using SyncIndex = std::unordered_map<std::string, struct sync_entry>;
+
+/* Identifies everything that decides what the outputs look like */
+static std::string sync_options_id(const struct heif2jpg_batch_options &options)
+{
+    struct heif2jpg_cache_params params;
+    params.encode_options = options.encode_options;
+    params.output_p010 = options.output_p010;
+    params.preview_width = options.preview_width;
+    params.images = options.images;
+
+    std::string description = ConversionCache::describe(params);
+    for (const auto &rendition : options.renditions)
+        description += " " + std::to_string(rendition.width) + ":" +
+                       std::to_string(rendition.quality);
+
+    char id[17];
+    snprintf(id, sizeof(id), "%016" PRIx64, xxh64(description.data(), description.size()));
+
+    return id;
+}
+
+/*
+ * Each line after the header is "<mtime>\t<size>\t<path>", with mtime in
+ * ticks of the filesystem clock. Returns false if there's no index, or it
+ * was written with other options.
+ */
+static bool read_sync_index(const std::string &index_filename, const std::string &options_id,
+                            SyncIndex &index)
+{
+    std::ifstream in(index_filename);
+    std::string line;
+
+    if (!std::getline(in, line) || line != SYNC_INDEX_HEADER " " + options_id)
+        return false;
+
+    while (std::getline(in, line)) {
+        size_t size_pos = line.find('\t');
+        size_t path_pos = size_pos == std::string::npos ? size_pos : line.find('\t', size_pos + 1);
+        if (path_pos == std::string::npos)
+            continue;
+
+        struct sync_entry entry;
+        entry.mtime = strtoll(line.c_str(), nullptr, 10);
+        entry.size = strtoull(line.c_str() + size_pos + 1, nullptr, 10);
+        index[line.substr(path_pos + 1)] = entry;
+    }
+
+    return true;
+}
+
+/* Replaces the index in one rename, so an interrupted write leaves the old one */
+static int write_sync_index(const std::string &index_filename, const std::string &options_id,
+                            const SyncIndex &index)
+{
+    std::string temp_filename = index_filename + ".tmp";
+    std::error_code ec;
+
+    /* Sorted, so the index diffs cleanly from one run to the next */
+    std::vector<const SyncIndex::value_type *> entries;
+    for (const auto &entry : index)
+        entries.push_back(&entry);
+    std::sort(entries.begin(), entries.end(),
+              [](const auto *a, const auto *b) { return a->first < b->first; });
+
+    FILE *file = fopen(temp_filename.c_str(), "wb");
+    bool ok = file != nullptr;
+    if (ok) {
+        fprintf(file, SYNC_INDEX_HEADER " %s\n", options_id.c_str());
+        for (const auto *entry : entries)
+            fprintf(file, "%" PRId64 "\t%" PRIu64 "\t%s\n", entry->second.mtime,
+                    entry->second.size, entry->first.c_str());
+        ok = fclose(file) == 0;
+    }
+    if (ok)
+        fs::rename(temp_filename, index_filename, ec);
+
+    if (!ok || ec) {
+        std::cerr << "Can't write sync index " << index_filename << std::endl;
+        fs::remove(temp_filename, ec);
+        return 13;
+    }
+
+    return 0;
+}
+
+int run_sync(const std::string &src_dir, const std::string &dst_dir,
+             const struct heif2jpg_batch_options &options)
+{
+    std::error_code ec;
+
+    if (!fs::is_directory(src_dir, ec)) {
+        std::cerr << "Can't sync from " << src_dir << ": not a directory" << std::endl;
+        return 2;
+    }
+    fs::create_directories(dst_dir, ec);
+    if (!fs::is_directory(dst_dir, ec)) {
+        std::cerr << "Can't sync to " << dst_dir << ": not a directory" << std::endl;
+        return 13;
+    }
+
+    std::string index_filename = (fs::path(dst_dir) / SYNC_INDEX_FILENAME).string();
+    std::string options_id = sync_options_id(options);
+    SyncIndex old_index, new_index;
+    bool have_index = read_sync_index(index_filename, options_id, old_index);
+
+    std::string suffix = output_suffix(options.output_p010, options.preview_width != 0);
+    std::vector<struct heif2jpg_pipeline_file> files;
+    /* Index entries for the files being converted, added once they're written */
+    std::unordered_map<std::string, std::pair<std::string, struct sync_entry>> pending;
+    std::set<fs::path> output_dirs;
+    size_t unchanged = 0;
+    /* Inputs found that were in the old index, changed or not */
+    size_t indexed = 0;
+
+    /* Only a stat per file, so an unchanged tree is rescanned quickly */
+    fs::recursive_directory_iterator it(src_dir, fs::directory_options::skip_permission_denied, ec);
+    for (fs::recursive_directory_iterator end; !ec && it != end; it.increment(ec)) {
+        std::error_code entry_ec;
+        if (!it->is_regular_file(entry_ec) || !has_heif_extension(it->path().string()))
+            continue;
+
+        struct sync_entry entry;
+        entry.mtime = it->last_write_time(entry_ec).time_since_epoch().count();
+        entry.size = it->file_size(entry_ec);
+        if (entry_ec)
+            continue;
+
+        std::string relative = it->path().lexically_relative(src_dir).generic_string();
+        auto old = old_index.find(relative);
+        indexed += old != old_index.end();
+        if (old != old_index.end() && old->second.mtime == entry.mtime &&
+            old->second.size == entry.size) {
+            new_index[relative] = entry;
+            unchanged++;
+            continue;
+        }
+
+        fs::path output = fs::path(dst_dir) / derive_output_filename(relative, suffix);
+        output_dirs.insert(output.parent_path());
+        files.push_back({it->path().string(), output.string()});
+        pending[it->path().string()] = {relative, entry};
+    }
+    if (ec) {
+        std::cerr << "Can't read directory " << src_dir << ": " << ec.message() << std::endl;
+        return 2;
+    }
+
+    size_t removed = old_index.size() - indexed;
+
+    std::ostream &out = options.stats ? std::cerr : log_out();
+    out << "Sync: " << files.size() << " new or changed, " << unchanged << " unchanged, "
+        << removed << " removed" << (have_index ? "" : " (no index for these options)")
+        << std::endl;
+
+    int ret = 0;
+    if (!files.empty()) {
+        for (const auto &dir : output_dirs)
+            fs::create_directories(dir, ec);
+
+        /*
+         * Inputs are indexed as they finish, and the index is rewritten now
+         * and then, so a long sync that's interrupted keeps its progress
+         */
+        auto last_write = std::chrono::steady_clock::now();
+        struct heif2jpg_batch_options batch_options = options;
+        batch_options.converted = [&](const std::string &input_filename) {
+            auto converted = pending.find(input_filename);
+            if (converted == pending.end())
+                return;
+            new_index[converted->second.first] = converted->second.second;
+
+            auto now = std::chrono::steady_clock::now();
+            if (now - last_write >= std::chrono::seconds(SYNC_INDEX_INTERVAL)) {
+                write_sync_index(index_filename, options_id, new_index);
+                last_write = now;
+            }
+        };
+        ret = run_batch_files(files, batch_options);
+    }
+
+    /* Nothing to record if nothing changed */
+    if (files.empty() && !removed && have_index)
+        return ret;
+
+    int index_ret = write_sync_index(index_filename, options_id, new_index);
+
+    return ret ? ret : index_ret;
+}
@@ -0,0 +1,38 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * Sync mode: mirror a directory tree of HEIF files as converted outputs,
+ * converting only the files that are new or changed since the last run
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#ifndef HEIF2JPG_SYNC_H
+#define HEIF2JPG_SYNC_H
+
+#include <string>
+
+#include "batch.h"
+
+/* Written to the top of dst_dir; delete it to convert everything again */
+#define SYNC_INDEX_FILENAME ".heif2jpg-sync"
+
+/*
+ * Converts every .heic/.heif/.hif file under src_dir to the same relative
+ * path under dst_dir, named as derive_output_filename() does, through the
+ * batch pipeline. options.output_dir is ignored.
+ *
+ * The modification time and size of each converted input is recorded in an
+ * index in dst_dir, along with the options that shape the outputs. Inputs
+ * that match their index entry are skipped on later runs; if the options
+ * have changed, everything is converted again. Inputs that have gone are
+ * dropped from the index, but their outputs are left in place.
+ *
+ * Returns 0 if every changed file converted, or the exit code of the last
+ * failure. Only inputs whose outputs were all written are indexed, so failed
+ * files are retried next time. The index is also rewritten every so often
+ * during the conversion, so an interrupted run keeps most of its progress.
+ */
+int run_sync(const std::string &src_dir, const std::string &dst_dir,
+             const struct heif2jpg_batch_options &options);
+
+#endif /* HEIF2JPG_SYNC_H */
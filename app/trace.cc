@@ -0,0 +1,149 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * Chrome trace events (--trace) for the conversion stages of every file on
+ * every thread. Compiled out unless built with -DHEIF2JPG_WITH_TRACING=ON.
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+#include "stats.h"
+#include "trace.h"
+
+#ifdef HEIF2JPG_TRACING
+
+std::atomic<bool> trace_active{false};
+
+struct trace_event {
+    const char *name;
+    /* 'X' for spans, 'i' for instants and 'M' for thread names */
+    char phase;
+    int tid;
+    double ts_us;
+    double dur_us;
+    std::string args;
+};
+
+/* Events are only appended under the lock; it's written out once at the end */
+static std::mutex trace_mutex;
+static std::vector<struct trace_event> trace_events;
+static std::chrono::steady_clock::time_point trace_start;
+static std::atomic<int> next_trace_tid{1};
+
+/* Small, stable thread ids, numbered in the order threads first record */
+static int trace_tid()
+{
+    thread_local int tid = next_trace_tid++;
+    return tid;
+}
+
+static double trace_us(std::chrono::steady_clock::time_point t)
+{
+    return std::chrono::duration<double, std::micro>(t - trace_start).count();
+}
+
+static void add_trace_event(struct trace_event event)
+{
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    trace_events.push_back(std::move(event));
+}
+
+void trace_thread_name(const char *name)
+{
+    if (trace_enabled())
+        add_trace_event({"thread_name", 'M', trace_tid(), 0, 0,
+                         "{\"name\": " + json_string(name) + "}"});
+}
+
+void trace_instant(const char *name, const std::string &args)
+{
+    if (trace_enabled())
+        add_trace_event({name, 'i', trace_tid(),
+                         trace_us(std::chrono::steady_clock::now()), 0, args});
+}
+
+TraceSpan::TraceSpan(const char *name, const std::string *file)
+    : name_(name), active_(trace_enabled())
+{
+    if (!active_)
+        return;
+    if (file)
+        file_ = *file;
+    start_ = std::chrono::steady_clock::now();
+}
+
+TraceSpan::~TraceSpan()
+{
+    if (!active_)
+        return;
+
+    auto end = std::chrono::steady_clock::now();
+    add_trace_event({name_, 'X', trace_tid(), trace_us(start_),
+                     std::chrono::duration<double, std::micro>(end - start_).count(),
+                     file_.empty() ? std::string() :
+                                     "{\"file\": " + json_string(file_) + "}"});
+}
+
+int TraceSession::start(const std::string &filename)
+{
+    file_ = fopen(filename.c_str(), "wb");
+    if (!file_) {
+        std::cerr << "Can't create trace " << filename << ": " << strerror(errno) << std::endl;
+        return 1;
+    }
+
+    filename_ = filename;
+    trace_start = std::chrono::steady_clock::now();
+    trace_active = true;
+    trace_thread_name("main");
+
+    return 0;
+}
+
+TraceSession::~TraceSession()
+{
+    if (!file_)
+        return;
+
+    trace_active = false;
+    std::lock_guard<std::mutex> lock(trace_mutex);
+
+    fprintf(file_, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    for (size_t i = 0; i < trace_events.size(); i++) {
+        const struct trace_event &event = trace_events[i];
+
+        fprintf(file_, "{\"name\": %s, \"ph\": \"%c\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f",
+                json_string(event.name).c_str(), event.phase, event.tid, event.ts_us);
+        if (event.phase == 'X')
+            fprintf(file_, ", \"dur\": %.3f", event.dur_us);
+        else if (event.phase == 'i')
+            fprintf(file_, ", \"s\": \"t\"");
+        if (!event.args.empty())
+            fprintf(file_, ", \"args\": %s", event.args.c_str());
+        fprintf(file_, "}%s\n", i + 1 < trace_events.size() ? "," : "");
+    }
+    fprintf(file_, "]}\n");
+
+    if (fclose(file_) != 0)
+        std::cerr << "Can't write trace " << filename_ << std::endl;
+    trace_events.clear();
+}
+
+#else
+
+TraceSession::~TraceSession() {}
+
+int TraceSession::start(const std::string &filename)
+{
+    std::cerr << "Can't write " << filename << ": heif2jpg was built without tracing; "
+                 "configure it with -DHEIF2JPG_WITH_TRACING=ON" << std::endl;
+    return 1;
+}
+
+#endif /* HEIF2JPG_TRACING */
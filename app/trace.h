@@ -0,0 +1,103 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * Chrome trace events (--trace) for the conversion stages of every file on
+ * every thread. Compiled out unless built with -DHEIF2JPG_WITH_TRACING=ON.
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#ifndef HEIF2JPG_TRACE_H
+#define HEIF2JPG_TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+/*
+ * Records events from every thread from start() until the session is
+ * destroyed, then writes them to a trace-event JSON file that
+ * chrome://tracing and ui.perfetto.dev open. Only one session at a time.
+ */
+class TraceSession
+{
+public:
+    TraceSession() = default;
+    /* Writes the trace, if one was started; failures are printed */
+    ~TraceSession();
+
+    TraceSession(const TraceSession &) = delete;
+    TraceSession &operator=(const TraceSession &) = delete;
+
+    /*
+     * Creates filename now, so a bad path fails before any work is done.
+     * Returns 0, or 1 with an error printed if it can't be created or
+     * tracing isn't built in.
+     */
+    int start(const std::string &filename);
+
+private:
+    std::string filename_;
+    FILE *file_ = nullptr;
+};
+
+#ifdef HEIF2JPG_TRACING
+
+extern std::atomic<bool> trace_active;
+
+/* True while a session is recording */
+inline bool trace_enabled()
+{
+    return trace_active.load(std::memory_order_relaxed);
+}
+
+/* Names the calling thread in the trace, e.g. after its pipeline stage */
+void trace_thread_name(const char *name);
+
+/* A point in time on the calling thread; args is a JSON object or empty */
+void trace_instant(const char *name, const std::string &args = std::string());
+
+/*
+ * A span on the calling thread from construction to destruction. name must
+ * outlive the session, as literals do; file is copied into the span's args.
+ */
+class TraceSpan
+{
+public:
+    explicit TraceSpan(const char *name) : TraceSpan(name, nullptr) {}
+    TraceSpan(const char *name, const std::string &file) : TraceSpan(name, &file) {}
+    ~TraceSpan();
+
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+
+private:
+    TraceSpan(const char *name, const std::string *file);
+
+    const char *name_;
+    bool active_;
+    std::string file_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+#else
+
+/* Without tracing built in, these all compile away */
+constexpr bool trace_enabled()
+{
+    return false;
+}
+
+inline void trace_thread_name(const char *) {}
+inline void trace_instant(const char *, const std::string & = std::string()) {}
+
+class TraceSpan
+{
+public:
+    explicit TraceSpan(const char *) {}
+    TraceSpan(const char *, const std::string &) {}
+};
+
+#endif /* HEIF2JPG_TRACING */
+
+#endif /* HEIF2JPG_TRACE_H */
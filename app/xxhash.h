@@ -0,0 +1,21 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * XXH64, a fast non-cryptographic 64-bit hash, for keying cached outputs
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#ifndef HEIF2JPG_XXHASH_H
+#define HEIF2JPG_XXHASH_H
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * The XXH64 hash of size bytes at data. Results match the reference
+ * implementation's XXH64() for the same seed, so they can be checked with
+ * e.g. xxhsum -H64.
+ */
+uint64_t xxh64(const void *data, size_t size, uint64_t seed = 0);
+
+#endif /* HEIF2JPG_XXHASH_H */
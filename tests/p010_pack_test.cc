@@ -0,0 +1,152 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/**
+ * Checks that every SIMD P010 kernel the build has matches the scalar ones
+ * bit for bit, across row lengths and source/destination misalignments
+ *
+ *   Copyright (c) 2025 Eric Joyner <erj@erj.cc>
+ */
+
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "p010_pack.h"
+
+/* Long enough to cover every kernel's vector loop, tail and 2x unrolling */
+static const size_t max_length = 300;
+/* Element offsets tried for sources and destination */
+static const size_t max_offset = 8;
+
+static std::mt19937 rng(2025);
+
+/* Random 10-bit samples, with padding for the largest offset */
+static std::vector<uint16_t> random_row10(size_t n)
+{
+    std::uniform_int_distribution<int> dist(0, 1023);
+    std::vector<uint16_t> row(n + max_offset);
+    for (auto &sample : row)
+        sample = (uint16_t)dist(rng);
+    return row;
+}
+
+static std::vector<uint8_t> random_row8(size_t n)
+{
+    std::uniform_int_distribution<int> dist(0, 255);
+    std::vector<uint8_t> row(n + max_offset);
+    for (auto &sample : row)
+        sample = (uint8_t)dist(rng);
+    return row;
+}
+
+static int failures;
+
+static void check(const char *kernels, const char *kernel, size_t n, size_t offset,
+                  const std::vector<uint16_t> &expected, const std::vector<uint16_t> &actual)
+{
+    if (expected == actual)
+        return;
+
+    size_t i = 0;
+    while (expected[i] == actual[i])
+        i++;
+    fprintf(stderr, "%s %s: n=%zu offset=%zu differs at %zu: %#x != %#x\n", kernels, kernel,
+            n, offset, i, actual[i], expected[i]);
+    failures++;
+}
+
+/*
+ * Runs one of the chroma downsampling kernels from both sets; source rows are
+ * src_scale * n samples long
+ */
+template <typename T, typename Kernel>
+static void check_uv_downsample(const struct p010_pack_kernels &kernels, const char *name,
+                                Kernel p010_pack_kernels::*kernel,
+                                std::vector<T> (*random_row)(size_t), size_t src_scale,
+                                size_t n, size_t offset)
+{
+    std::vector<T> cb0 = random_row(src_scale * n), cr0 = random_row(src_scale * n);
+    std::vector<T> cb1 = random_row(src_scale * n), cr1 = random_row(src_scale * n);
+    std::vector<uint16_t> expected(2 * n + max_offset), actual(2 * n + max_offset);
+
+    (p010_scalar_kernels.*kernel)(cb0.data() + offset, cr0.data() + offset, cb1.data() + offset,
+                                  cr1.data() + offset, expected.data() + offset, n);
+    (kernels.*kernel)(cb0.data() + offset, cr0.data() + offset, cb1.data() + offset,
+                      cr1.data() + offset, actual.data() + offset, n);
+    check(kernels.name, name, n, offset, expected, actual);
+
+    /* The same row twice, as at an odd bottom edge */
+    (p010_scalar_kernels.*kernel)(cb0.data() + offset, cr0.data() + offset, cb0.data() + offset,
+                                  cr0.data() + offset, expected.data() + offset, n);
+    (kernels.*kernel)(cb0.data() + offset, cr0.data() + offset, cb0.data() + offset,
+                      cr0.data() + offset, actual.data() + offset, n);
+    check(kernels.name, name, n, offset, expected, actual);
+}
+
+static void check_kernels(const struct p010_pack_kernels &kernels)
+{
+    int failures_before = failures;
+
+    for (size_t n = 0; n <= max_length; n++) {
+        for (size_t offset = 0; offset < max_offset; offset++) {
+            std::vector<uint16_t> expected(2 * n + max_offset), actual(2 * n + max_offset);
+
+            std::vector<uint16_t> y = random_row10(n);
+            p010_scalar_kernels.pack_y(y.data() + offset, expected.data() + offset, n);
+            kernels.pack_y(y.data() + offset, actual.data() + offset, n);
+            check(kernels.name, "pack_y", n, offset, expected, actual);
+
+            /* pack_y is also run in place */
+            std::vector<uint16_t> in_place = y;
+            kernels.pack_y(in_place.data() + offset, in_place.data() + offset, n);
+            check(kernels.name, "pack_y in place", n, offset,
+                  std::vector<uint16_t>(expected.begin() + offset, expected.begin() + offset + n),
+                  std::vector<uint16_t>(in_place.begin() + offset, in_place.begin() + offset + n));
+
+            std::vector<uint16_t> cb = random_row10(n), cr = random_row10(n);
+            p010_scalar_kernels.pack_uv(cb.data() + offset, cr.data() + offset,
+                                        expected.data() + offset, n);
+            kernels.pack_uv(cb.data() + offset, cr.data() + offset, actual.data() + offset, n);
+            check(kernels.name, "pack_uv", n, offset, expected, actual);
+
+            std::vector<uint8_t> y8 = random_row8(n);
+            p010_scalar_kernels.pack_y8(y8.data() + offset, expected.data() + offset, n);
+            kernels.pack_y8(y8.data() + offset, actual.data() + offset, n);
+            check(kernels.name, "pack_y8", n, offset, expected, actual);
+
+            std::vector<uint8_t> cb8 = random_row8(n), cr8 = random_row8(n);
+            p010_scalar_kernels.pack_uv8(cb8.data() + offset, cr8.data() + offset,
+                                         expected.data() + offset, n);
+            kernels.pack_uv8(cb8.data() + offset, cr8.data() + offset, actual.data() + offset, n);
+            check(kernels.name, "pack_uv8", n, offset, expected, actual);
+
+            check_uv_downsample(kernels, "pack_uv_422", &p010_pack_kernels::pack_uv_422,
+                                random_row10, 1, n, offset);
+            check_uv_downsample(kernels, "pack_uv_444", &p010_pack_kernels::pack_uv_444,
+                                random_row10, 2, n, offset);
+            check_uv_downsample(kernels, "pack_uv8_422", &p010_pack_kernels::pack_uv8_422,
+                                random_row8, 1, n, offset);
+            check_uv_downsample(kernels, "pack_uv8_444", &p010_pack_kernels::pack_uv8_444,
+                                random_row8, 2, n, offset);
+        }
+    }
+
+    printf("%s: %s\n", kernels.name, failures > failures_before ? "FAILED" : "ok");
+}
+
+int main()
+{
+#if defined(__x86_64__) || defined(_M_X64)
+    check_kernels(p010_sse2_kernels);
+#endif
+#ifdef HEIF2JPG_HAVE_AVX2
+    if (cpu_has_avx2())
+        check_kernels(p010_avx2_kernels);
+    else
+        printf("%s: skipped, the CPU doesn't support AVX2\n", p010_avx2_kernels.name);
+#endif
+#if defined(__aarch64__) || defined(_M_ARM64)
+    check_kernels(p010_neon_kernels);
+#endif
+
+    return failures ? 1 : 0;
+}